@@ -0,0 +1,54 @@
+#! /bin/bash
+# Profile-guided, link-time optimized build.
+#
+# Builds a plain -O3 baseline, then an instrumented build that is trained by
+# replaying the bundled telemetry corpus (data/pgo) and closed-loop laps,
+# then rebuilds with the profiles and LTO and compares the two on the
+# benchmarks. The optimized binaries end up in build-pgo/use.
+#
+#   ./pgo.sh [corpus logs...]
+set -e
+cd "$(dirname "$0")"
+root=$PWD
+corpus=("$@")
+if [ ${#corpus[@]} -eq 0 ]; then
+  corpus=("$root"/data/pgo/*.log)
+fi
+jobs=$(nproc)
+profile=$root/build-pgo/profile
+
+# baseline
+mkdir -p build-pgo/base
+(cd build-pgo/base && cmake "$root" > /dev/null && make -j"$jobs")
+
+# instrumented build, trained on the corpus
+rm -rf "$profile"
+mkdir -p build-pgo/use
+(cd build-pgo/use && cmake "$root" -DMPC_PGO=generate -DMPC_PGO_DIR="$profile" > /dev/null &&
+ make clean && make -j"$jobs")
+echo "Training on ${#corpus[@]} logs"
+(cd build-pgo/use && ./mpc_farm -j "$jobs" --laps 8 --track "$root/lake_track_waypoints.csv" "${corpus[@]}" > /dev/null &&
+ ./model_bench 100 100000 "$root/lake_track_waypoints.csv" > /dev/null)
+
+# rebuilt in the same directory, the profiles are found by object path
+(cd build-pgo/use && cmake "$root" -DMPC_PGO=use -DMPC_PGO_DIR="$profile" > /dev/null &&
+ make clean && make -j"$jobs")
+
+# wall time of a benchmark in both builds
+bench() {
+  local name=$1
+  shift
+  local times=()
+  for build in base use; do
+    local start=$(date +%s.%N)
+    (cd build-pgo/$build && "$@" > /dev/null 2>&1)
+    times+=($(echo "$start $(date +%s.%N)" | awk '{print $2 - $1}'))
+  done
+  echo "${times[0]} ${times[1]}" |
+    awk -v name="$name" '{printf "%-16s %9.2f %9.2f %7.2fx\n", name, $1, $2, $1 / $2}'
+}
+printf "%-16s %9s %9s %8s\n" benchmark base_s pgo_s speedup
+bench replay ./mpc_farm -j 1 "${corpus[@]}"
+bench laps ./mpc_farm -j 1 --laps 2 --track "$root/lake_track_waypoints.csv"
+bench model_bench ./model_bench 200 1000000 "$root/lake_track_waypoints.csv"
+bench batch_bench ./batch_bench 16 1 100 "$root/lake_track_waypoints.csv"
@@ -1,53 +1,105 @@
 #include "MPC.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include <cppad/cppad.hpp>
 #include <cppad/ipopt/solve.hpp>
 #include "Eigen-3.3/Eigen/Core"
+#include "cost.h"
+#include "guess.h"
+#include "layout.h"
+#include "riccati.h"
+#include "stage_nlp.h"
+#include "stage_pool.h"
+#include "terminal_cost.h"
+#include "vehicle_model.h"
 
 using CppAD::AD;
 
-// Set the timestep length and duration
-size_t N = 10;
-double dt = 0.12;
-
-// set the length from front to CoG that has a similar radius.
-const double Lf = 2.67;
-
-// set the reference velocity
-double ref_v = 80;
-// set the reference cross track error and orientation error 
-// even they all 0
-double ref_cte = 0.0;
-double ref_epsi = 0.0; 
-
-// set weights to each component of the cost function 
-// be tuned based on the relative importance of each part
-double weight_cet = 1500.0;
-double weight_epsi = 1000.0;
-double weight_constant_vel = 1.0;
-double weight_delta = 20.0;
-double weight_a = 40.0;
-double weight_delta_diff = 40.0;
-double weight_a_diff = 80.0;
-
-// The IPOPT solver takes all the state variables and actuator
-// variables in a singular vector. Thus, variables were established 
-// in a way that one variable was starts and another ends.
-size_t x_start = 0;
-size_t y_start = x_start + N;
-size_t psi_start = y_start + N;
-size_t v_start = psi_start + N;
-size_t cte_start = v_start + N;
-size_t epsi_start = cte_start + N;
-size_t delta_start = epsi_start + N;
-size_t a_start = delta_start + N - 1;
-
-class FG_eval {
+// definitions of the model constants, see vehicle_model.h
+constexpr double KinematicModel::Lf;
+constexpr double DynamicModel::Lf;
+constexpr double DynamicModel::Lr;
+constexpr double DynamicModel::m;
+constexpr double DynamicModel::Iz;
+constexpr double DynamicModel::Cf;
+constexpr double DynamicModel::Cr;
+constexpr double DynamicModel::min_speed;
+
+// FG_eval sees the config (N, dt, weights) and the layout as its own
+// members, so the cost and model below read like the equations.
+template <class Model>
+class FG_eval : public MPCConfig, public VarLayout {
  public:
   Eigen::VectorXd coeffs;
+  // obstacles to keep clear of, in the car frame
+  const vector<Obstacle> &obstacles;
+  // CppAD memory in use once the tape is recorded
+  size_t tape_bytes = 0;
+  // weights of the errors (cte, epsi) at the last stage, see
+  // terminal_cost.h
+  bool has_terminal = false;
+  Eigen::Matrix2d terminal_weight;
+  // Without cte and epsi variables (MPCConfig::formulation), the errors
+  // the horizon starts from, and the layout with them the cost is
+  // written for.
+  bool reduced;
+  double cte0 = 0.0;
+  double epsi0 = 0.0;
+  VarLayout full;
   // Coefficients of the fitted polynomial.
-  FG_eval(Eigen::VectorXd coeffs) { this->coeffs = coeffs; }
+  FG_eval(Eigen::VectorXd coeffs, const MPCConfig &config,
+          const vector<Obstacle> &obstacles)
+      : MPCConfig(config),
+        VarLayout(config.N, Model::n_state, config.formulation != "reduced"),
+        obstacles(obstacles),
+        reduced(config.formulation == "reduced"),
+        full(config.N, Model::n_state) {
+    this->coeffs = coeffs;
+  }
 
   typedef CPPAD_TESTVECTOR(AD<double>) ADvector;
+
+  // The reduced formulation's variables in the full layout. cte and epsi
+  // follow from the states the way the full formulation's constraints
+  // define them, so both formulations have the same cost:
+  // cte[t+1] = f(x[t]) - y[t] + (speed across the reference) * dt
+  // epsi[t+1] = psi[t+1] - psides[t]
+  ADvector WithErrors(const ADvector &vars) const {
+    ADvector all(full.a_start + N - 1);
+    for (size_t i = 0; i < delta_start; i++) {
+      all[i] = vars[i];
+    }
+    for (size_t i = 0; i < 2 * (N - 1); i++) {
+      all[full.delta_start + i] = vars[delta_start + i];
+    }
+    all[full.cte_start] = cte0;
+    all[full.epsi_start] = epsi0;
+    for (size_t t = 1; t < N; t++) {
+      if (Model::integrated_errors) {
+        AD<double> s1[Model::n_state];
+        for (size_t k = 0; k < Model::n_state; k++) {
+          s1[k] = vars[k * N + t];
+        }
+        ReferenceErrors<Model>(coeffs, s1, &all[full.cte_start + t],
+                               &all[full.epsi_start + t]);
+        continue;
+      }
+      AD<double> s0[Model::n_state];
+      for (size_t k = 0; k < Model::n_state; k++) {
+        s0[k] = vars[k * N + t - 1];
+      }
+      AD<double> x0 = s0[Model::X];
+      AD<double> f0 = coeffs[0] + coeffs[1] * x0 + coeffs[2] * x0 * x0 + coeffs[3] * x0 * x0 * x0;
+      AD<double> psides0 = CppAD::atan(coeffs[1] + 2 * coeffs[2] * x0 + 3 * coeffs[3] * x0 * x0);
+      all[full.cte_start + t] =
+          (f0 - s0[Model::Y]) +
+          Model::cte_rate(s0, all[full.epsi_start + t - 1]) * dt;
+      all[full.epsi_start + t] = vars[psi_start + t] - psides0;
+    }
+    return all;
+  }
+
   // `fg` is a vector containing the cost function and vehicle model/constraints.
   // `vars` is a vector containing the variable values used by the cost funciton 
   // and model(state & actuators).
@@ -67,23 +119,26 @@ class FG_eval {
 
     In each iteration through the loop, we sum three components to reach the 
     aggregate cost: our cross-track error, our heading error, and our velocity error.
+    We also minimize the use of actuators and the value gap between
+    sequential actuations, see ControllerCost.
     */
-    for (int t = 0; t < N; t++) {
-      fg[0] += weight_cet * CppAD::pow(vars[cte_start + t] - ref_cte, 2);
-      fg[0] += weight_epsi * CppAD::pow(vars[epsi_start + t] - ref_epsi, 2);
-      fg[0] += weight_constant_vel * CppAD::pow(vars[v_start + t] - ref_v, 2); // avoid stopping
-    }
-
-    // Minimize the use of actuators.
-    for (int t = 0; t < N - 1; t++) {
-      fg[0] += weight_delta * CppAD::pow(vars[delta_start + t], 2);
-      fg[0] += weight_a * CppAD::pow(vars[a_start + t], 2);
+    ADvector with_errors;
+    if (reduced) {
+      with_errors = WithErrors(vars);
     }
-
-    // Minimize the value gap between sequential actuations.
-    for (int t = 0; t < N - 2; t++) {
-      fg[0] += weight_delta_diff * CppAD::pow(vars[delta_start + t + 1] - vars[delta_start + t], 2);
-      fg[0] += weight_a_diff * CppAD::pow(vars[a_start + t + 1] - vars[a_start + t], 2);
+    const ADvector &all = reduced ? with_errors : vars;
+    const VarLayout &layout = reduced ? full : *this;
+    fg[0] = ControllerCost::Eval<AD<double>>(layout, *this, all);
+
+    // what driving on beyond the horizon is expected to cost
+    if (has_terminal) {
+      AD<double> e[2] = {all[layout.cte_start + N - 1] - ref_cte,
+                         all[layout.epsi_start + N - 1] - ref_epsi};
+      for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+          fg[0] += terminal_weight(i, j) * e[i] * e[j];
+        }
+      }
     }
 
     //
@@ -92,130 +147,130 @@ class FG_eval {
     // We add 1 to each of the starting indices due to cost being located at
     // index 0 of `fg`.
     // This bumps up the position of all the other values.
-    fg[1 + x_start] = vars[x_start];
-    fg[1 + y_start] = vars[y_start];
-    fg[1 + psi_start] = vars[psi_start];
-    fg[1 + v_start] = vars[v_start];
-    fg[1 + cte_start] = vars[cte_start];
-    fg[1 + epsi_start] = vars[epsi_start];
+    // Every state block, the model's and cte, epsi if carried, is N long.
+    for (size_t start = x_start; start < delta_start; start += N) {
+      fg[1 + start] = vars[start];
+    }
 
     // The rest of the constraints
     for (int t = 1; t < N; t++) {
-      // The state at time t+1 .
-      AD<double> x1 = vars[x_start + t];
-      AD<double> y1 = vars[y_start + t];
-      AD<double> psi1 = vars[psi_start + t];
-      AD<double> v1 = vars[v_start + t];
-      AD<double> cte1 = vars[cte_start + t];
-      AD<double> epsi1 = vars[epsi_start + t];
-
-      // The state at time t.
-      AD<double> x0 = vars[x_start + t - 1];
-      AD<double> y0 = vars[y_start + t - 1];
-      AD<double> psi0 = vars[psi_start + t - 1];
-      AD<double> v0 = vars[v_start + t - 1];
-      AD<double> cte0 = vars[cte_start + t - 1];
-      AD<double> epsi0 = vars[epsi_start + t - 1];
+      // The model state at time t, and what the model predicts for t+1.
+      AD<double> s0[Model::n_state];
+      AD<double> s1[Model::n_state];
+      for (size_t k = 0; k < Model::n_state; k++) {
+        s0[k] = vars[k * N + t - 1];
+      }
+      AD<double> x0 = s0[Model::X];
+      AD<double> y0 = s0[Model::Y];
+      AD<double> psi0 = s0[Model::PSI];
 
       // Only consider the actuation at time t.
-      AD<double> delta0 = vars[delta_start + t - 1];
-      AD<double> a0 = vars[a_start + t - 1];
+      AD<double> u0[Model::n_input];
+      u0[Model::DELTA] = vars[delta_start + t - 1];
+      u0[Model::A] = vars[a_start + t - 1];
+
+      Model::step(s0, u0, dt, s1);
+
+      // The idea here is to constraint the gap between the state at t+1
+      // and the model's prediction to be 0, see vehicle_model.h for the
+      // equations of the model.
+      for (size_t k = 0; k < Model::n_state; k++) {
+        fg[1 + k * N + t] = vars[k * N + t] - s1[k];
+      }
+      if (reduced) {
+        continue;
+      }
+      // rk2, rk4 and euler_integrated take the errors of the integrated
+      // state, see vehicle_model.h
+      if (Model::integrated_errors) {
+        AD<double> cte1, epsi1;
+        ReferenceErrors<Model>(coeffs, s1, &cte1, &epsi1);
+        fg[1 + cte_start + t] = vars[cte_start + t] - cte1;
+        fg[1 + epsi_start + t] = vars[epsi_start + t] - epsi1;
+        continue;
+      }
 
       // 3rd order polynomial fitting 
       AD<double> f0 = coeffs[0] + coeffs[1] * x0 + coeffs[2] * x0 * x0 + coeffs[3] * x0 * x0 *x0;
       AD<double> psides0 = CppAD::atan(coeffs[1] + 2 * coeffs[2] * x0 + 3 * coeffs[3] * x0 * x0);
 
-      // Here's `x` to get you started.
-      // The idea here is to constraint this value to be 0.
-      //
-      // Recall the equations for the model:
-      // x_[t+1] = x[t] + v[t] * cos(psi[t]) * dt
-      // y_[t+1] = y[t] + v[t] * sin(psi[t]) * dt
-      // psi_[t+1] = psi[t] + v[t] / Lf * delta[t] * dt
-      // v_[t+1] = v[t] + a[t] * dt
-      // cte[t+1] = f(x[t]) - y[t] + v[t] * sin(epsi[t]) * dt
-      // epsi[t+1] = psi[t] - psides[t] + v[t] * delta[t] / Lf * dt
-      fg[1 + x_start + t] = x1 - (x0 + v0 * CppAD::cos(psi0) * dt);
-      fg[1 + y_start + t] = y1 - (y0 + v0 * CppAD::sin(psi0) * dt);
-      fg[1 + psi_start + t] = psi1 - (psi0 + v0 * delta0 / Lf * dt);
-      fg[1 + v_start + t] = v1 - (v0 + a0 * dt);
+      // The errors follow the model:
+      // cte[t+1] = f(x[t]) - y[t] + (speed across the reference) * dt
+      // epsi[t+1] = psi[t] - psides[t] + (psi[t+1] - psi[t])
+      AD<double> epsi0 = vars[epsi_start + t - 1];
       fg[1 + cte_start + t] =
-          cte1 - ((f0 - y0) + (v0 * CppAD::sin(epsi0) * dt));
+          vars[cte_start + t] - ((f0 - y0) + Model::cte_rate(s0, epsi0) * dt);
       fg[1 + epsi_start + t] =
-          epsi1 - ((psi0 - psides0) + v0 * delta0 / Lf * dt);
+          vars[epsi_start + t] - ((psi0 - psides0) + (s1[Model::PSI] - psi0));
+    }
+
+    // Obstacle constraints after the model's: the squared distance from
+    // every predicted position to every obstacle, bounded below by
+    // (radius + margin)^2 in Solve().
+    size_t row = 1 + delta_start;
+    for (const auto &o : obstacles) {
+      for (size_t t = 1; t < N; t++) {
+        AD<double> dx = vars[x_start + t] - o.x;
+        AD<double> dy = vars[y_start + t] - o.y;
+        fg[row++] = dx * dx + dy * dy;
+      }
     }
+    tape_bytes = CppAD::thread_alloc::inuse(CppAD::thread_alloc::thread_num());
   }
 };
 
-//
-// MPC class definition implementation.
-//
-MPC::MPC() {}
-MPC::~MPC() {}
-
-vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
-  bool ok = true;
-  size_t i;
-  typedef CPPAD_TESTVECTOR(double) Dvector;
-
-  /*
-  Take of the plant latency problem 
-  */
-  // retrive states [x,y,ψ,v,cte,eψ] and actutations [δ,a] from Eigen::VectorXd state
-  double x = state[0];
-  double y = state[1];
-  double psi = state[2];
-  double v = state[3];
-  double cte = state[4];
-  double epsi = state[5];
-  // set the actuations
-  double delta = 0.0;
-  double a = 0.0;
-
-  // solving the latency problem by predicting states (current + latency) using process model
-  // before sending these states to solver
-  double latency_dt = 0.1;
-  double x_new = x + v * cos(psi) * latency_dt;
-  double y_new = y + v * sin(psi) * latency_dt;
-  double psi_new = psi + v/Lf * delta * latency_dt;
-  double v_new = v + a * latency_dt;
-  double cte_new = cte + v * sin(epsi) * latency_dt;
-  double epsi_new = epsi + v/Lf * delta * latency_dt;
-
-  // send the new states without latency to the solver
-  x = x_new;
-  y = y_new;
-  psi = psi_new;
-  v = v_new;
-  cte = cte_new;
-  epsi = epsi_new;
-
+// Everything a solve needs that depends only on the config. It is built
+// once per config change, off the control loop, instead of every tick.
+struct MPCSetup {
+  MPCConfig config;
+  // the process model, resolved once from config.model
+  enum ModelType { KINEMATIC, DYNAMIC } model;
+  // its integrator, from config.integrator
+  enum IntegratorType { EULER, EULER_INTEGRATED, RK2, RK4 } integrator;
+  // and the solver, from config.solver
+  enum SolverType { IPOPT, RICCATI, RICCATI_MIXED } solver;
+  VarLayout layout;
   // Set the number of model variables (includes both states and inputs).
-  size_t n_vars = N * 6 + (N - 1) * 2;
+  size_t n_vars;
   // Set the number of constraints
-  size_t n_constraints = N * 6;
-
-  // Initial value of the independent variables.
-  // SHOULD BE 0 besides initial state.
-  Dvector vars(n_vars);
-  for (int i = 0; i < n_vars; i++) {
-    vars[i] = 0.0;
-  }
-  // Set the initial variable values
-  vars[x_start] = x;
-  vars[y_start] = y;
-  vars[psi_start] = psi;
-  vars[v_start] = v;
-  vars[cte_start] = cte;
-  vars[epsi_start] = epsi;
-  
-  // Lower and upper limits for x
-  Dvector vars_lowerbound(n_vars);
-  Dvector vars_upperbound(n_vars);
+  size_t n_constraints;
+  // Lower and upper limits for x, besides the initial state
+  vector<double> vars_lowerbound;
+  vector<double> vars_upperbound;
+  // options for IPOPT solver
+  std::string options;
+  // evaluates the stages of long horizons, if config.eval_threads > 1
+  std::shared_ptr<StagePool> pool;
+  // from config.terminal_table, if set and readable
+  std::shared_ptr<const TerminalTable> terminal;
+  // and the network for the initial guess, from config.initial_guess
+  std::shared_ptr<const GuessNet> guess;
+
+  explicit MPCSetup(const MPCConfig &config);
+};
 
+MPCSetup::MPCSetup(const MPCConfig &config)
+    : config(config),
+      model(config.model == "dynamic" ? DYNAMIC : KINEMATIC),
+      integrator(config.integrator == "rk2"                ? RK2
+                 : config.integrator == "rk4"              ? RK4
+                 : config.integrator == "euler_integrated" ? EULER_INTEGRATED
+                                                           : EULER),
+      solver(config.solver == "riccati"         ? RICCATI
+             : config.solver == "riccati_mixed" ? RICCATI_MIXED
+                                                : IPOPT),
+      layout(config.N,
+             model == DYNAMIC ? DynamicModel::n_state : KinematicModel::n_state,
+             config.formulation != "reduced"),
+      // the model's states and cte, epsi (unless reduced) over the horizon,
+      // 2 actuators
+      n_vars(layout.delta_start + (config.N - 1) * 2),
+      n_constraints(layout.delta_start),
+      vars_lowerbound(n_vars),
+      vars_upperbound(n_vars) {
   // Set all non-actuators upper and lower limits
   // to the max negative and positive values.
-  for (int i = 0; i < delta_start; i++) {
+  for (size_t i = 0; i < layout.delta_start; i++) {
     vars_lowerbound[i] = -1.0e19;
     vars_upperbound[i] = 1.0e19;
   }
@@ -225,7 +280,7 @@ vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
   // gloabl optimization instead of local minima
   // This is NOT necessary for this project but a good point
   // to consider for future similar project
-  for (int i = psi_start; i < v_start; i++) {
+  for (size_t i = layout.psi_start; i < layout.v_start; i++) {
     vars_lowerbound[i] = -1.047197;
     vars_upperbound[i] = 1.047197;
   }
@@ -233,48 +288,21 @@ vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
   // The upper and lower limits of delta are set to -25 and 25
   // degrees (values in radians).
   // NOTE: Feel free to change this to something else.
-  for (int i = delta_start; i < a_start; i++) {
+  for (size_t i = layout.delta_start; i < layout.a_start; i++) {
     vars_lowerbound[i] = -0.436332;
     vars_upperbound[i] = 0.436332;
   }
 
   // Acceleration/decceleration upper and lower limits.
   // NOTE: Feel free to change this to something else.
-  for (int i = a_start; i < n_vars; i++) {
+  for (size_t i = layout.a_start; i < n_vars; i++) {
     vars_lowerbound[i] = -1.0;
     vars_upperbound[i] = 1.0;
   }
 
-  // Lower and upper limits for the constraints
-  // Should be 0 besides initial state.
-  Dvector constraints_lowerbound(n_constraints);
-  Dvector constraints_upperbound(n_constraints);
-  for (int i = 0; i < n_constraints; i++) {
-    constraints_lowerbound[i] = 0;
-    constraints_upperbound[i] = 0;
-  }
-  constraints_lowerbound[x_start] = x;
-  constraints_lowerbound[y_start] = y;
-  constraints_lowerbound[psi_start] = psi;
-  constraints_lowerbound[v_start] = v;
-  constraints_lowerbound[cte_start] = cte;
-  constraints_lowerbound[epsi_start] = epsi;
-
-  constraints_upperbound[x_start] = x;
-  constraints_upperbound[y_start] = y;
-  constraints_upperbound[psi_start] = psi;
-  constraints_upperbound[v_start] = v;
-  constraints_upperbound[cte_start] = cte;
-  constraints_upperbound[epsi_start] = epsi;
-
-  // object that computes objective and constraints
-  FG_eval fg_eval(coeffs);
-
   //
   // NOTE: You don't have to worry about these options
   //
-  // options for IPOPT solver
-  std::string options;
   // Uncomment this if you'd like more print information
   options += "Integer print_level  0\n";
   // NOTE: Setting sparse to true allows the solver to take advantage
@@ -287,14 +315,387 @@ vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
   // NOTE: Currently the solver has a maximum time limit of 0.5 seconds.
   // Change this as you see fit.
   options += "Numeric max_cpu_time          0.5\n";
+  // Tolerances, mu_strategy, linear solver, ... from the config (see
+  // mpc_solver_tune), later lines override earlier ones.
+  options += config.ipopt_options;
+
+  if (!config.terminal_table.empty()) {
+    auto table = std::make_shared<TerminalTable>();
+    if (!LoadTerminalTable(config.terminal_table, table.get())) {
+      std::cerr << "Failed to load terminal table " << config.terminal_table
+                << ", no terminal cost" << std::endl;
+    } else if (table->model != config.model) {
+      // its errors are another model's, the matrices don't apply at all
+      std::cerr << "Terminal table " << config.terminal_table
+                << " was solved for the " << table->model
+                << " model, no terminal cost" << std::endl;
+    } else {
+      if (!table->Matches(config)) {
+        std::cerr << "Terminal table " << config.terminal_table
+                  << " was solved for another dt, integrator or other"
+                  << " weights" << std::endl;
+      }
+      terminal = table;
+    }
+  }
+
+  if (!config.initial_guess.empty()) {
+    GuessNet *net = new GuessNet;
+    if (!LoadGuessNet(config.initial_guess, net)) {
+      std::cerr << "Failed to load initial guess " << config.initial_guess
+                << ", starting from zero" << std::endl;
+      delete net;
+    } else {
+      if (fabs(net->dt - config.dt) > 1e-6) {
+        std::cerr << "Initial guess " << config.initial_guess
+                  << " was trained for another dt" << std::endl;
+      }
+      guess.reset(net);
+    }
+  }
+
+  // no more threads than cores, they spin between Ipopt's callbacks; the
+  // stage by stage cost has no terminal weights, a table is there to keep
+  // the horizon short anyway, and its stages carry cte and epsi
+  int threads = std::min<int>(config.eval_threads,
+                              std::thread::hardware_concurrency());
+  if (threads > 1 && config.N >= config.eval_parallel_min_N && !terminal &&
+      config.formulation != "reduced") {
+    pool = std::make_shared<StagePool>(threads);
+  }
+}
+
+//
+// MPC class definition implementation.
+//
+MPC::MPC() : MPC(MPCConfig()) {}
+MPC::MPC(const MPCConfig &config)
+    : setup(Prepare(config)), workspace_bytes(0), tape_bytes(0) {}
+MPC::~MPC() {}
+
+std::shared_ptr<const MPCSetup> MPC::Prepare(const MPCConfig &config) {
+  return std::make_shared<const MPCSetup>(config);
+}
+
+void MPC::SetSetup(std::shared_ptr<const MPCSetup> next) {
+  std::atomic_store(&setup, next);
+}
+
+void MPC::SetConfig(const MPCConfig &config) { SetSetup(Prepare(config)); }
+
+MPCConfig MPC::Config() const { return std::atomic_load(&setup)->config; }
+
+MPCMemory MPC::Memory() const {
+  std::shared_ptr<const MPCSetup> snapshot = std::atomic_load(&setup);
+  MPCMemory memory;
+  memory.setup = sizeof(MPCSetup) +
+                 (snapshot->vars_lowerbound.capacity() +
+                  snapshot->vars_upperbound.capacity()) * sizeof(double) +
+                 snapshot->options.capacity() +
+                 snapshot->config.ipopt_options.capacity() +
+                 (snapshot->terminal ? snapshot->terminal->Bytes() : 0) +
+                 (snapshot->guess ? sizeof(GuessNet) : 0);
+  memory.workspace = workspace_bytes;
+  memory.tape = tape_bytes;
+  return memory;
+}
+
+// Predicts the model state `s` and the errors against `coeffs`
+// `latency_dt` ahead, with the actuations at 0.
+template <class Model>
+static void PredictLatency(double latency_dt, const Eigen::VectorXd &coeffs,
+                           double *s, double *cte, double *epsi) {
+  double u[Model::n_input] = {};
+  double s_new[Model::n_state];
+  Model::step(s, u, latency_dt, s_new);
+  if (Model::integrated_errors) {
+    ReferenceErrors<Model>(coeffs, s_new, cte, epsi);
+  } else {
+    *cte += Model::cte_rate(s, *epsi) * latency_dt;
+    *epsi += s_new[Model::PSI] - s[Model::PSI];
+  }
+  for (size_t k = 0; k < Model::n_state; k++) {
+    s[k] = s_new[k];
+  }
+}
+
+// The plan of a solve from s, cte, epsi with `inputs`, and the LQR
+// feedback around it (see MPC::Correct).
+template <class Model>
+static void FillPlan(const MPCConfig &config, const Eigen::VectorXd &coeffs,
+                     const double *s, double cte, double epsi,
+                     const typename Riccati<Model, double>::Inputs &inputs,
+                     const Eigen::Matrix2d *terminal, MPCPlan *plan) {
+  typedef Riccati<Model, double> Solver;
+  size_t N = config.N;
+  typename Solver::State z0 = Solver::State::Zero();
+  for (size_t i = 0; i < Model::n_state; i++) {
+    z0[i] = s[i];
+  }
+  z0[Solver::CTE] = cte;
+  z0[Solver::EPSI] = epsi;
+  Solver lqr(config, coeffs, terminal);
+  lqr.Start(z0, inputs);
+  const typename Solver::Gains &gains = lqr.FeedbackGains();
+
+  plan->dt = config.dt;
+  plan->coeffs = coeffs;
+  plan->n_z = Solver::NZ;
+  plan->actuations.clear();
+  plan->states.clear();
+  plan->gains.clear();
+  for (size_t t = 0; t < N; t++) {
+    const typename Solver::State &z = lqr.StateTrajectory()[t];
+    plan->states.insert(plan->states.end(), z.data(), z.data() + Solver::NZ);
+    if (t + 1 == N) {
+      break;
+    }
+    plan->actuations.push_back(inputs[t][Model::DELTA]);
+    plan->actuations.push_back(inputs[t][Model::A]);
+    for (int i = 0; i < Solver::NU; i++) {
+      for (int j = 0; j < Solver::NZ; j++) {
+        plan->gains.push_back(gains[t](i, j));
+      }
+    }
+  }
+}
+
+// One solve with the model compiled in; MPC::Solve picks the instance.
+template <class Model>
+static vector<double> SolveWith(const MPCSetup &setup, Eigen::VectorXd state,
+                                Eigen::VectorXd coeffs,
+                                const vector<Obstacle> &obstacles,
+                                MPCMemory *memory, MPCPlan *plan,
+                                double ref_v) {
+  bool ok = true;
+  typedef CPPAD_TESTVECTOR(double) Dvector;
+
+  // the config, with this solve's speed reference if it has its own
+  MPCConfig with_ref_v;
+  if (!std::isnan(ref_v)) {
+    with_ref_v = setup.config;
+    with_ref_v.ref_v = ref_v;
+  }
+  const MPCConfig &config =
+      std::isnan(ref_v) ? setup.config : with_ref_v;
+  const VarLayout &layout = setup.layout;
+
+  /*
+  Take of the plant latency problem 
+  */
+  // retrive states [x,y,ψ,v,cte,eψ] and actutations [δ,a] from Eigen::VectorXd state
+  // Model states beyond these (e.g. lateral velocity, yaw rate) are not
+  // measured and start at 0.
+  double s[Model::n_state] = {};
+  s[Model::X] = state[0];
+  s[Model::Y] = state[1];
+  s[Model::PSI] = state[2];
+  s[Model::V] = state[3];
+  double cte = state[4];
+  double epsi = state[5];
+
+  // solving the latency problem by predicting states (current + latency) using process model
+  // before sending these states to solver
+  PredictLatency<Model>(config.latency_dt, coeffs, s, &cte, &epsi);
+
+  size_t N = config.N;
+
+  // the terminal weights for the speed the horizon starts at
+  Eigen::Matrix2d terminal;
+  if (setup.terminal) {
+    terminal = setup.terminal->At(s[Model::V]);
+  }
+  const Eigen::Matrix2d *terminal_weight =
+      setup.terminal ? &terminal : nullptr;
+
+  // the actuations the solver starts from: the learned guess (see guess.h)
+  // within the actuator bounds, or zero
+  vector<double> guess_delta(N - 1, 0.0);
+  vector<double> guess_a(N - 1, 0.0);
+  if (setup.guess) {
+    setup.guess->Guess(state, coeffs, N - 1, guess_delta.data(),
+                       guess_a.data());
+    for (size_t t = 0; t < N - 1; t++) {
+      size_t d = layout.delta_start + t;
+      size_t a = layout.a_start + t;
+      guess_delta[t] = std::min(
+          std::max(guess_delta[t], setup.vars_lowerbound[d]),
+          setup.vars_upperbound[d]);
+      guess_a[t] = std::min(std::max(guess_a[t], setup.vars_lowerbound[a]),
+                            setup.vars_upperbound[a]);
+    }
+  }
+
+  // The in-tree solver, when there are no obstacles to keep clear of.
+  // Mixed precision runs most iterations in float and refines the result
+  // with double iterations until it converges again.
+  if (setup.solver != MPCSetup::IPOPT && obstacles.empty()) {
+    typename Riccati<Model, double>::Inputs inputs;
+    typename Riccati<Model, double>::States states;
+    typename Riccati<Model, double>::Inputs initial(N - 1);
+    for (size_t t = 0; t < N - 1; t++) {
+      initial[t][Model::DELTA] = guess_delta[t];
+      initial[t][Model::A] = guess_a[t];
+    }
+    if (setup.solver == MPCSetup::RICCATI_MIXED) {
+      RiccatiSolve<Model>(config, coeffs, s, cte, epsi, 100, 20, &inputs,
+                          &states, terminal_weight, &initial);
+    } else {
+      RiccatiSolve<Model>(config, coeffs, s, cte, epsi, 0, 200, &inputs,
+                          &states, terminal_weight, &initial);
+    }
+    // the trajectory, and the gains and feedforward of one iteration
+    typedef Riccati<Model, double> Solver;
+    memory->workspace =
+        N * (sizeof(typename Solver::State) + sizeof(typename Solver::Gain) +
+             2 * sizeof(typename Solver::Input));
+    memory->tape = 0;
+    if (plan) {
+      FillPlan<Model>(config, coeffs, s, cte, epsi, inputs, terminal_weight,
+                      plan);
+    }
+    std::vector<double> results;
+    results.push_back(inputs[0][Model::DELTA]);
+    results.push_back(inputs[0][Model::A]);
+    for (size_t i = 0; i < N - 1; i++) {
+      results.push_back(states[i + 1][Model::X]);
+      results.push_back(states[i + 1][Model::Y]);
+    }
+    return results;
+  }
+
+  size_t n_vars = setup.n_vars;
+  // plus one per obstacle and predicted position
+  size_t n_constraints = setup.n_constraints + obstacles.size() * (N - 1);
+
+  // Initial value of the independent variables.
+  // SHOULD BE 0 besides initial state.
+  Dvector vars(n_vars);
+  for (int i = 0; i < n_vars; i++) {
+    vars[i] = 0.0;
+  }
+  // Set the initial variable values
+  for (size_t k = 0; k < Model::n_state; k++) {
+    vars[k * N] = s[k];
+  }
+  // the reduced formulation has the errors in FG_eval instead
+  bool reduced = layout.cte_start == layout.delta_start;
+  if (!reduced) {
+    vars[layout.cte_start] = cte;
+    vars[layout.epsi_start] = epsi;
+  }
+
+  // With a learned guess, start from its actuations and the states they
+  // lead to, as the model constraints below compute them, so Ipopt starts
+  // on a feasible trajectory.
+  if (setup.guess) {
+    for (size_t t = 0; t + 1 < N; t++) {
+      double s0[Model::n_state], s1[Model::n_state];
+      double u0[Model::n_input];
+      for (size_t k = 0; k < Model::n_state; k++) {
+        s0[k] = vars[k * N + t];
+      }
+      u0[Model::DELTA] = vars[layout.delta_start + t] = guess_delta[t];
+      u0[Model::A] = vars[layout.a_start + t] = guess_a[t];
+      Model::step(s0, u0, config.dt, s1);
+      double x0 = s0[Model::X];
+      double f0 = coeffs[0] + coeffs[1] * x0 + coeffs[2] * x0 * x0 +
+                  coeffs[3] * x0 * x0 * x0;
+      double psides0 = atan(coeffs[1] + 2 * coeffs[2] * x0 +
+                            3 * coeffs[3] * x0 * x0);
+      for (size_t k = 0; k < Model::n_state; k++) {
+        vars[k * N + t + 1] = s1[k];
+      }
+      if (reduced) {
+        continue;
+      }
+      if (Model::integrated_errors) {
+        ReferenceErrors<Model>(coeffs, s1, &vars[layout.cte_start + t + 1],
+                               &vars[layout.epsi_start + t + 1]);
+        continue;
+      }
+      double epsi0 = vars[layout.epsi_start + t];
+      vars[layout.cte_start + t + 1] =
+          (f0 - s0[Model::Y]) + Model::cte_rate(s0, epsi0) * config.dt;
+      vars[layout.epsi_start + t + 1] =
+          (s0[Model::PSI] - psides0) + (s1[Model::PSI] - s0[Model::PSI]);
+    }
+  }
+
+  // Lower and upper limits for x
+  Dvector vars_lowerbound(n_vars);
+  Dvector vars_upperbound(n_vars);
+  for (size_t i = 0; i < n_vars; i++) {
+    vars_lowerbound[i] = setup.vars_lowerbound[i];
+    vars_upperbound[i] = setup.vars_upperbound[i];
+  }
+
+  // Lower and upper limits for the constraints
+  // Should be 0 besides initial state.
+  Dvector constraints_lowerbound(n_constraints);
+  Dvector constraints_upperbound(n_constraints);
+  for (int i = 0; i < n_constraints; i++) {
+    constraints_lowerbound[i] = 0;
+    constraints_upperbound[i] = 0;
+  }
+  for (size_t start = layout.x_start; start < layout.delta_start; start += N) {
+    constraints_lowerbound[start] = vars[start];
+    constraints_upperbound[start] = vars[start];
+  }
+  size_t row = setup.n_constraints;
+  for (const auto &o : obstacles) {
+    double clearance = o.radius + config.obstacle_margin;
+    for (size_t t = 1; t < N; t++, row++) {
+      constraints_lowerbound[row] = clearance * clearance;
+      constraints_upperbound[row] = 1.0e19;
+    }
+  }
+
+  // object that computes objective and constraints
+  FG_eval<Model> fg_eval(coeffs, config, obstacles);
+  fg_eval.cte0 = cte;
+  fg_eval.epsi0 = epsi;
+  if (terminal_weight) {
+    fg_eval.has_terminal = true;
+    fg_eval.terminal_weight = terminal;
+  }
+
+  // options for IPOPT solver
+  const std::string &options = setup.options;
 
   // place to return solution
   CppAD::ipopt::solve_result<Dvector> solution;
 
-  // solve the problem
-  CppAD::ipopt::solve<Dvector, FG_eval>(
-      options, vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
-      constraints_upperbound, fg_eval, solution);
+  // solve the problem; long horizons stage by stage on the pool, with
+  // the stage problem's buffers in place of the tape
+  size_t stage_bytes = 0;
+  bool staged = setup.pool && obstacles.empty();
+  if (staged) {
+    SolveStages<Model, ControllerCost>(
+        options, config, layout, coeffs, setup.pool.get(), vars,
+        vars_lowerbound, vars_upperbound, constraints_lowerbound,
+        constraints_upperbound, solution, &stage_bytes);
+  } else {
+    CppAD::ipopt::solve<Dvector, FG_eval<Model>>(
+        options, vars, vars_lowerbound, vars_upperbound,
+        constraints_lowerbound, constraints_upperbound, fg_eval, solution);
+  }
+
+  // vars, their bounds, the solution with its multipliers; the constraints'
+  // bounds, values and multipliers
+  memory->workspace = (6 * n_vars + 4 * n_constraints) * sizeof(double);
+  memory->tape = staged ? stage_bytes : fg_eval.tape_bytes;
+
+  // the feedback around the plan leaves the obstacles out
+  if (plan) {
+    typename Riccati<Model, double>::Inputs inputs(N - 1);
+    for (size_t t = 0; t < N - 1; t++) {
+      inputs[t][Model::DELTA] = solution.x[layout.delta_start + t];
+      inputs[t][Model::A] = solution.x[layout.a_start + t];
+    }
+    FillPlan<Model>(config, coeffs, s, cte, epsi, inputs, terminal_weight,
+                    plan);
+  }
 
   // Check some of the solution values
   ok &= solution.status == CppAD::ipopt::solve_result<Dvector>::success;
@@ -310,16 +711,163 @@ vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
 
   std::vector<double> results;
 
-  results.push_back(solution.x[delta_start]);
-  results.push_back(solution.x[a_start]);
+  results.push_back(solution.x[layout.delta_start]);
+  results.push_back(solution.x[layout.a_start]);
 
   // the MPC predicted path x and y position
   for (int i = 0; i < N - 1; i++){
-    results.push_back(solution.x[x_start + i + 1]);
-    results.push_back(solution.x[y_start + i + 1]);
+    results.push_back(solution.x[layout.x_start + i + 1]);
+    results.push_back(solution.x[layout.y_start + i + 1]);
   }
 
   //return controls (delta, a) and path (x, y)
   return results; 
 
 }
+
+// Calls fn.Run<Model>() with the model and integrator of `setup`
+// compiled in, see vehicle_model.h.
+template <class Model, class Fn>
+static typename Fn::Result WithIntegrator(const MPCSetup &setup,
+                                          const Fn &fn) {
+  switch (setup.integrator) {
+    case MPCSetup::EULER_INTEGRATED:
+      return fn.template Run<IntegratedEuler<Model>>();
+    case MPCSetup::RK2:
+      return fn.template Run<Midpoint<Model>>();
+    case MPCSetup::RK4:
+      return fn.template Run<RungeKutta4<Model>>();
+    default:
+      return fn.template Run<Model>();
+  }
+}
+
+template <class Fn>
+static typename Fn::Result WithModel(const MPCSetup &setup, const Fn &fn) {
+  return setup.model == MPCSetup::DYNAMIC
+             ? WithIntegrator<DynamicModel>(setup, fn)
+             : WithIntegrator<KinematicModel>(setup, fn);
+}
+
+struct SolveCall {
+  typedef vector<double> Result;
+  const MPCSetup &setup;
+  const Eigen::VectorXd &state;
+  const Eigen::VectorXd &coeffs;
+  const vector<Obstacle> &obstacles;
+  MPCMemory *memory;
+  MPCPlan *plan;
+  double ref_v;
+  template <class Model>
+  Result Run() const {
+    return SolveWith<Model>(setup, state, coeffs, obstacles, memory, plan,
+                            ref_v);
+  }
+};
+
+vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs,
+                          const vector<Obstacle> &obstacles,
+                          MPCPlan *plan, double ref_v) {
+  // The config this solve runs with. A config swapped in meanwhile is
+  // picked up by the next solve.
+  std::shared_ptr<const MPCSetup> snapshot = std::atomic_load(&setup);
+  MPCMemory used;
+  vector<double> solution = WithModel(
+      *snapshot,
+      SolveCall{*snapshot, state, coeffs, obstacles, &used, plan, ref_v});
+  workspace_bytes = used.workspace;
+  tape_bytes = used.tape;
+  return solution;
+}
+
+// MPC::Correct with the model compiled in.
+template <class Model>
+static bool CorrectWith(const MPCSetup &setup, const MPCPlan &plan, double x,
+                        double y, double psi, double v, double elapsed,
+                        double *delta, double *a) {
+  typedef Riccati<Model, double> Solver;
+  enum { NZ = Solver::NZ, NU = Solver::NU };
+  if (plan.n_z != NZ || plan.dt <= 0.0 || elapsed < 0.0) {
+    return false;
+  }
+  // The stage the car has reached, by the distance it has driven since
+  // the solve: the model moves v * dt per stage with v in mph, the car
+  // v * 0.44704 m/s, so elapsed / dt would run ahead of it.
+  double driven = hypot(x, y);
+  size_t n_stages = plan.states.size() / NZ;
+  size_t k = 0;
+  double along = 0.0;
+  while (k + 1 < n_stages) {
+    const double *from = plan.states.data() + k * NZ;
+    const double *to = from + NZ;
+    double step = hypot(to[Model::X] - from[Model::X],
+                        to[Model::Y] - from[Model::Y]);
+    if (along + step / 2 > driven) {
+      break;
+    }
+    along += step;
+    k++;
+  }
+  if (2 * k + 1 >= plan.actuations.size()) {
+    return false;
+  }
+  Eigen::Map<const typename Solver::State> planned(plan.states.data() +
+                                                   k * NZ);
+  Eigen::Map<const Eigen::Matrix<double, NU, NZ, Eigen::RowMajor>> K(
+      plan.gains.data() + k * NU * NZ);
+
+  // the measured states, the rest (e.g. yaw rate) as planned
+  double s[Model::n_state];
+  for (size_t i = 0; i < Model::n_state; i++) {
+    s[i] = planned[i];
+  }
+  s[Model::X] = x;
+  s[Model::Y] = y;
+  s[Model::PSI] = psi;
+  s[Model::V] = v;
+  // the errors against the plan's reference, as Drive() computes them at
+  // the origin
+  const Eigen::VectorXd &c = plan.coeffs;
+  double cte = c[0] + c[1] * x + c[2] * x * x + c[3] * x * x * x - y;
+  double epsi = psi - atan(c[1] + 2 * c[2] * x + 3 * c[3] * x * x);
+  PredictLatency<Model>(setup.config.latency_dt, c, s, &cte, &epsi);
+
+  typename Solver::State z = planned;
+  for (size_t i = 0; i < Model::n_state; i++) {
+    z[i] = s[i];
+  }
+  z[Solver::CTE] = cte;
+  z[Solver::EPSI] = epsi;
+  typename Solver::Input u;
+  u[Model::DELTA] = plan.actuations[2 * k];
+  u[Model::A] = plan.actuations[2 * k + 1];
+  u += K * (z - planned);
+
+  const VarLayout &layout = setup.layout;
+  *delta = std::min(std::max(u[Model::DELTA],
+                             setup.vars_lowerbound[layout.delta_start]),
+                    setup.vars_upperbound[layout.delta_start]);
+  *a = std::min(std::max(u[Model::A], setup.vars_lowerbound[layout.a_start]),
+                setup.vars_upperbound[layout.a_start]);
+  return true;
+}
+
+struct CorrectCall {
+  typedef bool Result;
+  const MPCSetup &setup;
+  const MPCPlan &plan;
+  double x, y, psi, v, elapsed;
+  double *delta;
+  double *a;
+  template <class Model>
+  Result Run() const {
+    return CorrectWith<Model>(setup, plan, x, y, psi, v, elapsed, delta, a);
+  }
+};
+
+bool MPC::Correct(const MPCPlan &plan, double x, double y, double psi,
+                  double v, double elapsed, double *delta, double *a) const {
+  std::shared_ptr<const MPCSetup> snapshot = std::atomic_load(&setup);
+  return WithModel(*snapshot, CorrectCall{*snapshot, plan, x, y, psi, v,
+                                          elapsed, delta, a});
+}
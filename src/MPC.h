@@ -1,20 +1,92 @@
 #ifndef MPC_H
 #define MPC_H
 
+#include <atomic>
+#include <cmath>
+#include <memory>
 #include <vector>
 #include "Eigen-3.3/Eigen/Core"
+#include "config.h"
+#include "wire.h"
 
 using namespace std;
 
+// Layout, bounds and solver options prepared for one config, see MPC.cpp.
+struct MPCSetup;
+
+// What a controller holds on to, bytes.
+struct MPCMemory {
+  // the prepared config: layout, bounds, options
+  size_t setup = 0;
+  // the vectors handed to and returned by the solver in the last solve;
+  // Ipopt's own factorization only shows in the process' RSS
+  size_t workspace = 0;
+  // CppAD memory in use once the last solve's tape was recorded, or on
+  // the stage-parallel path the stage problem's buffers (see stage_nlp.h)
+  size_t tape = 0;
+};
+
+// A solve's plan and the LQR feedback around it, to correct the
+// actuations between solves (see feedback.h).
+struct MPCPlan {
+  // all N - 1 actuations, as (delta, a) pairs
+  vector<double> actuations;
+  // the reference polynomial, and the N states along the plan in the car
+  // frame of the solve, from the state predicted latency_dt ahead; n_z
+  // entries each: the model's, cte, epsi, the previous delta and a
+  Eigen::VectorXd coeffs;
+  size_t n_z = 0;
+  vector<double> states;
+  // N - 1 gains of 2 x n_z, row-major
+  vector<double> gains;
+  // the stage length it was solved with
+  double dt = 0.0;
+};
+
 class MPC {
  public:
   MPC();
+  explicit MPC(const MPCConfig &config);
 
   virtual ~MPC();
 
   // Solve the model given an initial state and polynomial coefficients.
   // Return the first actuatotions.
-  vector<double> Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs);
+  // The predicted path keeps config.obstacle_margin clear of every
+  // obstacle given, in the car frame.
+  // `plan`, if given, gets the whole plan and its feedback gains.
+  // `ref_v`, if not NAN, is the speed reference of this solve in place of
+  // the config's.
+  vector<double> Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs,
+                       const vector<Obstacle> &obstacles = vector<Obstacle>(),
+                       MPCPlan *plan = nullptr, double ref_v = NAN);
+
+  // The actuations of `plan` corrected by its feedback for the car now at
+  // x, y, psi (in the car frame of the solve) and speed v, `elapsed`
+  // seconds after the telemetry the plan was solved from:
+  //   u = u_plan(k) + K(k) (z - z_plan(k))
+  // with z predicted latency_dt ahead like a solve does, and k the stage
+  // as far along the plan as the car has driven since the solve. False if
+  // the plan has run out or was solved with another model.
+  bool Correct(const MPCPlan &plan, double x, double y, double psi, double v,
+               double elapsed, double *delta, double *a) const;
+
+  // Changing the config is RCU style: the new setup is built first, ideally
+  // off the control loop with Prepare(), then swapped in atomically.
+  // Solves already running finish with the config they started with.
+  static std::shared_ptr<const MPCSetup> Prepare(const MPCConfig &config);
+  void SetSetup(std::shared_ptr<const MPCSetup> next);
+  void SetConfig(const MPCConfig &config);
+  MPCConfig Config() const;
+
+  // May be called from any thread.
+  MPCMemory Memory() const;
+
+ private:
+  std::shared_ptr<const MPCSetup> setup;
+  // of the last solve
+  std::atomic<size_t> workspace_bytes;
+  std::atomic<size_t> tape_bytes;
 };
 
 #endif /* MPC_H */
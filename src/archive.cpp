@@ -0,0 +1,455 @@
+#include "archive.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+const char *kArchiveColumnNames[kArchiveColumns] = {
+    "time", "x",  "y",  "psi",      "speed",    "c0",
+    "c1",   "c2", "c3", "steering", "throttle", "solve_ms"};
+
+int ArchiveColumnByName(const string &name) {
+  for (int c = 0; c < kArchiveColumns; c++) {
+    if (name == kArchiveColumnNames[c]) {
+      return c;
+    }
+  }
+  return -1;
+}
+
+// Little-endian fields, as in wire.cpp.
+static void PutU32(string &out, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    out.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+  }
+}
+
+static void PutDouble(string &out, double d) {
+  uint64_t v;
+  memcpy(&v, &d, sizeof(v));
+  for (int i = 0; i < 8; i++) {
+    out.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+  }
+}
+
+static uint32_t GetU32(const char *p) {
+  uint32_t v = 0;
+  for (int i = 0; i < 4; i++) {
+    v |= static_cast<uint32_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+  }
+  return v;
+}
+
+static double GetDouble(const char *p) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) {
+    v |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+  }
+  double d;
+  memcpy(&d, &v, sizeof(d));
+  return d;
+}
+
+// Time column: microseconds, delta of delta, zigzag varints.
+
+static void PutVarint(string &out, int64_t v) {
+  uint64_t z = (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+  while (z >= 0x80) {
+    out.push_back(static_cast<char>((z & 0x7f) | 0x80));
+    z >>= 7;
+  }
+  out.push_back(static_cast<char>(z));
+}
+
+static bool GetVarint(const char *&p, const char *end, int64_t *v) {
+  uint64_t z = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (p == end) {
+      return false;
+    }
+    uint8_t b = static_cast<uint8_t>(*p++);
+    z |= static_cast<uint64_t>(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      *v = static_cast<int64_t>(z >> 1) ^ -static_cast<int64_t>(z & 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+static string EncodeTimes(const vector<double> &vals) {
+  string out;
+  int64_t prev = 0;
+  int64_t prev_delta = 0;
+  for (size_t i = 0; i < vals.size(); i++) {
+    int64_t us = llround(vals[i] * 1e6);
+    int64_t delta = us - prev;
+    // the first row stores the time, the second the delta
+    PutVarint(out, i == 0 ? us : i == 1 ? delta : delta - prev_delta);
+    prev = us;
+    prev_delta = delta;
+  }
+  return out;
+}
+
+static bool DecodeTimes(const char *p, const char *end, size_t n,
+                        vector<double> *vals) {
+  int64_t prev = 0;
+  int64_t prev_delta = 0;
+  for (size_t i = 0; i < n; i++) {
+    int64_t v;
+    if (!GetVarint(p, end, &v)) {
+      return false;
+    }
+    int64_t delta = i == 0 ? v : i == 1 ? v : prev_delta + v;
+    int64_t us = i == 0 ? v : prev + delta;
+    (*vals)[i] = us / 1e6;
+    prev = us;
+    prev_delta = i == 0 ? 0 : delta;
+  }
+  return true;
+}
+
+// Other columns: Gorilla XOR compression, most significant bit first.
+//   '0'                      same value as before
+//   '10' bits                the changed bits fit the previous window
+//   '11' lead(6) len-1(6) bits  a new window
+
+class BitWriter {
+ public:
+  void Put(uint64_t v, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+      if (used % 8 == 0) {
+        bytes.push_back(0);
+      }
+      if ((v >> i) & 1) {
+        bytes.back() |= static_cast<char>(0x80 >> (used % 8));
+      }
+      used++;
+    }
+  }
+  string bytes;
+
+ private:
+  size_t used = 0;
+};
+
+class BitReader {
+ public:
+  BitReader(const char *p, size_t n) : p(p), n_bits(n * 8) {}
+  bool Get(int n, uint64_t *v) {
+    if (at + n > n_bits) {
+      return false;
+    }
+    *v = 0;
+    for (int i = 0; i < n; i++, at++) {
+      uint8_t byte = static_cast<uint8_t>(p[at / 8]);
+      *v = (*v << 1) | ((byte >> (7 - at % 8)) & 1);
+    }
+    return true;
+  }
+
+ private:
+  const char *p;
+  size_t n_bits;
+  size_t at = 0;
+};
+
+static int LeadingZeros(uint64_t x) {
+  int n = 0;
+  while (!(x & (1ull << 63))) {
+    x <<= 1;
+    n++;
+  }
+  return n;
+}
+
+static int TrailingZeros(uint64_t x) {
+  int n = 0;
+  while (!(x & 1)) {
+    x >>= 1;
+    n++;
+  }
+  return n;
+}
+
+static string EncodeXor(const vector<double> &vals) {
+  BitWriter out;
+  uint64_t prev = 0;
+  int lead = -1;
+  int trail = 0;
+  for (size_t i = 0; i < vals.size(); i++) {
+    uint64_t bits;
+    memcpy(&bits, &vals[i], sizeof(bits));
+    if (i == 0) {
+      out.Put(bits, 64);
+      prev = bits;
+      continue;
+    }
+    uint64_t x = bits ^ prev;
+    prev = bits;
+    if (x == 0) {
+      out.Put(0, 1);
+      continue;
+    }
+    int l = LeadingZeros(x);
+    int t = TrailingZeros(x);
+    if (lead >= 0 && l >= lead && t >= trail) {
+      out.Put(2, 2);
+      out.Put(x >> trail, 64 - lead - trail);
+    } else {
+      lead = l;
+      trail = t;
+      out.Put(3, 2);
+      out.Put(lead, 6);
+      out.Put(64 - lead - trail - 1, 6);
+      out.Put(x >> trail, 64 - lead - trail);
+    }
+  }
+  return out.bytes;
+}
+
+static bool DecodeXor(const char *p, size_t n_bytes, size_t n,
+                      vector<double> *vals) {
+  BitReader in(p, n_bytes);
+  uint64_t prev = 0;
+  int lead = 0;
+  int trail = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint64_t bits = prev;
+    uint64_t v;
+    if (i == 0) {
+      if (!in.Get(64, &bits)) {
+        return false;
+      }
+    } else {
+      if (!in.Get(1, &v)) {
+        return false;
+      }
+      if (v) {
+        if (!in.Get(1, &v)) {
+          return false;
+        }
+        if (v) {
+          uint64_t l, len;
+          if (!in.Get(6, &l) || !in.Get(6, &len)) {
+            return false;
+          }
+          lead = l;
+          trail = 64 - lead - (len + 1);
+          if (trail < 0) {
+            return false;
+          }
+        }
+        if (!in.Get(64 - lead - trail, &v)) {
+          return false;
+        }
+        bits = prev ^ (v << trail);
+      }
+    }
+    memcpy(&(*vals)[i], &bits, sizeof(bits));
+    prev = bits;
+  }
+  return true;
+}
+
+ArchiveWriter::ArchiveWriter(const string &path, size_t chunk_rows)
+    : chunk_rows(chunk_rows) {
+  // a new file gets the header, an old one is continued
+  ifstream existing(path, ios::binary | ios::ate);
+  bool fresh = !existing || existing.tellg() == 0;
+  out.open(path, ios::binary | ios::app);
+  if (out.good() && fresh) {
+    string header;
+    PutU32(header, kArchiveMagic);
+    header.push_back(static_cast<char>(kArchiveVersion));
+    header.push_back(static_cast<char>(kArchiveColumns));
+    header.append(2, '\0');
+    out.write(header.data(), header.size());
+  }
+}
+
+ArchiveWriter::~ArchiveWriter() { Flush(); }
+
+void ArchiveWriter::Append(const double row[kArchiveColumns]) {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (int c = 0; c < kArchiveColumns; c++) {
+    columns[c].push_back(row[c]);
+  }
+  if (columns[0].size() >= chunk_rows) {
+    WriteChunk();
+  }
+}
+
+size_t ArchiveWriter::BufferBytes() {
+  std::lock_guard<std::mutex> lock(mutex);
+  size_t bytes = 0;
+  for (int c = 0; c < kArchiveColumns; c++) {
+    bytes += columns[c].capacity() * sizeof(double);
+  }
+  return bytes;
+}
+
+void ArchiveWriter::Flush() {
+  std::lock_guard<std::mutex> lock(mutex);
+  WriteChunk();
+  out.flush();
+}
+
+void ArchiveWriter::WriteChunk() {
+  size_t n = columns[0].size();
+  if (n == 0) {
+    return;
+  }
+  string index;
+  string data;
+  PutU32(index, n);
+  for (int c = 0; c < kArchiveColumns; c++) {
+    const vector<double> &vals = columns[c];
+    double lo = vals[0];
+    double hi = vals[0];
+    for (double v : vals) {
+      lo = std::min(lo, v);
+      hi = std::max(hi, v);
+    }
+    string packed = c == kArchiveTime ? EncodeTimes(vals) : EncodeXor(vals);
+    PutDouble(index, lo);
+    PutDouble(index, hi);
+    PutU32(index, packed.size());
+    data += packed;
+    columns[c].clear();
+  }
+  out.write(index.data(), index.size());
+  out.write(data.data(), data.size());
+}
+
+bool ParsePredicate(const string &s, ArchivePredicate *p) {
+  size_t at = s.find_first_of("<>=");
+  if (at == string::npos || at == 0) {
+    return false;
+  }
+  p->column = ArchiveColumnByName(s.substr(0, at));
+  if (p->column < 0) {
+    return false;
+  }
+  size_t end = s.find_first_not_of("<>=", at);
+  if (end == string::npos) {
+    return false;
+  }
+  string op = s.substr(at, end - at);
+  char *rest;
+  double v = strtod(s.c_str() + end, &rest);
+  if (*rest != '\0') {
+    return false;
+  }
+  const double inf = numeric_limits<double>::infinity();
+  p->lo = -inf;
+  p->hi = inf;
+  if (op == ">") {
+    p->lo = nextafter(v, inf);
+  } else if (op == ">=") {
+    p->lo = v;
+  } else if (op == "<") {
+    p->hi = nextafter(v, -inf);
+  } else if (op == "<=") {
+    p->hi = v;
+  } else if (op == "=" || op == "==") {
+    p->lo = p->hi = v;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ScanArchive(const string &path, const vector<ArchivePredicate> &where,
+                 const vector<int> &wanted, ArchiveRowFn row,
+                 ArchiveScanStats *stats) {
+  ifstream in(path, ios::binary);
+  char header[8];
+  if (!in.read(header, sizeof(header)) || GetU32(header) != kArchiveMagic ||
+      static_cast<uint8_t>(header[4]) != kArchiveVersion ||
+      static_cast<uint8_t>(header[5]) != kArchiveColumns) {
+    return false;
+  }
+
+  // the columns to decompress
+  bool needed[kArchiveColumns] = {};
+  for (const auto &p : where) {
+    needed[p.column] = true;
+  }
+  for (int c : wanted) {
+    needed[c] = true;
+  }
+
+  const size_t entry = 2 * sizeof(double) + sizeof(uint32_t);
+  string index(entry * kArchiveColumns, '\0');
+  string data;
+  vector<double> columns[kArchiveColumns];
+  double values[kArchiveColumns];
+  char count[4];
+  while (in.read(count, sizeof(count))) {
+    size_t n = GetU32(count);
+    if (!in.read(&index[0], index.size())) {
+      return false;
+    }
+    size_t offsets[kArchiveColumns + 1] = {0};
+    bool may_match = true;
+    for (int c = 0; c < kArchiveColumns; c++) {
+      const char *e = index.data() + c * entry;
+      double lo = GetDouble(e);
+      double hi = GetDouble(e + 8);
+      offsets[c + 1] = offsets[c] + GetU32(e + 16);
+      for (const auto &p : where) {
+        if (p.column == c && (hi < p.lo || lo > p.hi)) {
+          may_match = false;
+        }
+      }
+    }
+    size_t size = offsets[kArchiveColumns];
+    stats->chunks++;
+    if (!may_match) {
+      stats->chunks_skipped++;
+      stats->bytes_skipped += size;
+      in.seekg(size, ios::cur);
+      continue;
+    }
+
+    data.resize(size);
+    if (!in.read(&data[0], size)) {
+      return false;
+    }
+    stats->bytes_read += size;
+    for (int c = 0; c < kArchiveColumns; c++) {
+      if (!needed[c]) {
+        continue;
+      }
+      columns[c].resize(n);
+      const char *p = data.data() + offsets[c];
+      size_t bytes = offsets[c + 1] - offsets[c];
+      bool ok = c == kArchiveTime ? DecodeTimes(p, p + bytes, n, &columns[c])
+                                  : DecodeXor(p, bytes, n, &columns[c]);
+      if (!ok) {
+        return false;
+      }
+    }
+
+    stats->rows_scanned += n;
+    for (size_t i = 0; i < n; i++) {
+      bool match = true;
+      for (const auto &p : where) {
+        double v = columns[p.column][i];
+        match = match && v >= p.lo && v <= p.hi;
+      }
+      if (!match) {
+        continue;
+      }
+      for (int c = 0; c < kArchiveColumns; c++) {
+        values[c] = needed[c] ? columns[c][i] : 0.0;
+      }
+      stats->rows_matched++;
+      row(values);
+    }
+  }
+  return true;
+}
@@ -0,0 +1,115 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+Long-term telemetry archive.
+
+Every tick of the controller is one row of fixed columns (kArchiveColumns).
+Rows are buffered and written in chunks of up to `chunk_rows`, column by
+column, each column compressed on its own:
+
+  time      microseconds, delta-of-delta as zigzag varints; ticks are
+            nearly periodic, so most rows take a byte
+  the rest  doubles XORed with the previous value of the column
+            (Gorilla style): a repeated value is a single bit, a value
+            close to the previous one only stores the bits that changed
+
+Every chunk starts with the min and max of each column. A scan with
+predicates reads those first and seeks past the chunks that can't match,
+and only decompresses the columns it needs in the others.
+
+  file    uint32 magic "MPCA", uint8 version, uint8 n_columns, uint16 0
+  chunk   uint32 n_rows
+          per column: double min, double max, uint32 n_bytes
+          the compressed columns, n_bytes each
+
+Files are appended to, a restarted server continues its archive.
+*/
+
+const uint32_t kArchiveMagic = 0x4143504D;  // "MPCA" read little-endian
+const uint8_t kArchiveVersion = 1;
+
+enum ArchiveColumn {
+  kArchiveTime,  // seconds since the epoch
+  kArchiveX,
+  kArchiveY,
+  kArchivePsi,
+  kArchiveSpeed,
+  // reference polynomial in the car frame
+  kArchiveC0,
+  kArchiveC1,
+  kArchiveC2,
+  kArchiveC3,
+  // commands sent back
+  kArchiveSteering,
+  kArchiveThrottle,
+  // telemetry in to command ready, milliseconds
+  kArchiveSolveMs,
+  kArchiveColumns
+};
+
+extern const char *kArchiveColumnNames[kArchiveColumns];
+
+// Column by name, -1 if there is none.
+int ArchiveColumnByName(const string &name);
+
+// Thread safe; rows may come from the batch workers.
+class ArchiveWriter {
+ public:
+  explicit ArchiveWriter(const string &path, size_t chunk_rows = 4096);
+  // writes the last, partial chunk
+  virtual ~ArchiveWriter();
+
+  bool ok() const { return out.good(); }
+
+  void Append(const double row[kArchiveColumns]);
+  void Flush();
+
+  // The rows buffered for the next chunk, bytes.
+  size_t BufferBytes();
+
+ private:
+  void WriteChunk();
+
+  size_t chunk_rows;
+  std::mutex mutex;
+  ofstream out;
+  vector<double> columns[kArchiveColumns];
+};
+
+// Rows with lo <= column <= hi.
+struct ArchivePredicate {
+  int column;
+  double lo;
+  double hi;
+};
+
+// Parses "solve_ms>50", "speed<=20" etc.
+bool ParsePredicate(const string &s, ArchivePredicate *p);
+
+struct ArchiveScanStats {
+  size_t chunks = 0;
+  size_t chunks_skipped = 0;
+  size_t rows_scanned = 0;
+  size_t rows_matched = 0;
+  size_t bytes_read = 0;
+  size_t bytes_skipped = 0;
+};
+
+// Calls `row` for every row matching all predicates, with the values of
+// `wanted` columns (others are left 0). Returns false on a bad file.
+typedef function<void(const double *row)> ArchiveRowFn;
+bool ScanArchive(const string &path, const vector<ArchivePredicate> &where,
+                 const vector<int> &wanted, ArchiveRowFn row,
+                 ArchiveScanStats *stats);
+
+#endif /* ARCHIVE_H */
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "archive.h"
+
+/*
+Range scans over telemetry archives (see archive.h).
+
+Prints the matching rows as CSV, then how many chunks the index let it
+skip. Times are seconds since the epoch.
+
+  archive_scan [--from t] [--to t] [--where solve_ms>50 ...]
+               [--columns time,speed,solve_ms] [--count] archive ...
+*/
+
+int main(int argc, char *argv[]) {
+  vector<ArchivePredicate> where;
+  vector<int> wanted;
+  vector<string> paths;
+  bool count_only = false;
+  ArchivePredicate time = {kArchiveTime, -1e300, 1e300};
+  bool timed = false;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--from" && has_value) {
+      time.lo = atof(argv[++i]);
+      timed = true;
+    } else if (arg == "--to" && has_value) {
+      time.hi = atof(argv[++i]);
+      timed = true;
+    } else if (arg == "--where" && has_value) {
+      ArchivePredicate p;
+      if (!ParsePredicate(argv[++i], &p)) {
+        cerr << "Bad predicate " << argv[i] << endl;
+        return -1;
+      }
+      where.push_back(p);
+    } else if (arg == "--columns" && has_value) {
+      stringstream names(argv[++i]);
+      string name;
+      while (getline(names, name, ',')) {
+        int c = ArchiveColumnByName(name);
+        if (c < 0) {
+          cerr << "No column " << name << endl;
+          return -1;
+        }
+        wanted.push_back(c);
+      }
+    } else if (arg == "--count") {
+      count_only = true;
+    } else {
+      paths.push_back(arg);
+    }
+  }
+  if (paths.empty()) {
+    cerr << "Give an archive to scan" << endl;
+    return -1;
+  }
+  if (timed) {
+    where.push_back(time);
+  }
+  if (wanted.empty() && !count_only) {
+    for (int c = 0; c < kArchiveColumns; c++) {
+      wanted.push_back(c);
+    }
+  }
+
+  if (!count_only) {
+    for (size_t k = 0; k < wanted.size(); k++) {
+      printf("%s%s", k ? "," : "", kArchiveColumnNames[wanted[k]]);
+    }
+    printf("\n");
+  }
+  ArchiveScanStats stats;
+  for (const auto &path : paths) {
+    bool ok = ScanArchive(path, where, wanted, [&](const double *row) {
+      if (count_only) {
+        return;
+      }
+      for (size_t k = 0; k < wanted.size(); k++) {
+        printf(k ? ",%.9g" : "%.17g", row[wanted[k]]);
+      }
+      printf("\n");
+    }, &stats);
+    if (!ok) {
+      cerr << "Bad archive " << path << endl;
+      return 1;
+    }
+  }
+  fprintf(stderr,
+          "%zu rows matched of %zu scanned, %zu of %zu chunks skipped "
+          "(%zu of %zu bytes)\n",
+          stats.rows_matched, stats.rows_scanned, stats.chunks_skipped,
+          stats.chunks, stats.bytes_skipped,
+          stats.bytes_read + stats.bytes_skipped);
+  if (count_only) {
+    printf("%zu\n", stats.rows_matched);
+  }
+  return 0;
+}
@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+#include "memory.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "track.h"
+
+/*
+Throughput/latency trade-off of the batch window.
+
+Simulates `vehicles` connections on lake_track_waypoints.csv whose
+telemetry ticks arrive nearly together (spread over ~2 ms), runs `ticks`
+ticks per batch window and reports solves per second, submit-to-done
+latency and batch sizes, so the window of `./mpc --batch` can be tuned.
+The memory columns are the process' resident set, CppAD's memory in use
+and the largest tape of a worker's controller after each window.
+
+  batch_bench [vehicles] [workers] [ticks] [track]
+*/
+
+int main(int argc, char *argv[]) {
+  int vehicles = argc > 1 ? atoi(argv[1]) : 24;
+  int workers = argc > 2 ? atoi(argv[2]) : std::thread::hardware_concurrency();
+  int ticks = argc > 3 ? atoi(argv[3]) : 20;
+  std::string path = argc > 4 ? argv[4] : "../lake_track_waypoints.csv";
+
+  Track track;
+  if (!LoadTrack(path, &track)) {
+    std::cerr << "Failed to load track " << path << std::endl;
+    return -1;
+  }
+
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<double> offset(-1.0, 1.0);
+  std::uniform_real_distribution<double> dpsi(-0.1, 0.1);
+  std::uniform_real_distribution<double> speed(30.0, 90.0);
+  std::uniform_int_distribution<int> jitter_us(0, 2000);
+
+  std::vector<double> windows = {0.0, 0.5, 1.0, 2.0, 5.0};
+  printf("%d vehicles, %d workers, %d ticks\n", vehicles, workers, ticks);
+  printf("%10s %12s %10s %10s %10s %8s %8s %9s %8s\n", "window_ms",
+         "solves/s", "p50_ms", "p99_ms", "batch", "steals", "rss_mb",
+         "cppad_kb", "tape_kb");
+
+  for (double window_ms : windows) {
+    BatchScheduler scheduler(workers, window_ms);
+    scheduler.RecordLatencies(true);
+    std::atomic<int> done(0);
+    auto start = std::chrono::steady_clock::now();
+
+    for (int tick = 0; tick < ticks; tick++) {
+      done = 0;
+      for (int v = 0; v < vehicles; v++) {
+        int index = v * track.x.size() / vehicles + tick;
+        Telemetry t = TelemetryOnTrack(track, index, 0.5, offset(rng),
+                                       dpsi(rng), speed(rng));
+        scheduler.Submit(t, [&done](const Steer &) { done++; });
+        std::this_thread::sleep_for(
+            std::chrono::microseconds(jitter_us(rng) / vehicles));
+      }
+      while (done < vehicles) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    }
+
+    double seconds = MsSince(start) / 1000.0;
+    BatchScheduler::Stats stats = scheduler.TakeStats();
+    size_t tape = 0;
+    for (const auto &memory : scheduler.Memory()) {
+      tape = std::max(tape, memory.tape);
+    }
+    printf("%10.1f %12.1f %10.2f %10.2f %10.1f %8zu %8.1f %9.1f %8.1f\n",
+           window_ms, stats.jobs / seconds, Percentile(stats.latency_ms, 50),
+           Percentile(stats.latency_ms, 99),
+           stats.batches ? double(stats.jobs) / stats.batches : 0.0,
+           stats.steals, ResidentBytes() / 1048576.0,
+           CppADInUseBytes() / 1024.0, tape / 1024.0);
+  }
+  return 0;
+}
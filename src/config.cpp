@@ -0,0 +1,155 @@
+#include "config.h"
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include "json.hpp"
+
+// for convenience
+using json = nlohmann::json;
+
+// Every numeric field by name, so reading and writing can't drift apart.
+#define CONFIG_FIELDS(X)  \
+  X(N)                    \
+  X(dt)                   \
+  X(ref_v)                \
+  X(ref_cte)              \
+  X(ref_epsi)             \
+  X(weight_cet)           \
+  X(weight_epsi)          \
+  X(weight_constant_vel)  \
+  X(weight_delta)         \
+  X(weight_a)             \
+  X(weight_delta_diff)    \
+  X(weight_a_diff)        \
+  X(weight_terminal_cte)  \
+  X(weight_terminal_epsi) \
+  X(obstacle_margin)      \
+  X(obstacle_reach)       \
+  X(latency_dt)           \
+  X(feedback_period)      \
+  X(eval_threads)         \
+  X(eval_parallel_min_N)
+
+std::string ConfigToJson(const MPCConfig &config) {
+  json j;
+#define WRITE_FIELD(name) j[#name] = config.name;
+  CONFIG_FIELDS(WRITE_FIELD)
+#undef WRITE_FIELD
+  j["ipopt_options"] = config.ipopt_options;
+  j["model"] = config.model;
+  j["integrator"] = config.integrator;
+  j["formulation"] = config.formulation;
+  j["solver"] = config.solver;
+  j["terminal_table"] = config.terminal_table;
+  j["initial_guess"] = config.initial_guess;
+  return j.dump(2);
+}
+
+bool ConfigFromJson(const std::string &text, MPCConfig *config) {
+  json j;
+  try {
+    j = json::parse(text);
+  } catch (const std::exception &) {
+    return false;
+  }
+  if (!j.is_object()) {
+    return false;
+  }
+  MPCConfig parsed = *config;
+#define READ_FIELD(name)                        \
+  if (j.find(#name) != j.end()) {               \
+    if (!j[#name].is_number()) return false;    \
+    parsed.name = j[#name];                     \
+  }
+  CONFIG_FIELDS(READ_FIELD)
+#undef READ_FIELD
+  if (j.find("ipopt_options") != j.end()) {
+    if (!j["ipopt_options"].is_string()) return false;
+    parsed.ipopt_options = j["ipopt_options"];
+  }
+  if (j.find("model") != j.end()) {
+    if (!j["model"].is_string()) return false;
+    parsed.model = j["model"];
+  }
+  if (j.find("integrator") != j.end()) {
+    if (!j["integrator"].is_string()) return false;
+    parsed.integrator = j["integrator"];
+  }
+  if (j.find("formulation") != j.end()) {
+    if (!j["formulation"].is_string()) return false;
+    parsed.formulation = j["formulation"];
+  }
+  if (j.find("solver") != j.end()) {
+    if (!j["solver"].is_string()) return false;
+    parsed.solver = j["solver"];
+  }
+  if (j.find("terminal_table") != j.end()) {
+    if (!j["terminal_table"].is_string()) return false;
+    parsed.terminal_table = j["terminal_table"];
+  }
+  if (j.find("initial_guess") != j.end()) {
+    if (!j["initial_guess"].is_string()) return false;
+    parsed.initial_guess = j["initial_guess"];
+  }
+  if (parsed.model != "kinematic" && parsed.model != "dynamic") {
+    return false;
+  }
+  if (parsed.integrator != "euler" &&
+      parsed.integrator != "euler_integrated" &&
+      parsed.integrator != "rk2" && parsed.integrator != "rk4") {
+    return false;
+  }
+  if (parsed.formulation != "full" && parsed.formulation != "reduced") {
+    return false;
+  }
+  if (parsed.solver != "ipopt" && parsed.solver != "riccati" &&
+      parsed.solver != "riccati_mixed") {
+    return false;
+  }
+  // the horizon needs at least two actuations for the rate terms
+  if (parsed.N < 3 || parsed.N > 1000 || parsed.dt <= 0.0) {
+    return false;
+  }
+  if (parsed.eval_threads < 1 || parsed.eval_threads > 64) {
+    return false;
+  }
+  if (parsed.feedback_period < 0.0) {
+    return false;
+  }
+  // the cost takes the square root of every weight (Cost<...>::Jacobian)
+  const double weights[] = {parsed.weight_cet,
+                            parsed.weight_epsi,
+                            parsed.weight_constant_vel,
+                            parsed.weight_delta,
+                            parsed.weight_a,
+                            parsed.weight_delta_diff,
+                            parsed.weight_a_diff,
+                            parsed.weight_terminal_cte,
+                            parsed.weight_terminal_epsi};
+  for (double w : weights) {
+    if (!std::isfinite(w) || w < 0.0) {
+      return false;
+    }
+  }
+  if (!std::isfinite(parsed.ref_v)) {
+    return false;
+  }
+  *config = parsed;
+  return true;
+}
+
+bool LoadConfig(const std::string &path, MPCConfig *config) {
+  std::ifstream in(path);
+  if (!in) {
+    return false;
+  }
+  std::stringstream text;
+  text << in.rdbuf();
+  return ConfigFromJson(text.str(), config);
+}
+
+bool SaveConfig(const std::string &path, const MPCConfig &config) {
+  std::ofstream out(path);
+  out << ConfigToJson(config) << std::endl;
+  return static_cast<bool>(out);
+}
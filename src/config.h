@@ -0,0 +1,94 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stddef.h>
+#include <string>
+
+/*
+Parameters of the controller. The defaults are the values tuned against
+the Unity simulator; a JSON config file (e.g. written by mpc_tune) may
+override any of them by name.
+*/
+struct MPCConfig {
+  // Set the timestep length and duration
+  size_t N = 10;
+  double dt = 0.12;
+
+  // set the reference velocity
+  double ref_v = 80;
+  // set the reference cross track error and orientation error
+  // even they all 0
+  double ref_cte = 0.0;
+  double ref_epsi = 0.0;
+
+  // set weights to each component of the cost function
+  // be tuned based on the relative importance of each part
+  double weight_cet = 1500.0;
+  double weight_epsi = 1000.0;
+  double weight_constant_vel = 1.0;
+  double weight_delta = 20.0;
+  double weight_a = 40.0;
+  double weight_delta_diff = 40.0;
+  double weight_a_diff = 80.0;
+  // extra weight on the errors at the end of the horizon, off by default
+  double weight_terminal_cte = 0.0;
+  double weight_terminal_epsi = 0.0;
+  // LQR cost-to-go at the end of the horizon: the table of terminal
+  // weights by speed written by lqr_terminal, "" for none (see
+  // terminal_cost.h)
+  std::string terminal_table;
+
+  // initial guess for the solver from the network written by guess_train,
+  // "" to start from zero actuations (see guess.h)
+  std::string initial_guess;
+
+  // clearance kept from obstacles, and how far from the previous plan an
+  // obstacle still becomes a constraint, meters (see obstacles.h)
+  double obstacle_margin = 1.5;
+  double obstacle_reach = 5.0;
+
+  // the plant latency predicted away before solving, seconds
+  double latency_dt = 0.1;
+
+  // seconds a vehicle's plan is followed with its LQR feedback before the
+  // next full solve, 0 to solve on every message (see feedback.h)
+  double feedback_period = 0.0;
+
+  // process model, "kinematic" or "dynamic" (see vehicle_model.h)
+  std::string model = "kinematic";
+  // and how it is integrated over dt: "euler", or "rk2" (midpoint) and
+  // "rk4", which stay accurate with a larger dt (see integrator_bench).
+  // Those take cte and epsi from the integrated state, "euler_integrated"
+  // is Euler with the errors taken the same way.
+  std::string integrator = "euler";
+
+  // Ipopt's variables: "full" carries cte and epsi over the horizon with
+  // their own model constraints, "reduced" only the model's states and
+  // computes the errors from them in the cost (see FG_eval)
+  std::string formulation = "full";
+
+  // "ipopt", or the in-tree iterative LQR (see riccati.h) in double
+  // ("riccati") or mostly in float with a double refinement at the end
+  // ("riccati_mixed"); ticks with obstacles always use Ipopt
+  std::string solver = "ipopt";
+
+  // Threads evaluating the stages of the Ipopt problem in parallel (see
+  // stage_nlp.h), counting the solving thread; 1 keeps the CppAD path.
+  // Only horizons of at least eval_parallel_min_N use them.
+  int eval_threads = 1;
+  size_t eval_parallel_min_N = 40;
+
+  // extra Ipopt options in CppAD::ipopt::solve's format, one per line,
+  // e.g. "Numeric tol 1e-6\nString mu_strategy adaptive\n"
+  std::string ipopt_options;
+};
+
+// Fields missing from the file keep their current value. A config with
+// an unknown name, a horizon out of range, a negative weight or a
+// non-finite ref_v is rejected as a whole.
+bool LoadConfig(const std::string &path, MPCConfig *config);
+bool SaveConfig(const std::string &path, const MPCConfig &config);
+std::string ConfigToJson(const MPCConfig &config);
+bool ConfigFromJson(const std::string &text, MPCConfig *config);
+
+#endif /* CONFIG_H */
@@ -0,0 +1,175 @@
+#include "controller.h"
+#include <math.h>
+#include "Eigen-3.3/Eigen/QR"
+
+double polyeval(Eigen::VectorXd coeffs, double x) {
+  double result = 0.0;
+  for (int i = 0; i < coeffs.size(); i++) {
+    result += coeffs[i] * pow(x, i);
+  }
+  return result;
+}
+
+// Adapted from
+// https://github.com/JuliaMath/Polynomials.jl/blob/master/src/Polynomials.jl#L676-L716
+Eigen::VectorXd polyfit(Eigen::VectorXd xvals, Eigen::VectorXd yvals,
+                        int order) {
+  assert(xvals.size() == yvals.size());
+  assert(order >= 1 && order <= xvals.size() - 1);
+  Eigen::MatrixXd A(xvals.size(), order + 1);
+
+  for (int i = 0; i < xvals.size(); i++) {
+    A(i, 0) = 1.0;
+  }
+
+  for (int j = 0; j < xvals.size(); j++) {
+    for (int i = 0; i < order; i++) {
+      A(j, i + 1) = A(j, i) * xvals(j);
+    }
+  }
+
+  auto Q = A.householderQr();
+  auto result = Q.solve(yvals);
+  return result;
+}
+
+void WaypointsToCar(const Telemetry &t, Eigen::VectorXd *x,
+                    Eigen::VectorXd *y) {
+  *x = Eigen::VectorXd(t.ptsx.size());
+  *y = Eigen::VectorXd(t.ptsy.size());
+
+  // loop all waypoints
+  for (int i = 0; i < t.ptsx.size(); i++) {
+    double dx_global = t.ptsx[i] - t.x;
+    double dy_global = t.ptsy[i] - t.y;
+    (*x)[i] =  cos(t.psi) * dx_global + sin(t.psi) * dy_global;
+    (*y)[i] = -sin(t.psi) * dx_global + cos(t.psi) * dy_global;
+  }
+}
+
+Eigen::VectorXd ReferenceCoeffs(const Telemetry &t) {
+  Eigen::VectorXd x, y;
+  WaypointsToCar(t, &x, &y);
+  return polyfit(x, y, 3);
+}
+
+Eigen::VectorXd CarState(const Telemetry &t, const Eigen::VectorXd &coeffs) {
+  Eigen::VectorXd state(6);
+  state << 0.0, 0.0, 0.0, t.speed, polyeval(coeffs, 0.0), -atan(coeffs[1]);
+  return state;
+}
+
+Steer Drive(MPC &mpc, const Telemetry &t, ObstacleField *field,
+            MPCPlan *plan, double ref_v) {
+  /*
+  * Calculate steering angle and throttle using MPC.
+  * Both are in between [-1, 1].
+  */
+  // STEP 1: get data from the simulator
+  // https://github.com/udacity/CarND-MPC-Project/blob/master/DATA.md
+  // t.ptsx, t.ptsy: the global x, y positions of the waypoints
+  // px, py: the global x, y position of the vehicle
+  // psi, v: the orientation, the current velocity of the vehicle
+  double px = t.x;
+  double py = t.y;
+  double psi = t.psi;
+  double v = t.speed;
+
+  // STEP 2: Fit a 3rd order polynomial to the waypoints (reference trajectory)
+  // with respect to the car frame of coordinates
+  // Transfer the waypoints w.r.t the global to car frame of reference
+  // "The simulator returns waypoints using the map's coordinate system, which is
+  // different than the car's coordinate system. Transforming these waypoints
+  // will make it easier to both display them and to calculate the CTE and epsi values"
+  Eigen::VectorXd ptsx_car;
+  Eigen::VectorXd ptsy_car;
+  WaypointsToCar(t, &ptsx_car, &ptsy_car);
+
+  auto coeffs = polyfit(ptsx_car, ptsy_car, 3);
+
+  // STEP 3: Set initial state values
+  // Calculate cross track error and orientation error values.
+  // The cross track error is calculated by evaluating at polynomial at x, f(x)
+  // and subtracting y.
+  // Because only the first waypoint (w.r.t the car frame) is used to calculate
+  // the cross track error and orientation error, x = y = 0.0, psi = 0.0.
+  double cte = polyeval(coeffs, 0.0) - 0.0;
+  // Due to the sign starting at 0, the orientation error is -f'(x).
+  // derivative of coeffs[0] + coeffs[1] * x -> coeffs[1]
+  double epsi = 0.0 - atan(coeffs[1]);
+
+  double px_initial = 0.0;
+  double py_initial = 0.0;
+  double psi_initial = 0.0;
+
+  Eigen::VectorXd state(6);
+  state << px_initial, py_initial, psi_initial, v, cte, epsi;
+
+  // Obstacles the car may get near this tick, see obstacles.h.
+  // Without a field of its own the vehicle has no previous plan and the
+  // obstacles within reach of the horizon at the current speed are used.
+  vector<Obstacle> obstacles;
+  ObstacleField local;
+  if (!field && !t.obstacles.empty()) {
+    field = &local;
+  }
+  if (field) {
+    field->SetObstacles(t.obstacles);
+  }
+  if (!t.obstacles.empty()) {
+    MPCConfig config = mpc.Config();
+    obstacles = field->Nearby(px, py, fabs(v) * config.N * config.dt,
+                              config.obstacle_reach);
+    // to the car frame, like the waypoints
+    for (auto &o : obstacles) {
+      double dx_global = o.x - px;
+      double dy_global = o.y - py;
+      o.x =  cos(psi) * dx_global + sin(psi) * dy_global;
+      o.y = -sin(psi) * dx_global + cos(psi) * dy_global;
+    }
+  }
+
+  // STEP 4: solve steering angle and throttle using MPC
+  auto solutions = mpc.Solve(state, coeffs, obstacles, plan, ref_v);
+
+  Steer steer;
+  steer.steering_angle = -solutions[0]; // psi values are reverse in the simulator
+  steer.throttle = solutions[1];
+
+  /*
+  Display predicted trajectory and waypoints/reference line
+  "These (x,y) points are displayed in reference to the vehicle's coordinate system.
+  Recall that the x axis always points in the direction of the car’s heading and
+  the y axis points to the left of the car. So if you wanted to display a point
+  10 units directly in front of the car, you could set next_x = {10.0} and next_y = {0.0}."
+  */
+  // Display the MPC predicted trajectory
+  // the points in the simulator are connected by a Green line
+  for (int i = 2; i < solutions.size(); i++) {
+    if (i % 2 == 0) {
+      steer.mpc_x.push_back(solutions[i]);
+    }
+    else {
+      steer.mpc_y.push_back(solutions[i]);
+    }
+  }
+
+  // keep the plan in map coordinates for culling the obstacles next tick
+  if (field) {
+    vector<double> plan_x;
+    vector<double> plan_y;
+    for (size_t i = 0; i < steer.mpc_x.size(); i++) {
+      plan_x.push_back(px + cos(psi) * steer.mpc_x[i] - sin(psi) * steer.mpc_y[i]);
+      plan_y.push_back(py + sin(psi) * steer.mpc_x[i] + cos(psi) * steer.mpc_y[i]);
+    }
+    field->SetPlan(plan_x, plan_y);
+  }
+
+  // Display the waypoints/reference line
+  // the points in the simulator are connected by a Yellow line
+  for (int i = 0; i < ptsx_car.size(); i++) {
+    steer.next_x.push_back(ptsx_car[i]);
+    steer.next_y.push_back(ptsy_car[i]);
+  }
+  return steer;
+}
@@ -0,0 +1,41 @@
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+#include <math.h>
+#include "Eigen-3.3/Eigen/Core"
+#include "MPC.h"
+#include "obstacles.h"
+#include "wire.h"
+
+// For converting back and forth between radians and degrees.
+constexpr double pi() { return M_PI; }
+inline double deg2rad(double x) { return x * pi() / 180; }
+inline double rad2deg(double x) { return x * 180 / pi(); }
+
+// Evaluate a polynomial.
+double polyeval(Eigen::VectorXd coeffs, double x);
+
+// Fit a polynomial.
+Eigen::VectorXd polyfit(Eigen::VectorXd xvals, Eigen::VectorXd yvals,
+                        int order);
+
+// The waypoints in the car frame, and the reference polynomial fit to
+// them as Drive() does.
+void WaypointsToCar(const Telemetry &t, Eigen::VectorXd *x,
+                    Eigen::VectorXd *y);
+Eigen::VectorXd ReferenceCoeffs(const Telemetry &t);
+
+// The state (x, y, psi, v, cte, epsi) Drive() solves from, in the car
+// frame, for those coefficients.
+Eigen::VectorXd CarState(const Telemetry &t, const Eigen::VectorXd &coeffs);
+
+// One control step: transform the waypoints into the car frame, fit the
+// reference polynomial, solve the MPC and build the reply.
+// Shared by the JSON and binary paths of the server.
+// `field` is the vehicle's obstacle state kept between ticks, if any.
+// `plan`, if given, gets the solve's plan and feedback (see feedback.h).
+// `ref_v`, if not NAN, replaces the config's speed reference for this tick.
+Steer Drive(MPC &mpc, const Telemetry &t, ObstacleField *field = nullptr,
+            MPCPlan *plan = nullptr, double ref_v = NAN);
+
+#endif /* CONTROLLER_H */
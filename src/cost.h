@@ -0,0 +1,212 @@
+#ifndef COST_H
+#define COST_H
+
+#include <math.h>
+#include <stddef.h>
+#include <vector>
+#include "config.h"
+#include "layout.h"
+
+/*
+The MPC cost as a list of weighted residual terms,
+
+  cost = sum over terms and stages t of weight * residual(t)^2
+
+declared as types, e.g.
+
+  typedef Cost<TrackRef<&VarLayout::cte_start, &MPCConfig::weight_cet,
+                        &MPCConfig::ref_cte>,
+               Rate<&VarLayout::a_start, &MPCConfig::weight_a_diff>>
+      MyCost;
+
+The variable block comes from the layout and the weight and reference
+from the config, by member pointer. Cost<...>::Eval expands into one loop
+over the stages with every term inlined and the square written out, so a
+new term is one line and costs no more than a hand-written one.
+
+All residuals are linear in the variables, so the Gauss-Newton Jacobian
+of the stacked residuals sqrt(weight) * residual is constant;
+Cost<...>::Jacobian lists its nonzeros and Cost<...>::Gradient adds up
+the gradient of the cost.
+*/
+
+// what the terms on a single variable per stage share
+template <size_t VarLayout::*Start, double MPCConfig::*Weight>
+struct Single {
+  static double weight(const MPCConfig &c) { return c.*Weight; }
+
+  // columns and coefficients of d residual / d vars, returns the count
+  static size_t gradient(const VarLayout &l, size_t t, size_t *cols,
+                         double *coefs) {
+    cols[0] = l.*Start + t;
+    coefs[0] = 1.0;
+    return 1;
+  }
+};
+
+// residual = vars[start + t] - ref, at every stage
+template <size_t VarLayout::*Start, double MPCConfig::*Weight,
+          double MPCConfig::*Ref>
+struct TrackRef : Single<Start, Weight> {
+  static size_t begin(size_t N) { return 0; }
+  static size_t end(size_t N) { return N; }
+
+  template <class T, class Vars>
+  static T residual(const VarLayout &l, const MPCConfig &c, const Vars &vars,
+                    size_t t) {
+    return vars[l.*Start + t] - c.*Ref;
+  }
+};
+
+// TrackRef at the last stage only.
+template <size_t VarLayout::*Start, double MPCConfig::*Weight,
+          double MPCConfig::*Ref>
+struct Terminal : TrackRef<Start, Weight, Ref> {
+  static size_t begin(size_t N) { return N - 1; }
+};
+
+// residual = vars[start + t], for the N - 1 actuations
+template <size_t VarLayout::*Start, double MPCConfig::*Weight>
+struct Effort : Single<Start, Weight> {
+  static size_t begin(size_t N) { return 0; }
+  static size_t end(size_t N) { return N - 1; }
+
+  template <class T, class Vars>
+  static T residual(const VarLayout &l, const MPCConfig &c, const Vars &vars,
+                    size_t t) {
+    return vars[l.*Start + t];
+  }
+};
+
+// residual = vars[start + t + 1] - vars[start + t], between actuations
+template <size_t VarLayout::*Start, double MPCConfig::*Weight>
+struct Rate {
+  static size_t begin(size_t N) { return 0; }
+  static size_t end(size_t N) { return N - 2; }
+  static double weight(const MPCConfig &c) { return c.*Weight; }
+
+  template <class T, class Vars>
+  static T residual(const VarLayout &l, const MPCConfig &c, const Vars &vars,
+                    size_t t) {
+    return vars[l.*Start + t + 1] - vars[l.*Start + t];
+  }
+
+  static size_t gradient(const VarLayout &l, size_t t, size_t *cols,
+                         double *coefs) {
+    cols[0] = l.*Start + t + 1;
+    coefs[0] = 1.0;
+    cols[1] = l.*Start + t;
+    coefs[1] = -1.0;
+    return 2;
+  }
+};
+
+template <class... Terms>
+struct Cost {
+  // The cost of `vars`, T is double or CppAD::AD<double>.
+  template <class T, class Vars>
+  static T Eval(const VarLayout &l, const MPCConfig &c, const Vars &vars) {
+    T sum = 0.0;
+    for (size_t t = 0; t < c.N; t++) {
+      // one statement per term, in declaration order
+      int expand[] = {0, (Add<Terms, T>(l, c, vars, t, sum), 0)...};
+      (void)expand;
+    }
+    return sum;
+  }
+
+  // Nonzeros (row, col, value) of the Jacobian of the stacked residuals
+  // sqrt(weight) * residual, one row per term and stage, and the number
+  // of rows. J^T J is the Gauss-Newton Hessian of the cost (over 2).
+  static size_t Jacobian(const VarLayout &l, const MPCConfig &c,
+                         std::vector<size_t> *rows, std::vector<size_t> *cols,
+                         std::vector<double> *vals) {
+    size_t row = 0;
+    for (size_t t = 0; t < c.N; t++) {
+      int expand[] = {0, (AddRow<Terms>(l, c, t, &row, rows, cols, vals), 0)...};
+      (void)expand;
+    }
+    return row;
+  }
+
+  // Adds the gradient of the cost at `vars` to `grad`.
+  template <class Vars, class Grad>
+  static void Gradient(const VarLayout &l, const MPCConfig &c,
+                       const Vars &vars, Grad &grad) {
+    for (size_t t = 0; t < c.N; t++) {
+      int expand[] = {0, (AddGradient<Terms>(l, c, vars, t, grad), 0)...};
+      (void)expand;
+    }
+  }
+
+ private:
+  static bool Covers(size_t begin, size_t end, size_t t) {
+    return t >= begin && t < end;
+  }
+
+  template <class Term, class T, class Vars>
+  static void Add(const VarLayout &l, const MPCConfig &c, const Vars &vars,
+                  size_t t, T &sum) {
+    double w = Term::weight(c);
+    // a weight of 0 switches a term off without taping anything
+    if (w != 0.0 && Covers(Term::begin(c.N), Term::end(c.N), t)) {
+      T r = Term::template residual<T>(l, c, vars, t);
+      sum += w * r * r;
+    }
+  }
+
+  template <class Term, class Vars, class Grad>
+  static void AddGradient(const VarLayout &l, const MPCConfig &c,
+                          const Vars &vars, size_t t, Grad &grad) {
+    double w = Term::weight(c);
+    if (w == 0.0 || !Covers(Term::begin(c.N), Term::end(c.N), t)) {
+      return;
+    }
+    double r = Term::template residual<double>(l, c, vars, t);
+    size_t term_cols[2];
+    double coefs[2];
+    size_t n = Term::gradient(l, t, term_cols, coefs);
+    for (size_t k = 0; k < n; k++) {
+      grad[term_cols[k]] += 2.0 * w * r * coefs[k];
+    }
+  }
+
+  template <class Term>
+  static void AddRow(const VarLayout &l, const MPCConfig &c, size_t t,
+                     size_t *row, std::vector<size_t> *rows,
+                     std::vector<size_t> *cols, std::vector<double> *vals) {
+    double w = Term::weight(c);
+    if (w == 0.0 || !Covers(Term::begin(c.N), Term::end(c.N), t)) {
+      return;
+    }
+    size_t term_cols[2];
+    double coefs[2];
+    size_t n = Term::gradient(l, t, term_cols, coefs);
+    for (size_t k = 0; k < n; k++) {
+      rows->push_back(*row);
+      cols->push_back(term_cols[k]);
+      vals->push_back(sqrt(w) * coefs[k]);
+    }
+    (*row)++;
+  }
+};
+
+// The controller's cost, for FG_eval, the stage problem and the in-tree
+// solvers in MPC.cpp. A term with weight 0 is skipped.
+typedef Cost<
+    TrackRef<&VarLayout::cte_start, &MPCConfig::weight_cet, &MPCConfig::ref_cte>,
+    TrackRef<&VarLayout::epsi_start, &MPCConfig::weight_epsi, &MPCConfig::ref_epsi>,
+    // avoid stopping
+    TrackRef<&VarLayout::v_start, &MPCConfig::weight_constant_vel, &MPCConfig::ref_v>,
+    // Minimize the use of actuators.
+    Effort<&VarLayout::delta_start, &MPCConfig::weight_delta>,
+    Effort<&VarLayout::a_start, &MPCConfig::weight_a>,
+    // Minimize the value gap between sequential actuations.
+    Rate<&VarLayout::delta_start, &MPCConfig::weight_delta_diff>,
+    Rate<&VarLayout::a_start, &MPCConfig::weight_a_diff>,
+    // end the horizon on the reference
+    Terminal<&VarLayout::cte_start, &MPCConfig::weight_terminal_cte, &MPCConfig::ref_cte>,
+    Terminal<&VarLayout::epsi_start, &MPCConfig::weight_terminal_epsi, &MPCConfig::ref_epsi>>
+    ControllerCost;
+
+#endif /* COST_H */
@@ -0,0 +1,262 @@
+#include "farm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <stdexcept>
+#include "interference.h"
+
+// for convenience
+using json = nlohmann::json;
+
+#ifdef MPC_PGO_GENERATE
+extern "C" void __gcov_dump();
+#endif
+
+// A forked worker and the shard it is running, -1 if idle.
+struct FarmWorker {
+  pid_t pid = -1;
+  int to_worker = -1;
+  int from_worker = -1;
+  int shard = -1;
+  string buffer;
+  chrono::steady_clock::time_point started;
+};
+
+static bool WriteAll(int fd, const string &s) {
+  size_t done = 0;
+  while (done < s.size()) {
+    ssize_t n = write(fd, s.data() + done, s.size() - done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    done += n;
+  }
+  return true;
+}
+
+static bool ReadLine(int fd, string *line) {
+  line->clear();
+  char c;
+  while (true) {
+    ssize_t n = read(fd, &c, 1);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    if (c == '\n') return true;
+    line->push_back(c);
+  }
+}
+
+// The worker side: read shard numbers, answer with one JSON line each.
+static void WorkerMain(int in, int out, const vector<string> &shards,
+                       ShardFn run) {
+  string line;
+  while (ReadLine(in, &line)) {
+    int shard = atoi(line.c_str());
+    json result = run(shards[shard]);
+    WriteAll(out, result.dump() + "\n");
+  }
+}
+
+static void Spawn(vector<FarmWorker> &workers, int slot,
+                  const vector<string> &shards, const FarmOptions &opts,
+                  ShardFn run) {
+  FarmWorker *w = &workers[slot];
+  int down[2], up[2];
+  if (pipe(down) != 0 || pipe(up) != 0) {
+    perror("pipe");
+    exit(-1);
+  }
+  // don't let the child inherit and flush our buffered output
+  fflush(nullptr);
+  cout.flush();
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(down[1]);
+    close(up[0]);
+    // the other workers only see EOF if we don't hold their pipes open
+    for (auto &other : workers) {
+      if (other.pid >= 0) {
+        close(other.to_worker);
+        close(other.from_worker);
+      }
+    }
+    if (opts.pin) {
+      PinThisThread(slot);
+    }
+    // the solver prints every cost, keep the driver's output readable
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull >= 0) {
+      dup2(devnull, STDOUT_FILENO);
+    }
+    WorkerMain(down[0], up[1], shards, run);
+#ifdef MPC_PGO_GENERATE
+    // _exit() skips writing the profile of an instrumented build (pgo.sh)
+    __gcov_dump();
+#endif
+    _exit(0);
+  }
+  close(down[0]);
+  close(up[1]);
+  w->pid = pid;
+  w->to_worker = down[1];
+  w->from_worker = up[0];
+  w->shard = -1;
+  w->buffer.clear();
+}
+
+static void Reap(FarmWorker *w, string *why) {
+  close(w->to_worker);
+  close(w->from_worker);
+  int status = 0;
+  waitpid(w->pid, &status, 0);
+  if (WIFSIGNALED(status)) {
+    *why = string("killed by signal ") + strsignal(WTERMSIG(status));
+  } else {
+    *why = "exited with status " + to_string(WEXITSTATUS(status));
+  }
+  w->pid = -1;
+}
+
+vector<json> RunFarm(const vector<string> &shards, const FarmOptions &opts,
+                     ShardFn run) {
+  vector<json> results(shards.size());
+  vector<int> attempts(shards.size(), 0);
+  deque<int> queue;
+  for (size_t i = 0; i < shards.size(); i++) {
+    queue.push_back(i);
+  }
+
+  // a dead worker must not kill the driver when it writes to the pipe
+  signal(SIGPIPE, SIG_IGN);
+
+  int n_workers = opts.workers < 1 ? 1 : opts.workers;
+  if (n_workers > static_cast<int>(shards.size())) {
+    n_workers = shards.size();
+  }
+  vector<FarmWorker> workers(n_workers);
+  for (int i = 0; i < n_workers; i++) {
+    Spawn(workers, i, shards, opts, run);
+  }
+
+  size_t finished = 0;
+  while (finished < shards.size()) {
+    // hand out work to idle workers
+    for (int i = 0; i < n_workers; i++) {
+      FarmWorker &w = workers[i];
+      if (w.pid < 0 && !queue.empty()) {
+        Spawn(workers, i, shards, opts, run);
+      }
+      if (w.pid >= 0 && w.shard < 0 && !queue.empty()) {
+        w.shard = queue.front();
+        queue.pop_front();
+        attempts[w.shard]++;
+        w.started = chrono::steady_clock::now();
+        WriteAll(w.to_worker, to_string(w.shard) + "\n");
+      }
+    }
+
+    vector<pollfd> fds;
+    vector<int> owner;
+    for (int i = 0; i < n_workers; i++) {
+      if (workers[i].pid >= 0 && workers[i].shard >= 0) {
+        pollfd p;
+        p.fd = workers[i].from_worker;
+        p.events = POLLIN;
+        p.revents = 0;
+        fds.push_back(p);
+        owner.push_back(i);
+      }
+    }
+    if (fds.empty()) {
+      break;
+    }
+    poll(fds.data(), fds.size(), 100);
+
+    for (size_t k = 0; k < fds.size(); k++) {
+      FarmWorker &w = workers[owner[k]];
+      bool failed = false;
+      string why;
+      if (fds[k].revents & (POLLIN | POLLHUP | POLLERR)) {
+        char chunk[4096];
+        ssize_t n = read(w.from_worker, chunk, sizeof(chunk));
+        if (n > 0) {
+          w.buffer.append(chunk, n);
+        } else if (n == 0 || errno != EINTR) {
+          failed = true;
+        }
+      }
+      double elapsed = chrono::duration<double>(
+          chrono::steady_clock::now() - w.started).count();
+      if (!failed && opts.timeout > 0.0 && elapsed > opts.timeout) {
+        kill(w.pid, SIGKILL);
+        failed = true;
+      }
+
+      size_t eol = w.buffer.find('\n');
+      bool garbled = false;
+      json result;
+      if (eol != string::npos) {
+        try {
+          result = json::parse(w.buffer.substr(0, eol));
+        } catch (const std::invalid_argument &) {
+          // a stray print or a write cut short by a crash; nothing else
+          // the worker sends can be trusted either
+          garbled = true;
+          kill(w.pid, SIGKILL);
+          failed = true;
+        }
+      }
+      if (eol != string::npos && !garbled) {
+        results[w.shard] = result;
+        w.buffer.erase(0, eol + 1);
+        if (opts.verbose) {
+          cerr << "[" << ++finished << "/" << shards.size() << "] "
+               << shards[w.shard] << std::endl;
+        } else {
+          ++finished;
+        }
+        w.shard = -1;
+        if (failed || queue.empty()) {
+          // no more work, let it exit; a worker that died or was killed
+          // right after its result can't take the next shard either
+          Reap(&w, &why);
+        }
+        continue;
+      }
+
+      if (failed) {
+        int shard = w.shard;
+        Reap(&w, &why);
+        if (garbled) {
+          why = "wrote an unreadable result";
+        } else if (opts.timeout > 0.0 && elapsed > opts.timeout) {
+          why = "timed out";
+        }
+        if (attempts[shard] <= opts.retries) {
+          cerr << shards[shard] << ": worker " << why << ", retrying" << endl;
+          queue.push_front(shard);
+        } else {
+          results[shard] = {{"shard", shards[shard]}, {"ok", false},
+                            {"error", why}};
+          finished++;
+          cerr << shards[shard] << ": worker " << why << ", giving up" << endl;
+        }
+      }
+    }
+  }
+
+  for (auto &w : workers) {
+    if (w.pid >= 0) {
+      string why;
+      Reap(&w, &why);
+    }
+  }
+  return results;
+}
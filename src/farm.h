@@ -0,0 +1,39 @@
+#ifndef FARM_H
+#define FARM_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "json.hpp"
+
+using namespace std;
+
+/*
+Multi-process work farm.
+
+CppAD keeps global state and Ipopt's default linear solver is not thread
+safe, so large runs use processes rather than threads. RunFarm() forks
+`workers` processes, each pinned to its own core. Idle workers pull the
+next shard from the driver over a pipe, run `run` on it in their own copy
+of the controller and send back one JSON result. A worker that crashes
+or exceeds `timeout` is replaced and its shard retried up to `retries`
+times before it is reported as failed.
+*/
+struct FarmOptions {
+  int workers = 1;
+  int retries = 2;
+  // seconds a single shard may take, 0 for no limit
+  double timeout = 0.0;
+  bool pin = true;
+  // print a line per finished shard to stderr
+  bool verbose = true;
+};
+
+typedef function<nlohmann::json(const string &shard)> ShardFn;
+
+// Results in the order of `shards`. A shard that kept failing gets
+// {"shard": ..., "ok": false, "error": ...}.
+vector<nlohmann::json> RunFarm(const vector<string> &shards,
+                               const FarmOptions &opts, ShardFn run);
+
+#endif /* FARM_H */
@@ -0,0 +1,73 @@
+#include "feedback.h"
+#include <math.h>
+#include "controller.h"
+
+// (x, y) in map coordinates to the frame of a car at (px, py, psi).
+static void ToCar(double px, double py, double psi, double x, double y,
+                  double *car_x, double *car_y) {
+  double dx = x - px;
+  double dy = y - py;
+  *car_x =  cos(psi) * dx + sin(psi) * dy;
+  *car_y = -sin(psi) * dx + cos(psi) * dy;
+}
+
+Steer DriveWithFeedback(MPC &mpc, const Telemetry &t, double now,
+                        PlanFeedback *feedback, ObstacleField *field) {
+  std::lock_guard<std::mutex> lock(feedback->mutex);
+  double period = mpc.Config().feedback_period;
+  if (period <= 0.0) {
+    feedback->has_plan = false;
+    feedback->solves++;
+    return Drive(mpc, t, field);
+  }
+
+  double elapsed = now - feedback->time;
+  if (feedback->has_plan && t.obstacles.empty() && elapsed < period) {
+    // the car in the frame of the solve, heading wrapped to (-pi, pi]
+    double x, y;
+    ToCar(feedback->x, feedback->y, feedback->psi, t.x, t.y, &x, &y);
+    double psi = atan2(sin(t.psi - feedback->psi), cos(t.psi - feedback->psi));
+    double delta, a;
+    if (mpc.Correct(feedback->plan, x, y, psi, t.speed, elapsed, &delta,
+                    &a)) {
+      feedback->corrections++;
+      Steer steer;
+      steer.steering_angle = -delta;  // psi values are reverse in the simulator
+      steer.throttle = a;
+      // the plan and the waypoints as seen from where the car is now
+      for (size_t i = 0; i < feedback->path_x.size(); i++) {
+        double car_x, car_y;
+        ToCar(t.x, t.y, t.psi, feedback->path_x[i], feedback->path_y[i],
+              &car_x, &car_y);
+        if (car_x > 0.0) {
+          steer.mpc_x.push_back(car_x);
+          steer.mpc_y.push_back(car_y);
+        }
+      }
+      Eigen::VectorXd ptsx_car, ptsy_car;
+      WaypointsToCar(t, &ptsx_car, &ptsy_car);
+      for (int i = 0; i < ptsx_car.size(); i++) {
+        steer.next_x.push_back(ptsx_car[i]);
+        steer.next_y.push_back(ptsy_car[i]);
+      }
+      return steer;
+    }
+  }
+
+  Steer steer = Drive(mpc, t, field, &feedback->plan);
+  feedback->has_plan = true;
+  feedback->x = t.x;
+  feedback->y = t.y;
+  feedback->psi = t.psi;
+  feedback->time = now;
+  feedback->path_x.clear();
+  feedback->path_y.clear();
+  for (size_t i = 0; i < steer.mpc_x.size(); i++) {
+    feedback->path_x.push_back(t.x + cos(t.psi) * steer.mpc_x[i] -
+                               sin(t.psi) * steer.mpc_y[i]);
+    feedback->path_y.push_back(t.y + sin(t.psi) * steer.mpc_x[i] +
+                               cos(t.psi) * steer.mpc_y[i]);
+  }
+  feedback->solves++;
+  return steer;
+}
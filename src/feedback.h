@@ -0,0 +1,52 @@
+#ifndef FEEDBACK_H
+#define FEEDBACK_H
+
+#include <mutex>
+#include <vector>
+#include "MPC.h"
+#include "obstacles.h"
+#include "wire.h"
+
+/*
+LQR feedback around the last plan, between full solves.
+
+A full solve on every telemetry message ties the rate a vehicle can be
+served at to the solve time. With `feedback_period` set in the config a
+vehicle is solved for at most that often, and the messages in between
+get
+
+  u = u_plan(k) + K(k) (z - z_plan(k))
+
+from the plan of its last solve and the time-varying LQR gains along it
+(see MPC::Correct). That is a few small matrix products, so every state
+update still moves the actuators. A full solve runs anyway once the plan
+is `feedback_period` old or used up, when there are obstacles (the gains
+don't know them) and after a config swap to another model.
+
+The state is locked for the whole call, so a vehicle shared by the batch
+workers is driven one message at a time.
+*/
+struct PlanFeedback {
+  MPCPlan plan;
+  bool has_plan = false;
+  // the pose in map coordinates the plan was solved from, and when
+  double x = 0.0;
+  double y = 0.0;
+  double psi = 0.0;
+  double time = 0.0;
+  // the predicted path in map coordinates, to keep drawing it
+  std::vector<double> path_x;
+  std::vector<double> path_y;
+  // full solves and corrections so far
+  long solves = 0;
+  long corrections = 0;
+  std::mutex mutex;
+};
+
+// Drive() for one vehicle at most every `feedback_period` seconds of
+// `now`, the correction of its plan in between.
+Steer DriveWithFeedback(MPC &mpc, const Telemetry &t, double now,
+                        PlanFeedback *feedback,
+                        ObstacleField *field = nullptr);
+
+#endif /* FEEDBACK_H */
@@ -0,0 +1,86 @@
+#include "guess.h"
+#include <stdint.h>
+#include <algorithm>
+#include <fstream>
+
+const uint32_t kGuessMagic = 0x4743504D;  // "MPCG" read little-endian
+const uint32_t kGuessVersion = 1;
+
+GuessInput GuessNet::Features(const Eigen::VectorXd &state,
+                              const Eigen::VectorXd &coeffs) {
+  GuessInput x;
+  x << state[3], state[4], state[5], coeffs[0], coeffs[1], coeffs[2],
+      coeffs[3];
+  return x;
+}
+
+void GuessNet::Predict(const GuessInput &x, GuessOutput *y) const {
+  GuessInput normalized = (x - in_mean).cwiseProduct(in_scale);
+  GuessHidden h1 = (W1 * normalized + b1).array().tanh().matrix();
+  GuessHidden h2 = (W2 * h1 + b2).array().tanh().matrix();
+  *y = out_mean + (W3 * h2 + b3).cwiseProduct(out_scale);
+}
+
+void GuessNet::Guess(const Eigen::VectorXd &state,
+                     const Eigen::VectorXd &coeffs, size_t n, double *delta,
+                     double *a) const {
+  GuessOutput y;
+  Predict(Features(state, coeffs), &y);
+  for (size_t t = 0; t < n; t++) {
+    size_t step = std::min<size_t>(t, kGuessSteps - 1);
+    delta[t] = y[2 * step];
+    a[t] = y[2 * step + 1];
+  }
+}
+
+// Every matrix of the net in file order.
+template <class Fn>
+static bool EachMatrix(GuessNet &net, Fn fn) {
+  return fn(net.in_mean.data(), net.in_mean.size()) &&
+         fn(net.in_scale.data(), net.in_scale.size()) &&
+         fn(net.W1.data(), net.W1.size()) && fn(net.b1.data(), net.b1.size()) &&
+         fn(net.W2.data(), net.W2.size()) && fn(net.b2.data(), net.b2.size()) &&
+         fn(net.W3.data(), net.W3.size()) && fn(net.b3.data(), net.b3.size()) &&
+         fn(net.out_mean.data(), net.out_mean.size()) &&
+         fn(net.out_scale.data(), net.out_scale.size());
+}
+
+bool LoadGuessNet(const std::string &path, GuessNet *net) {
+  std::ifstream in(path, std::ios::binary);
+  uint32_t header[5];
+  if (!in.read(reinterpret_cast<char *>(header), sizeof(header))) {
+    return false;
+  }
+  if (header[0] != kGuessMagic || header[1] != kGuessVersion ||
+      header[2] != kGuessInputs || header[3] != kGuessHidden ||
+      header[4] != kGuessSteps) {
+    return false;
+  }
+  GuessNet loaded;
+  if (!in.read(reinterpret_cast<char *>(&loaded.dt), sizeof(float))) {
+    return false;
+  }
+  bool ok = EachMatrix(loaded, [&](float *data, size_t n) {
+    return static_cast<bool>(
+        in.read(reinterpret_cast<char *>(data), n * sizeof(float)));
+  });
+  if (!ok || in.peek() != std::ifstream::traits_type::eof()) {
+    return false;
+  }
+  *net = loaded;
+  return true;
+}
+
+bool SaveGuessNet(const std::string &path, const GuessNet &net) {
+  std::ofstream out(path, std::ios::binary);
+  uint32_t header[5] = {kGuessMagic, kGuessVersion, kGuessInputs,
+                        kGuessHidden, kGuessSteps};
+  out.write(reinterpret_cast<const char *>(header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(&net.dt), sizeof(float));
+  GuessNet copy = net;
+  EachMatrix(copy, [&](float *data, size_t n) {
+    out.write(reinterpret_cast<const char *>(data), n * sizeof(float));
+    return true;
+  });
+  return static_cast<bool>(out);
+}
@@ -0,0 +1,76 @@
+#ifndef GUESS_H
+#define GUESS_H
+
+#include <stddef.h>
+#include <string>
+#include "Eigen-3.3/Eigen/Core"
+
+/*
+Learned initial guess for the solver.
+
+Every solve otherwise starts from zero actuations: a controller serves
+many vehicles, so there is no previous plan of the same car to shift.
+A small MLP maps what a solve starts from,
+
+  (v, cte, epsi, coeffs[0..3])    as MPC::Solve() takes them
+
+to the first kGuessSteps actuations (delta, a) of the optimal plan; a
+longer horizon holds the last one. The layers are fixed-size float
+matrices, so a prediction is a few small matrix products without any
+allocation.
+
+`guess_train` records (state, coeffs) -> actuations pairs with
+MPC::Solve() from replay logs, trains the network on the CPU and writes
+the weights as a binary blob:
+
+  uint32 magic "MPCG", uint32 version, uint32 inputs, hidden, steps
+  float dt the labels were solved with
+  float input mean, input scale, W1, b1, W2, b2, W3, b3, output mean,
+        output scale, column-major
+
+With `initial_guess` set to the blob in the config, every solve starts
+from the predicted actuations.
+*/
+
+const int kGuessInputs = 7;
+const int kGuessHidden = 32;
+const int kGuessSteps = 16;
+const int kGuessOutputs = 2 * kGuessSteps;
+
+typedef Eigen::Matrix<float, kGuessInputs, 1> GuessInput;
+typedef Eigen::Matrix<float, kGuessHidden, 1> GuessHidden;
+typedef Eigen::Matrix<float, kGuessOutputs, 1> GuessOutput;
+
+struct GuessNet {
+  float dt = 0.0f;
+  // inputs are normalized as (x - in_mean) * in_scale, outputs come out
+  // as out_mean + y * out_scale
+  GuessInput in_mean, in_scale;
+  Eigen::Matrix<float, kGuessHidden, kGuessInputs> W1;
+  GuessHidden b1;
+  Eigen::Matrix<float, kGuessHidden, kGuessHidden> W2;
+  GuessHidden b2;
+  Eigen::Matrix<float, kGuessOutputs, kGuessHidden> W3;
+  GuessOutput b3;
+  GuessOutput out_mean, out_scale;
+
+  // The network's input for a solve from `state` (x, y, psi, v, cte,
+  // epsi) and `coeffs`.
+  static GuessInput Features(const Eigen::VectorXd &state,
+                             const Eigen::VectorXd &coeffs);
+
+  // Interleaved (delta, a) for each step, kGuessSteps of them.
+  void Predict(const GuessInput &x, GuessOutput *y) const;
+
+  // The first `n` actuations, the last predicted one held beyond
+  // kGuessSteps.
+  void Guess(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs,
+             size_t n, double *delta, double *a) const;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+bool LoadGuessNet(const std::string &path, GuessNet *net);
+bool SaveGuessNet(const std::string &path, const GuessNet &net);
+
+#endif /* GUESS_H */
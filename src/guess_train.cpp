@@ -0,0 +1,341 @@
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "MPC.h"
+#include "config.h"
+#include "controller.h"
+#include "guess.h"
+#include "scenario.h"
+#include "stats.h"
+#include "track.h"
+
+/*
+Trains the network of the learned initial guess (guess.h).
+
+Every telemetry message of the corpus (the recorded logs plus
+--synthetic random cars around the track) is solved with the config from
+zero actuations, as Drive() does. Its state, coefficients and first
+kGuessSteps actuations make a sample; a shorter horizon repeats its last
+actuation. Every fifth sample is held out. The network trains with Adam
+on mini-batches of the rest, on the CPU, for --epochs passes over them,
+and the blob is written to --out.
+
+The held-out messages are then solved again, once from zero and once
+from the guess. The report gives the error of the guess, the time of a
+prediction, the solve times of both starts and on how many messages their
+first actuations differ by more than --delta-tol/--a-tol.
+
+  guess_train [--synthetic n] [--epochs n] [--lr rate] [--batch n]
+              [--seed n] [--delta-tol rad] [--a-tol a] [--config c.json]
+              [--track path] [--out guess.bin] [log ...]
+*/
+
+struct Sample {
+  Eigen::VectorXd state;
+  Eigen::VectorXd coeffs;
+  GuessInput x;
+  GuessOutput y;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+typedef vector<Sample, Eigen::aligned_allocator<Sample>> Samples;
+
+// Gradients of the loss over the net's weights, and Adam's moments.
+struct Weights {
+  Eigen::Matrix<float, kGuessHidden, kGuessInputs> W1;
+  GuessHidden b1;
+  Eigen::Matrix<float, kGuessHidden, kGuessHidden> W2;
+  GuessHidden b2;
+  Eigen::Matrix<float, kGuessOutputs, kGuessHidden> W3;
+  GuessOutput b3;
+
+  void SetZero() {
+    W1.setZero();
+    b1.setZero();
+    W2.setZero();
+    b2.setZero();
+    W3.setZero();
+    b3.setZero();
+  }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+// Adds the gradient of the squared error of one normalized sample, and
+// returns that error.
+float Backward(const GuessNet &net, const GuessInput &x,
+               const GuessOutput &target, Weights *grad) {
+  GuessInput x_n = (x - net.in_mean).cwiseProduct(net.in_scale);
+  GuessHidden h1 = (net.W1 * x_n + net.b1).array().tanh().matrix();
+  GuessHidden h2 = (net.W2 * h1 + net.b2).array().tanh().matrix();
+  GuessOutput y = net.W3 * h2 + net.b3;
+  GuessOutput t = (target - net.out_mean).cwiseQuotient(net.out_scale);
+
+  GuessOutput dy = 2.0f * (y - t) / kGuessOutputs;
+  grad->W3 += dy * h2.transpose();
+  grad->b3 += dy;
+  GuessHidden dz2 = (net.W3.transpose() * dy)
+                        .cwiseProduct(GuessHidden::Ones() - h2.cwiseAbs2());
+  grad->W2 += dz2 * h1.transpose();
+  grad->b2 += dz2;
+  GuessHidden dz1 = (net.W2.transpose() * dz2)
+                        .cwiseProduct(GuessHidden::Ones() - h1.cwiseAbs2());
+  grad->W1 += dz1 * x_n.transpose();
+  grad->b1 += dz1;
+  return (y - t).squaredNorm() / kGuessOutputs;
+}
+
+// One Adam step of `w` along the gradient `sum` of a batch of `n`.
+template <class M>
+void AdamStep(M &w, const M &sum, size_t n, M &m, M &v, float lr, int step) {
+  const float beta1 = 0.9f, beta2 = 0.999f;
+  M g = sum / float(n);
+  m = beta1 * m + (1 - beta1) * g;
+  v = beta2 * v + (1 - beta2) * g.cwiseAbs2();
+  float c1 = 1 - pow(beta1, step);
+  float c2 = 1 - pow(beta2, step);
+  w.array() -= lr * (m.array() / c1) / ((v.array() / c2).sqrt() + 1e-8f);
+}
+
+// Glorot uniform
+template <class M>
+void Init(M &w, std::mt19937 &rng) {
+  float limit = sqrt(6.0f / (w.rows() + w.cols()));
+  std::uniform_real_distribution<float> uniform(-limit, limit);
+  for (int i = 0; i < w.size(); i++) {
+    w.data()[i] = uniform(rng);
+  }
+}
+
+struct Start {
+  vector<double> solve_ms;
+  vector<double> delta;
+  vector<double> a;
+};
+
+Start SolveAll(const MPCConfig &config, const Samples &samples) {
+  MPC mpc(config);
+  Start start;
+  for (const auto &sample : samples) {
+    auto begin = chrono::steady_clock::now();
+    vector<double> solution = mpc.Solve(sample.state, sample.coeffs);
+    start.solve_ms.push_back(MsSince(begin));
+    start.delta.push_back(solution[0]);
+    start.a.push_back(solution[1]);
+  }
+  return start;
+}
+
+int main(int argc, char *argv[]) {
+  int synthetic = 2000;
+  int epochs = 300;
+  float lr = 1e-3f;
+  int batch = 32;
+  unsigned seed = 1;
+  double delta_tol = 0.01;
+  double a_tol = 0.05;
+  MPCConfig config;
+  string track_path = "../lake_track_waypoints.csv";
+  string out_path = "guess.bin";
+  vector<string> logs;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--synthetic" && has_value) {
+      synthetic = atoi(argv[++i]);
+    } else if (arg == "--epochs" && has_value) {
+      epochs = atoi(argv[++i]);
+    } else if (arg == "--lr" && has_value) {
+      lr = atof(argv[++i]);
+    } else if (arg == "--batch" && has_value) {
+      batch = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--seed" && has_value) {
+      seed = atoi(argv[++i]);
+    } else if (arg == "--delta-tol" && has_value) {
+      delta_tol = atof(argv[++i]);
+    } else if (arg == "--a-tol" && has_value) {
+      a_tol = atof(argv[++i]);
+    } else if (arg == "--config" && has_value) {
+      if (!LoadConfig(argv[++i], &config)) {
+        cerr << "Failed to load config " << argv[i] << endl;
+        return -1;
+      }
+    } else if (arg == "--track" && has_value) {
+      track_path = argv[++i];
+    } else if (arg == "--out" && has_value) {
+      out_path = argv[++i];
+    } else {
+      logs.push_back(arg);
+    }
+  }
+
+  Track track;
+  if (!LoadTrack(track_path, &track)) {
+    cerr << "Failed to load track " << track_path << endl;
+    return -1;
+  }
+  // the labels are solved from zero
+  config.initial_guess = "";
+
+  // record
+  Samples train, holdout;
+  {
+    MPC mpc(config);
+    vector<Telemetry> corpus = TelemetryCorpus(track, logs, synthetic, seed);
+    for (size_t k = 0; k < corpus.size(); k++) {
+      Sample sample;
+      sample.coeffs = ReferenceCoeffs(corpus[k]);
+      sample.state = CarState(corpus[k], sample.coeffs);
+      MPCPlan plan;
+      mpc.Solve(sample.state, sample.coeffs, vector<Obstacle>(), &plan);
+      const vector<double> &actuations = plan.actuations;
+      sample.x = GuessNet::Features(sample.state, sample.coeffs);
+      size_t steps = actuations.size() / 2;
+      for (int t = 0; t < kGuessSteps; t++) {
+        size_t step = std::min<size_t>(t, steps - 1);
+        sample.y[2 * t] = actuations[2 * step];
+        sample.y[2 * t + 1] = actuations[2 * step + 1];
+      }
+      (k % 5 == 4 ? holdout : train).push_back(sample);
+    }
+  }
+  printf("%zu samples, %zu held out\n", train.size() + holdout.size(),
+         holdout.size());
+  if (train.empty() || holdout.empty()) {
+    cerr << "Not enough samples" << endl;
+    return -1;
+  }
+
+  // normalization from the training set
+  GuessNet *net = new GuessNet;
+  net->dt = config.dt;
+  GuessInput x_sq = GuessInput::Zero();
+  GuessOutput y_sq = GuessOutput::Zero();
+  net->in_mean.setZero();
+  net->out_mean.setZero();
+  for (const auto &sample : train) {
+    net->in_mean += sample.x;
+    x_sq += sample.x.cwiseAbs2();
+    net->out_mean += sample.y;
+    y_sq += sample.y.cwiseAbs2();
+  }
+  net->in_mean /= train.size();
+  net->out_mean /= train.size();
+  for (int i = 0; i < kGuessInputs; i++) {
+    float var = x_sq[i] / train.size() - net->in_mean[i] * net->in_mean[i];
+    net->in_scale[i] = var > 1e-12f ? 1.0f / sqrt(var) : 1.0f;
+  }
+  for (int i = 0; i < kGuessOutputs; i++) {
+    float var = y_sq[i] / train.size() - net->out_mean[i] * net->out_mean[i];
+    net->out_scale[i] = var > 1e-12f ? sqrt(var) : 1.0f;
+  }
+
+  std::mt19937 rng(seed);
+  Init(net->W1, rng);
+  Init(net->W2, rng);
+  Init(net->W3, rng);
+  net->b1.setZero();
+  net->b2.setZero();
+  net->b3.setZero();
+
+  // train
+  Weights *grad = new Weights, *m = new Weights, *v = new Weights;
+  m->SetZero();
+  v->SetZero();
+  vector<size_t> order(train.size());
+  for (size_t k = 0; k < order.size(); k++) {
+    order[k] = k;
+  }
+  int step = 0;
+  auto begin = chrono::steady_clock::now();
+  printf("%6s %12s %12s\n", "epoch", "train_mse", "holdout_mse");
+  for (int epoch = 1; epoch <= epochs; epoch++) {
+    std::shuffle(order.begin(), order.end(), rng);
+    double loss = 0.0;
+    for (size_t first = 0; first < order.size(); first += batch) {
+      size_t last = std::min(order.size(), first + batch);
+      grad->SetZero();
+      for (size_t k = first; k < last; k++) {
+        loss += Backward(*net, train[order[k]].x, train[order[k]].y, grad);
+      }
+      size_t n = last - first;
+      step++;
+      AdamStep(net->W1, grad->W1, n, m->W1, v->W1, lr, step);
+      AdamStep(net->b1, grad->b1, n, m->b1, v->b1, lr, step);
+      AdamStep(net->W2, grad->W2, n, m->W2, v->W2, lr, step);
+      AdamStep(net->b2, grad->b2, n, m->b2, v->b2, lr, step);
+      AdamStep(net->W3, grad->W3, n, m->W3, v->W3, lr, step);
+      AdamStep(net->b3, grad->b3, n, m->b3, v->b3, lr, step);
+    }
+    if (epoch % std::max(1, epochs / 10) == 0 || epoch == epochs) {
+      Weights unused;
+      unused.SetZero();
+      double held = 0.0;
+      for (const auto &sample : holdout) {
+        held += Backward(*net, sample.x, sample.y, &unused);
+      }
+      printf("%6d %12.5f %12.5f\n", epoch, loss / train.size(),
+             held / holdout.size());
+    }
+  }
+  printf("trained in %.1f s\n", MsSince(begin) / 1000.0);
+  if (!SaveGuessNet(out_path, *net)) {
+    cerr << "Failed to write " << out_path << endl;
+    return -1;
+  }
+  printf("wrote %s\n", out_path.c_str());
+
+  // the guess itself on the held-out messages, in the units of the solver
+  vector<double> delta_err, a_err;
+  GuessOutput y;
+  begin = chrono::steady_clock::now();
+  const int repeats = 100;
+  for (int r = 0; r < repeats; r++) {
+    for (const auto &sample : holdout) {
+      net->Predict(sample.x, &y);
+    }
+  }
+  double predict_us = MsSince(begin) * 1000.0 / (repeats * holdout.size());
+  for (const auto &sample : holdout) {
+    net->Predict(sample.x, &y);
+    delta_err.push_back(fabs(y[0] - sample.y[0]));
+    a_err.push_back(fabs(y[1] - sample.y[1]));
+  }
+  printf("prediction %.2f us; first actuation error p50/p99: delta %.4f / "
+         "%.4f rad, a %.4f / %.4f\n", predict_us, Percentile(delta_err, 50),
+         Percentile(delta_err, 99), Percentile(a_err, 50),
+         Percentile(a_err, 99));
+
+  // solves from zero and from the guess
+  MPCConfig guessed = config;
+  guessed.initial_guess = out_path;
+  Start cold = SolveAll(config, holdout);
+  Start warm = SolveAll(guessed, holdout);
+  int differ = 0;
+  for (size_t k = 0; k < holdout.size(); k++) {
+    if (fabs(cold.delta[k] - warm.delta[k]) > delta_tol ||
+        fabs(cold.a[k] - warm.a[k]) > a_tol) {
+      differ++;
+    }
+  }
+  printf("%-6s %10s %10s %10s\n", "start", "mean_ms", "p50_ms", "p99_ms");
+  printf("%-6s %10.3f %10.3f %10.3f\n", "zero", Mean(cold.solve_ms),
+         Percentile(cold.solve_ms, 50), Percentile(cold.solve_ms, 99));
+  printf("%-6s %10.3f %10.3f %10.3f\n", "guess", Mean(warm.solve_ms),
+         Percentile(warm.solve_ms, 50), Percentile(warm.solve_ms, 99));
+  printf("first actuations differ on %d of %zu held-out messages\n", differ,
+         holdout.size());
+  delete net;
+  delete grad;
+  delete m;
+  delete v;
+  return 0;
+}
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "MPC.h"
+#include "config.h"
+#include "farm.h"
+#include "json.hpp"
+#include "scenario.h"
+#include "terminal_cost.h"
+#include "track.h"
+
+// for convenience
+using json = nlohmann::json;
+
+/*
+How short the horizon can get, with and without the LQR terminal cost.
+
+Every N from the config's down to --min-n drives the same closed-loop
+laps of the headless simulator (SyntheticScenarios) twice: without a
+terminal cost and with the --table written by lqr_terminal. Laps run in
+parallel on all cores (farm.h).
+
+The config as given, without a terminal cost, is today's controller: its
+worst max cte and its mean cte over the laps are the bounds. An N keeps
+them if every lap completes and its worst max cte and mean cte are
+within --cte-margin (a fraction) of the bounds. The report gives, with
+and without the table, the shortest N down to which every horizon keeps
+them.
+
+  horizon_bench [-j workers] [--table terminal_lqr.json] [--min-n n]
+                [--laps n] [--cte-margin fraction] [--config c.json]
+                [--track path]
+*/
+
+// Runs in a farm worker, shard "<N> <terminal 0/1> <scenario>".
+json RunOne(const string &shard, const MPCConfig &base,
+            const string &table_path, const Track &track) {
+  istringstream in(shard);
+  size_t N;
+  int terminal;
+  string spec;
+  in >> N >> terminal >> spec;
+  MPCConfig config = base;
+  config.N = N;
+  config.terminal_table = terminal ? table_path : "";
+  MPC mpc(config);
+  json r = RunScenario(mpc, spec, track);
+  r["N"] = N;
+  r["terminal"] = terminal;
+  return r;
+}
+
+struct Row {
+  int laps = 0;
+  int completed = 0;
+  double max_cte = 0.0;
+  double mean_cte = 0.0;
+  double lap_time = 0.0;
+  double solve_p50 = 0.0;
+};
+
+int main(int argc, char *argv[]) {
+  FarmOptions opts;
+  opts.workers = sysconf(_SC_NPROCESSORS_ONLN);
+  opts.timeout = 900.0;
+  opts.verbose = false;
+  string table_path = "terminal_lqr.json";
+  size_t min_n = 3;
+  int laps = 6;
+  double margin = 0.05;
+  MPCConfig base;
+  string track_path = "../lake_track_waypoints.csv";
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "-j" && has_value) {
+      opts.workers = atoi(argv[++i]);
+    } else if (arg == "--table" && has_value) {
+      table_path = argv[++i];
+    } else if (arg == "--min-n" && has_value) {
+      min_n = atoi(argv[++i]);
+    } else if (arg == "--laps" && has_value) {
+      laps = atoi(argv[++i]);
+    } else if (arg == "--cte-margin" && has_value) {
+      margin = atof(argv[++i]);
+    } else if (arg == "--config" && has_value) {
+      if (!LoadConfig(argv[++i], &base)) {
+        cerr << "Failed to load config " << argv[i] << endl;
+        return -1;
+      }
+    } else if (arg == "--track" && has_value) {
+      track_path = argv[++i];
+    }
+  }
+  // the config's validation: two actuations for the rate terms
+  min_n = std::max<size_t>(min_n, 3);
+
+  Track track;
+  if (!LoadTrack(track_path, &track)) {
+    cerr << "Failed to load track " << track_path << endl;
+    return -1;
+  }
+  TerminalTable table;
+  if (!LoadTerminalTable(table_path, &table)) {
+    cerr << "Failed to load terminal table " << table_path << endl;
+    return -1;
+  }
+  if (table.model != base.model) {
+    cerr << table_path << " was solved for the " << table.model
+         << " model" << endl;
+    return -1;
+  }
+  if (!table.Matches(base)) {
+    cerr << "Warning: " << table_path
+         << " was solved for another dt, integrator or other weights"
+         << endl;
+  }
+  base.terminal_table = "";
+
+  vector<string> scenarios = SyntheticScenarios(track, laps);
+  vector<string> shards;
+  for (size_t N = base.N; N >= min_n; N--) {
+    for (int terminal = 0; terminal < 2; terminal++) {
+      for (const auto &spec : scenarios) {
+        shards.push_back(to_string(N) + " " + to_string(terminal) + " " +
+                         spec);
+      }
+    }
+  }
+  printf("%zu laps on %d workers\n", shards.size(), opts.workers);
+  vector<json> results = RunFarm(shards, opts, [&](const string &shard) {
+    return RunOne(shard, base, table_path, track);
+  });
+
+  // (N, terminal) -> the laps' summary
+  map<pair<size_t, int>, Row> rows;
+  for (size_t k = 0; k < results.size(); k++) {
+    const json &r = results[k];
+    istringstream in(shards[k]);
+    size_t N;
+    int terminal;
+    in >> N >> terminal;
+    Row &row = rows[make_pair(N, terminal)];
+    row.laps++;
+    if (r.find("completed") == r.end() || !r["completed"].get<bool>()) {
+      continue;
+    }
+    row.completed++;
+    row.max_cte = std::max(row.max_cte, r["max_cte"].get<double>());
+    row.mean_cte += r["mean_cte"].get<double>();
+    row.lap_time += r["lap_time"].get<double>();
+    row.solve_p50 += r["solve_p50_ms"].get<double>();
+  }
+  for (auto &kv : rows) {
+    if (kv.second.completed > 0) {
+      kv.second.mean_cte /= kv.second.completed;
+      kv.second.lap_time /= kv.second.completed;
+      kv.second.solve_p50 /= kv.second.completed;
+    }
+  }
+
+  const Row &today = rows[make_pair(base.N, 0)];
+  if (today.completed < today.laps) {
+    printf("the config itself doesn't complete every lap, no bounds\n");
+    return 1;
+  }
+  double max_bound = today.max_cte * (1.0 + margin);
+  double mean_bound = today.mean_cte * (1.0 + margin);
+  printf("bounds: max cte %.3f, mean cte %.3f (N = %zu, no terminal cost, "
+         "+%.0f%%)\n", max_bound, mean_bound, base.N, margin * 100.0);
+  printf("%4s %9s %6s %9s %9s %9s %10s %6s\n", "N", "terminal", "laps",
+         "max_cte", "mean_cte", "lap_s", "solve_p50", "keeps");
+  size_t shortest[2] = {base.N, base.N};
+  bool keeping[2] = {true, true};
+  for (size_t N = base.N; N >= min_n; N--) {
+    for (int terminal = 0; terminal < 2; terminal++) {
+      const Row &row = rows[make_pair(N, terminal)];
+      bool keeps = row.completed == row.laps && row.max_cte <= max_bound &&
+                   row.mean_cte <= mean_bound;
+      keeping[terminal] = keeping[terminal] && keeps;
+      if (keeping[terminal]) {
+        shortest[terminal] = N;
+      }
+      printf("%4zu %9s %3d/%-2d %9.3f %9.3f %9.2f %10.3f %6s\n", N,
+             terminal ? "lqr" : "none", row.completed, row.laps, row.max_cte,
+             row.mean_cte, row.lap_time, row.solve_p50, keeps ? "yes" : "no");
+    }
+  }
+  printf("shortest N within the bounds: %zu without, %zu with the terminal "
+         "cost\n", shortest[0], shortest[1]);
+  return 0;
+}
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "MPC.h"
+#include "config.h"
+#include "controller.h"
+#include "scenario.h"
+#include "stats.h"
+#include "track.h"
+#include "vehicle_model.h"
+
+/*
+Prediction error of each integrator (MPCConfig::integrator) against dt.
+
+Every car of a telemetry corpus drives the horizon of the config, N * dt
+seconds, with a random constant steering and throttle. The end of the
+horizon is predicted with each scheme at a range of step counts n (so
+dt = horizon / n) and compared with the same model integrated with RK4
+in steps of about a millisecond. The table has the mean and max error of
+the end position (meters) and heading (radians), of the cte the solver
+carries to the end of the horizon (see ErrorStep in vehicle_model.h)
+against the reference's actual distance from the car's polynomial, and
+the time of one step on doubles.
+
+The summary is, for every scheme, the largest dt (smallest n) from
+which on it predicts the end position and heading at least as well as
+Euler does with the config's dt: the N the scheme needs for the same
+accuracy. The cte is left out of it. Euler carries cte by a step of its
+rate, the others take it from the integrated state, so its error
+compares the two definitions rather than the integration order;
+euler_integrated is Euler with the errors of the others.
+
+  integrator_bench [--config c.json] [--horizon s] [--synthetic n]
+                   [--track path]
+*/
+
+// One car's start of the horizon in its own frame, its reference
+// polynomial and its inputs.
+struct Case {
+  double v;
+  Eigen::VectorXd coeffs;
+  double delta;
+  double a;
+};
+
+struct SchemeError {
+  double mean_pos = 0.0;
+  double max_pos = 0.0;
+  double mean_psi = 0.0;
+  double max_psi = 0.0;
+  double mean_cte = 0.0;
+  double max_cte = 0.0;
+};
+
+// `n` steps of Model over `horizon` from the start of `c`: the end state
+// and the cte carried along with it.
+template <class Model>
+void Predict(const Case &c, double horizon, int n, double *end,
+             double *cte) {
+  double s[Model::n_state] = {};
+  s[Model::V] = c.v;
+  double u[Model::n_input];
+  u[Model::DELTA] = c.delta;
+  u[Model::A] = c.a;
+  double epsi;
+  ReferenceErrors<Model>(c.coeffs, s, cte, &epsi);
+  double next[Model::n_state];
+  for (int i = 0; i < n; i++) {
+    Model::step(s, u, horizon / n, next);
+    ErrorStep<Model>(c.coeffs, s, epsi, next, horizon / n, cte, &epsi);
+    for (size_t k = 0; k < Model::n_state; k++) {
+      s[k] = next[k];
+    }
+  }
+  for (size_t k = 0; k < Model::n_state; k++) {
+    end[k] = s[k];
+  }
+}
+
+template <class Model>
+SchemeError Errors(const vector<Case> &cases,
+                   const vector<vector<double>> &reference, double horizon,
+                   int n) {
+  SchemeError e;
+  double end[Model::n_state];
+  for (size_t i = 0; i < cases.size(); i++) {
+    double cte, true_cte, true_epsi;
+    Predict<Model>(cases[i], horizon, n, end, &cte);
+    ReferenceErrors<Model>(cases[i].coeffs, &reference[i][0], &true_cte,
+                           &true_epsi);
+    double pos = hypot(end[Model::X] - reference[i][Model::X],
+                       end[Model::Y] - reference[i][Model::Y]);
+    double psi = fabs(end[Model::PSI] - reference[i][Model::PSI]);
+    double cte_error = fabs(cte - true_cte);
+    e.mean_pos += pos / cases.size();
+    e.max_pos = max(e.max_pos, pos);
+    e.mean_psi += psi / cases.size();
+    e.max_psi = max(e.max_psi, psi);
+    e.mean_cte += cte_error / cases.size();
+    e.max_cte = max(e.max_cte, cte_error);
+  }
+  return e;
+}
+
+// Nanoseconds per Model::step, driving a constant turn.
+template <class Model>
+double StepNs(int steps) {
+  double s[Model::n_state] = {};
+  s[Model::V] = 30.0;
+  double u[Model::n_input] = {};
+  u[Model::DELTA] = 0.05;
+  u[Model::A] = 0.1;
+  double next[Model::n_state];
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < steps; i++) {
+    Model::step(s, u, 0.1, next);
+    for (size_t k = 0; k < Model::n_state; k++) {
+      s[k] = next[k];
+    }
+  }
+  double ns = MsSince(start) * 1e6 / steps;
+  // keep the loop from being optimized away
+  if (s[Model::X] == 12345.0) {
+    printf("\n");
+  }
+  return ns;
+}
+
+// The row of one scheme at every n of the grid, ascending, and the
+// smallest n from which on every n is at most as far off as `target`.
+// Returns 0 if even the last isn't.
+template <class Model>
+int Scheme(const string &model, const string &scheme,
+           const vector<Case> &cases,
+           const vector<vector<double>> &reference, double horizon,
+           const vector<int> &grid, const SchemeError &target) {
+  double step_ns = StepNs<Model>(200000);
+  int smallest = 0;
+  for (int n : grid) {
+    SchemeError e = Errors<Model>(cases, reference, horizon, n);
+    printf("%-10s %-16s %4d %7.4f %10.2e %10.2e %10.2e %10.2e %10.2e "
+           "%10.2e %8.1f\n",
+           model.c_str(), scheme.c_str(), n, horizon / n, e.mean_pos,
+           e.max_pos, e.mean_psi, e.max_psi, e.mean_cte, e.max_cte,
+           step_ns);
+    bool accurate = e.mean_pos <= target.mean_pos &&
+                    e.max_pos <= target.max_pos &&
+                    e.mean_psi <= target.mean_psi &&
+                    e.max_psi <= target.max_psi;
+    if (!accurate) {
+      smallest = 0;
+    } else if (smallest == 0) {
+      smallest = n;
+    }
+  }
+  return smallest;
+}
+
+template <class Model>
+void Bench(const string &model, const vector<Case> &cases, double horizon,
+           int config_n) {
+  // the reference: RK4 in steps of at most a millisecond
+  int fine = static_cast<int>(ceil(horizon / 0.001));
+  vector<vector<double>> reference(cases.size(),
+                                   vector<double>(Model::n_state));
+  for (size_t i = 0; i < cases.size(); i++) {
+    double cte;
+    Predict<RungeKutta4<Model>>(cases[i], horizon, fine, &reference[i][0],
+                                &cte);
+  }
+
+  vector<int> grid;
+  for (int n = 1; n <= 2 * config_n; n++) {
+    grid.push_back(n);
+  }
+  SchemeError target = Errors<Model>(cases, reference, horizon, config_n);
+
+  int euler = Scheme<Model>(model, "euler", cases, reference, horizon,
+                            grid, target);
+  int euler_integrated = Scheme<IntegratedEuler<Model>>(
+      model, "euler_integrated", cases, reference, horizon, grid, target);
+  int rk2 = Scheme<Midpoint<Model>>(model, "rk2", cases, reference,
+                                    horizon, grid, target);
+  int rk4 = Scheme<RungeKutta4<Model>>(model, "rk4", cases, reference,
+                                       horizon, grid, target);
+
+  printf("\n%s, as accurate as euler at dt %.4f (N %d):\n", model.c_str(),
+         horizon / config_n, config_n);
+  const char *names[] = {"euler", "euler_integrated", "rk2", "rk4"};
+  int smallest[] = {euler, euler_integrated, rk2, rk4};
+  for (int i = 0; i < 4; i++) {
+    if (smallest[i] == 0) {
+      printf("  %-16s none up to N %d\n", names[i], 2 * config_n);
+    } else {
+      printf("  %-16s dt %.4f  N %d\n", names[i], horizon / smallest[i],
+             smallest[i]);
+    }
+  }
+  printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+  MPCConfig config;
+  double horizon = 0.0;
+  int synthetic = 500;
+  string path = "../lake_track_waypoints.csv";
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--config" && has_value) {
+      if (!LoadConfig(argv[++i], &config)) {
+        cerr << "Failed to load config " << argv[i] << endl;
+        return -1;
+      }
+    } else if (arg == "--horizon" && has_value) {
+      horizon = atof(argv[++i]);
+    } else if (arg == "--synthetic" && has_value) {
+      synthetic = atoi(argv[++i]);
+    } else if (arg == "--track" && has_value) {
+      path = argv[++i];
+    }
+  }
+  if (horizon <= 0.0) {
+    horizon = config.N * config.dt;
+  }
+  // the config's dt, rounded to a step count over the horizon
+  int config_n = max(1, static_cast<int>(lround(horizon / config.dt)));
+
+  Track track;
+  if (!LoadTrack(path, &track)) {
+    cerr << "Failed to load track " << path << endl;
+    return -1;
+  }
+  // the corpus' speeds and reference polynomials, with the actuations
+  // anywhere within their bounds
+  vector<Telemetry> corpus = TelemetryCorpus(track, {}, synthetic);
+  mt19937 rng(7);
+  uniform_real_distribution<double> steer(-deg2rad(25), deg2rad(25));
+  uniform_real_distribution<double> throttle(-1.0, 1.0);
+  vector<Case> cases;
+  for (const auto &telemetry : corpus) {
+    double delta = steer(rng);
+    double a = throttle(rng);
+    cases.push_back({telemetry.speed, ReferenceCoeffs(telemetry), delta, a});
+  }
+
+  printf("horizon %.3f s, %zu cars\n\n", horizon, cases.size());
+  printf("%-10s %-16s %4s %7s %10s %10s %10s %10s %10s %10s %8s\n", "model",
+         "scheme", "n", "dt", "mean_pos", "max_pos", "mean_psi", "max_psi",
+         "mean_cte", "max_cte", "step_ns");
+  Bench<KinematicModel>("kinematic", cases, horizon, config_n);
+  Bench<DynamicModel>("dynamic", cases, horizon, config_n);
+  return 0;
+}
@@ -0,0 +1,178 @@
+#include "interference.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sstream>
+
+bool ParseAntagonist(const string &text, AntagonistSpec *spec) {
+  AntagonistSpec parsed;
+  stringstream in(text);
+  string kind, cores, mb;
+  getline(in, kind, ':');
+  getline(in, cores, ':');
+  getline(in, mb, ':');
+  if (kind == "cpu") {
+    parsed.kind = AntagonistSpec::CPU;
+  } else if (kind == "membw") {
+    parsed.kind = AntagonistSpec::MEMBW;
+  } else if (kind == "llc") {
+    parsed.kind = AntagonistSpec::LLC;
+  } else {
+    return false;
+  }
+  if (!cores.empty()) {
+    parsed.cores.clear();
+    stringstream list(cores);
+    string core;
+    while (getline(list, core, ',')) {
+      char *end = nullptr;
+      long c = strtol(core.c_str(), &end, 10);
+      if (core.empty() || *end != '\0' || c < 0) {
+        return false;
+      }
+      parsed.cores.push_back(c);
+    }
+  }
+  if (!mb.empty()) {
+    double size = atof(mb.c_str());
+    if (size <= 0.0) {
+      return false;
+    }
+    parsed.bytes = static_cast<size_t>(size * 1024 * 1024);
+  }
+  *spec = parsed;
+  return true;
+}
+
+size_t LastLevelCacheBytes() {
+#ifdef _SC_LEVEL3_CACHE_SIZE
+  long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  if (l3 > 0) {
+    return l3;
+  }
+#endif
+#ifdef _SC_LEVEL2_CACHE_SIZE
+  long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  if (l2 > 0) {
+    return l2;
+  }
+#endif
+  return 8 * 1024 * 1024;
+}
+
+bool PinThisThread(int core) {
+#ifdef __linux__
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  CPU_SET(core % (n_cpus > 0 ? n_cpus : 1), &cpus);
+  return sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+#else
+  return false;
+#endif
+}
+
+// The loops check `stop` every few milliseconds of work.
+static void SpinCpu(const std::atomic<bool> &stop,
+                    std::atomic<uint64_t> *work) {
+  uint64_t x = 88172645463325252ull;
+  // keeps the loop from being optimized away
+  volatile uint64_t sink;
+  while (!stop) {
+    for (int i = 0; i < 1000000; i++) {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+    }
+    sink = x;
+    work->fetch_add(1);
+  }
+  (void)sink;
+}
+
+static void StreamMemory(const std::atomic<bool> &stop, size_t bytes,
+                         std::atomic<uint64_t> *work) {
+  size_t n = bytes / sizeof(uint64_t) / 2;
+  vector<uint64_t> buffer(2 * n, 1);
+  uint64_t *src = buffer.data();
+  uint64_t *dst = buffer.data() + n;
+  const size_t chunk = 1 << 16;
+  while (!stop) {
+    for (size_t begin = 0; begin < n && !stop; begin += chunk) {
+      size_t end = std::min(begin + chunk, n);
+      for (size_t i = begin; i < end; i++) {
+        dst[i] = src[i] + 1;
+      }
+      work->fetch_add(2 * (end - begin) * sizeof(uint64_t));
+    }
+    std::swap(src, dst);
+  }
+}
+
+static void ThrashCache(const std::atomic<bool> &stop, size_t bytes,
+                        std::atomic<uint64_t> *work) {
+  const size_t line = 64 / sizeof(uint64_t);
+  // a power of two of cache lines, for masking
+  size_t lines = 1;
+  while (lines * 2 * 64 <= bytes) {
+    lines *= 2;
+  }
+  vector<uint64_t> buffer(lines * line, 1);
+  uint64_t x = 88172645463325252ull;
+  const int batch = 1 << 16;
+  while (!stop) {
+    for (int i = 0; i < batch; i++) {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      buffer[(x & (lines - 1)) * line]++;
+    }
+    work->fetch_add(batch * 64);
+  }
+}
+
+Interference::Interference(const vector<AntagonistSpec> &specs)
+    : specs(specs), stop(false) {
+  for (size_t s = 0; s < specs.size(); s++) {
+    const AntagonistSpec &spec = specs[s];
+    size_t bytes = spec.bytes;
+    if (bytes == 0) {
+      bytes = spec.kind == AntagonistSpec::MEMBW ? 256 * 1024 * 1024
+                                                 : LastLevelCacheBytes();
+    }
+    for (int core : spec.cores) {
+      unique_ptr<Thread> t(new Thread);
+      t->spec = s;
+      t->work = 0;
+      std::atomic<uint64_t> *work = &t->work;
+      AntagonistSpec::Kind kind = spec.kind;
+      t->thread = std::thread([this, kind, core, bytes, work] {
+        PinThisThread(core);
+        if (kind == AntagonistSpec::CPU) {
+          SpinCpu(stop, work);
+        } else if (kind == AntagonistSpec::MEMBW) {
+          StreamMemory(stop, bytes, work);
+        } else {
+          ThrashCache(stop, bytes, work);
+        }
+      });
+      threads.push_back(std::move(t));
+    }
+  }
+}
+
+Interference::~Interference() {
+  stop = true;
+  for (auto &t : threads) {
+    t->thread.join();
+  }
+}
+
+vector<double> Interference::Work() const {
+  vector<double> work(specs.size(), 0.0);
+  for (const auto &t : threads) {
+    work[t->spec] += t->work;
+  }
+  return work;
+}
@@ -0,0 +1,71 @@
+#ifndef INTERFERENCE_H
+#define INTERFERENCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/*
+Background load standing in for the other workloads on a host.
+
+Each antagonist runs one thread per core it is given, pinned there
+(Linux only; cores wrap around the ones online):
+
+  cpu    spins on integer arithmetic in registers, competing for the
+         core itself (or its SMT sibling)
+  membw  streams through a buffer much larger than the last level
+         cache, reading one half and writing the other, to use up the
+         memory bandwidth
+  llc    reads and writes random cache lines of a buffer about the size
+         of the last level cache, evicting what the controller keeps
+         there
+
+A spec is written kind[:cores[:mb]], cores comma separated, e.g.
+"cpu:0", "membw:2,3:512" or "llc:1". The buffer defaults to 256 MB per
+thread for membw and the last level cache's size for llc.
+*/
+struct AntagonistSpec {
+  enum Kind { CPU, MEMBW, LLC } kind = CPU;
+  vector<int> cores = {0};
+  // buffer per thread, 0 for the default
+  size_t bytes = 0;
+};
+
+bool ParseAntagonist(const string &text, AntagonistSpec *spec);
+
+// The last level cache's size, or 8 MB if the system doesn't say.
+size_t LastLevelCacheBytes();
+
+// Pins the calling thread to `core` (modulo the cores online). False if
+// that isn't supported here.
+bool PinThisThread(int core);
+
+// Runs the antagonists from construction until destruction.
+class Interference {
+ public:
+  explicit Interference(const vector<AntagonistSpec> &specs);
+  ~Interference();
+
+  // Work done since construction, summed over the threads of each spec:
+  // bytes touched for membw and llc, million iterations for cpu.
+  vector<double> Work() const;
+
+ private:
+  struct Thread {
+    size_t spec;
+    std::atomic<uint64_t> work;
+    std::thread thread;
+  };
+
+  vector<AntagonistSpec> specs;
+  std::atomic<bool> stop;
+  vector<unique_ptr<Thread>> threads;
+};
+
+#endif /* INTERFERENCE_H */
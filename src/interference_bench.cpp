@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "MPC.h"
+#include "config.h"
+#include "controller.h"
+#include "interference.h"
+#include "json.hpp"
+#include "obstacles.h"
+#include "scenario.h"
+#include "send_policy.h"
+#include "stats.h"
+#include "track.h"
+#include "wire.h"
+
+// for convenience
+using json = nlohmann::json;
+
+/*
+Tail latency of the controller next to other workloads.
+
+The controller runs on the core given with --pin. The benchmark runs once
+without load, then under each --antagonist alone (see interference.h),
+then under all of them together. Under each it times, for every message
+of a telemetry corpus:
+
+  solve     MPC::Solve() alone, from the message's state and polynomial
+  pipeline  what the server does per message: parse the socket.io JSON,
+            Drive() with the connection's obstacle state, encode both
+            kinds of reply
+
+and prints the latency distribution of both. p99_x is the p99 relative to
+the run without load. The antagonists' throughput shows they actually
+ran. Pass 0 of each run warms the caches up again and isn't counted.
+
+  interference_bench [--antagonist kind[:cores[:mb]]]... [--pin core]
+                     [--passes n] [--synthetic n] [--config c.json]
+                     [--track path] [log ...]
+
+Without --antagonist: cpu:<pin> (time slicing the controller's own
+core), membw and llc on the core after it.
+*/
+
+struct Latencies {
+  vector<double> solve_ms;
+  vector<double> pipeline_ms;
+};
+
+struct Message {
+  string text;
+  Eigen::VectorXd state;
+  Eigen::VectorXd coeffs;
+};
+
+Latencies Measure(const MPCConfig &config, const vector<Message> &messages,
+                  int passes) {
+  MPC mpc(config);
+  ObstacleField field;
+  SendPolicy policy;
+  Latencies latencies;
+  for (int pass = 0; pass <= passes; pass++) {
+    for (const auto &m : messages) {
+      auto start = chrono::steady_clock::now();
+      mpc.Solve(m.state, m.coeffs);
+      double solve_ms = MsSince(start);
+
+      start = chrono::steady_clock::now();
+      json j = json::parse(hasData(m.text));
+      Telemetry telemetry;
+      if (TelemetryFromJson(j[1], &telemetry)) {
+        Steer steer = Drive(mpc, telemetry, &field);
+        policy.Reply(steer, false, 0);
+        policy.Reply(steer, true, 0);
+      }
+      double pipeline_ms = MsSince(start);
+      if (pass > 0) {
+        latencies.solve_ms.push_back(solve_ms);
+        latencies.pipeline_ms.push_back(pipeline_ms);
+      }
+    }
+  }
+  return latencies;
+}
+
+void Print(const string &name, const char *stage, const vector<double> &ms,
+           double base_p99, const string &load) {
+  double p99 = Percentile(ms, 99);
+  printf("%-22s %-9s %8.3f %8.3f %8.3f %8.3f %8.3f %6.2f  %s\n",
+         name.c_str(), stage, Mean(ms), Percentile(ms, 50), p99,
+         Percentile(ms, 99.9), Percentile(ms, 100),
+         base_p99 > 0.0 ? p99 / base_p99 : 1.0, load.c_str());
+}
+
+int main(int argc, char *argv[]) {
+  vector<string> names;
+  vector<AntagonistSpec> specs;
+  int pin = 0;
+  int passes = 5;
+  int synthetic = 200;
+  MPCConfig config;
+  string track_path = "../lake_track_waypoints.csv";
+  vector<string> logs;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--antagonist" && has_value) {
+      AntagonistSpec spec;
+      if (!ParseAntagonist(argv[++i], &spec)) {
+        cerr << "Bad antagonist " << argv[i]
+             << ", want cpu|membw|llc[:cores[:mb]]" << endl;
+        return -1;
+      }
+      names.push_back(argv[i]);
+      specs.push_back(spec);
+    } else if (arg == "--pin" && has_value) {
+      pin = atoi(argv[++i]);
+    } else if (arg == "--passes" && has_value) {
+      passes = atoi(argv[++i]);
+    } else if (arg == "--synthetic" && has_value) {
+      synthetic = atoi(argv[++i]);
+    } else if (arg == "--config" && has_value) {
+      if (!LoadConfig(argv[++i], &config)) {
+        cerr << "Failed to load config " << argv[i] << endl;
+        return -1;
+      }
+    } else if (arg == "--track" && has_value) {
+      track_path = argv[++i];
+    } else {
+      logs.push_back(arg);
+    }
+  }
+  if (specs.empty()) {
+    string neighbor = to_string(pin + 1);
+    for (string name : {"cpu:" + to_string(pin), "membw:" + neighbor,
+                        "llc:" + neighbor}) {
+      AntagonistSpec spec;
+      ParseAntagonist(name, &spec);
+      names.push_back(name);
+      specs.push_back(spec);
+    }
+  }
+
+  Track track;
+  if (!LoadTrack(track_path, &track)) {
+    cerr << "Failed to load track " << track_path << endl;
+    return -1;
+  }
+  vector<Message> messages;
+  for (const auto &t : TelemetryCorpus(track, logs, synthetic)) {
+    Message m;
+    m.text = TelemetryMessage(t);
+    m.coeffs = ReferenceCoeffs(t);
+    m.state = CarState(t, m.coeffs);
+    messages.push_back(m);
+  }
+  if (!PinThisThread(pin)) {
+    cerr << "Can't pin to core " << pin << ", running unpinned" << endl;
+  }
+
+  // no load, each antagonist alone, all of them together
+  vector<string> runs = {"none"};
+  vector<vector<AntagonistSpec>> loads = {{}};
+  for (size_t s = 0; s < specs.size(); s++) {
+    runs.push_back(names[s]);
+    loads.push_back({specs[s]});
+  }
+  if (specs.size() > 1) {
+    runs.push_back("all");
+    loads.push_back(specs);
+  }
+
+  printf("%zu messages, %d passes, controller on core %d, LLC %zu kB\n",
+         messages.size(), passes, pin, LastLevelCacheBytes() / 1024);
+  printf("%-22s %-9s %8s %8s %8s %8s %8s %6s  %s\n", "load", "stage",
+         "mean_ms", "p50_ms", "p99_ms", "p999_ms", "max_ms", "p99_x",
+         "antagonists");
+  double base_solve = 0.0;
+  double base_pipeline = 0.0;
+  for (size_t r = 0; r < runs.size(); r++) {
+    Latencies latencies;
+    string load;
+    {
+      Interference interference(loads[r]);
+      auto start = chrono::steady_clock::now();
+      latencies = Measure(config, messages, passes);
+      double seconds = MsSince(start) / 1000.0;
+      vector<double> work = interference.Work();
+      for (size_t s = 0; s < work.size(); s++) {
+        char text[64];
+        if (loads[r][s].kind == AntagonistSpec::CPU) {
+          snprintf(text, sizeof(text), "%.0f Mops/s ", work[s] / seconds);
+        } else {
+          snprintf(text, sizeof(text), "%.1f GB/s ", work[s] / seconds / 1e9);
+        }
+        load += text;
+      }
+    }
+    if (r == 0) {
+      base_solve = Percentile(latencies.solve_ms, 99);
+      base_pipeline = Percentile(latencies.pipeline_ms, 99);
+    }
+    Print(runs[r], "solve", latencies.solve_ms, base_solve, load);
+    Print(runs[r], "pipeline", latencies.pipeline_ms, base_pipeline, load);
+  }
+  return 0;
+}
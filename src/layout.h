@@ -0,0 +1,34 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stddef.h>
+
+// The IPOPT solver takes all the state variables and actuator
+// variables in a singular vector. Thus, variables were established 
+// in a way that one variable was starts and another ends.
+// The model's states come first, x, y, psi, v and any extra ones, then
+// the errors cte and epsi, then the actuators.
+// Without the errors (the reduced formulation, see MPCConfig::formulation)
+// their blocks are empty: cte_start == epsi_start == delta_start.
+struct VarLayout {
+  size_t x_start;
+  size_t y_start;
+  size_t psi_start;
+  size_t v_start;
+  size_t cte_start;
+  size_t epsi_start;
+  size_t delta_start;
+  size_t a_start;
+
+  VarLayout(size_t N, size_t n_state, bool errors = true)
+      : x_start(0),
+        y_start(x_start + N),
+        psi_start(y_start + N),
+        v_start(psi_start + N),
+        cte_start(n_state * N),
+        epsi_start(cte_start + (errors ? N : 0)),
+        delta_start(epsi_start + (errors ? N : 0)),
+        a_start(delta_start + N - 1) {}
+};
+
+#endif /* LAYOUT_H */
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/Eigenvalues"
+#include "Eigen-3.3/unsupported/Eigen/AutoDiff"
+#include "MPC.h"
+#include "config.h"
+#include "terminal_cost.h"
+#include "vehicle_model.h"
+
+/*
+Offline solver for the terminal cost tables of terminal_cost.h.
+
+At every speed of the grid the kinematic model, integrated with the
+config's integrator, and its error step are linearized around driving
+straight along the reference at that speed, and the discrete algebraic
+Riccati equation
+
+  P = Q + A^T P A - A^T P B (R + B^T P B)^-1 B^T P A
+
+is iterated to its fixed point, with Q the config's weights on cte and
+epsi and R its weight on delta. The table is written for
+`terminal_table` in a config with the same model, dt, integrator and
+weights.
+
+  lqr_terminal [--config c.json] [--v-min mph] [--v-max mph]
+               [--v-step mph] [--out terminal_lqr.json]
+*/
+
+// A = de'/de and B = de'/d delta of the errors e = (cte, epsi) at e = 0,
+// delta = 0 and speed v, through the model's own step integrated as
+// configured and the error step the solvers use with it (ErrorStep in
+// vehicle_model.h). The reference runs along the x axis, so cte = -y and
+// epsi = psi.
+template <class Model>
+void Linearize(double v, double dt, Eigen::Matrix2d *A, Eigen::Vector2d *B) {
+  typedef Eigen::AutoDiffScalar<Eigen::Vector3d> AD;
+  const double poly[4] = {0.0, 0.0, 0.0, 0.0};
+  AD s[Model::n_state];
+  for (size_t i = 0; i < Model::n_state; i++) {
+    s[i] = AD(0.0);
+  }
+  s[Model::Y] = -AD(0.0, 3, 0);
+  s[Model::PSI] = AD(0.0, 3, 1);
+  s[Model::V] = AD(v);
+  AD u[Model::n_input];
+  u[Model::DELTA] = AD(0.0, 3, 2);
+  u[Model::A] = AD(0.0);
+  AD next[Model::n_state];
+  Model::step(s, u, dt, next);
+  AD e[2];
+  ErrorStep<Model>(poly, s, s[Model::PSI], next, dt, &e[0], &e[1]);
+  for (int i = 0; i < 2; i++) {
+    A->row(i) = e[i].derivatives().head<2>().transpose();
+    (*B)[i] = e[i].derivatives()[2];
+  }
+}
+
+void Linearize(const std::string &integrator, double v, double dt,
+               Eigen::Matrix2d *A, Eigen::Vector2d *B) {
+  if (integrator == "euler_integrated") {
+    Linearize<IntegratedEuler<KinematicModel>>(v, dt, A, B);
+  } else if (integrator == "rk2") {
+    Linearize<Midpoint<KinematicModel>>(v, dt, A, B);
+  } else if (integrator == "rk4") {
+    Linearize<RungeKutta4<KinematicModel>>(v, dt, A, B);
+  } else {
+    Linearize<KinematicModel>(v, dt, A, B);
+  }
+}
+
+// The LQR gain for P.
+Eigen::RowVector2d Gain(const Eigen::Matrix2d &A, const Eigen::Vector2d &B,
+                        double R, const Eigen::Matrix2d &P) {
+  return B.transpose() * P * A / (R + B.dot(P * B));
+}
+
+// Iterates the Riccati equation from P = Q until it changes by less than
+// `tol` relative to P. Returns the iterations, or -1 if it didn't settle.
+int SolveDARE(const Eigen::Matrix2d &A, const Eigen::Vector2d &B,
+              const Eigen::Matrix2d &Q, double R, Eigen::Matrix2d *P,
+              int max_iter = 100000, double tol = 1e-12) {
+  *P = Q;
+  for (int i = 1; i <= max_iter; i++) {
+    Eigen::Matrix2d closed = A - B * Gain(A, B, R, *P);
+    Eigen::Matrix2d next = Q + A.transpose() * *P * closed;
+    next = (next + next.transpose()) / 2;
+    double change = (next - *P).norm();
+    *P = next;
+    if (change <= tol * P->norm()) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int main(int argc, char *argv[]) {
+  MPCConfig config;
+  double v_min = 5.0;
+  double v_max = 120.0;
+  double v_step = 5.0;
+  string out_path = "terminal_lqr.json";
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--config" && has_value) {
+      if (!LoadConfig(argv[++i], &config)) {
+        cerr << "Failed to load config " << argv[i] << endl;
+        return -1;
+      }
+    } else if (arg == "--v-min" && has_value) {
+      v_min = atof(argv[++i]);
+    } else if (arg == "--v-max" && has_value) {
+      v_max = atof(argv[++i]);
+    } else if (arg == "--v-step" && has_value) {
+      v_step = atof(argv[++i]);
+    } else if (arg == "--out" && has_value) {
+      out_path = argv[++i];
+    }
+  }
+  // at standstill steering can't reduce cte, there is no finite P
+  if (v_min <= 0.0 || v_step <= 0.0 || v_max < v_min) {
+    cerr << "Need 0 < --v-min <= --v-max and --v-step > 0" << endl;
+    return -1;
+  }
+
+  // the table's errors are those of the kinematic model
+  if (config.model != "kinematic") {
+    cerr << "lqr_terminal solves for the kinematic model only, not "
+         << config.model << endl;
+    return -1;
+  }
+
+  TerminalTable table;
+  table.model = config.model;
+  table.integrator = config.integrator;
+  table.dt = config.dt;
+  table.weight_cet = config.weight_cet;
+  table.weight_epsi = config.weight_epsi;
+  table.weight_delta = config.weight_delta;
+
+  Eigen::Matrix2d Q =
+      Eigen::Vector2d(config.weight_cet, config.weight_epsi).asDiagonal();
+  double R = config.weight_delta;
+
+  printf("%8s %6s %12s %12s %12s %10s\n", "speed", "iter", "P cte",
+         "P epsi", "P cte,epsi", "closed |z|");
+  for (double v = v_min; v <= v_max + 1e-9; v += v_step) {
+    Eigen::Matrix2d A, P;
+    Eigen::Vector2d B;
+    Linearize(config.integrator, v, config.dt, &A, &B);
+    int iterations = SolveDARE(A, B, Q, R, &P);
+    if (iterations < 0) {
+      cerr << "The Riccati equation did not converge at " << v << endl;
+      return 1;
+    }
+    // the slowest mode of the closed loop with the LQR gain
+    Eigen::Matrix2d closed = A - B * Gain(A, B, R, P);
+    double radius = closed.eigenvalues().cwiseAbs().maxCoeff();
+    printf("%8.1f %6d %12.1f %12.1f %12.1f %10.4f\n", v, iterations,
+           P(0, 0), P(1, 1), P(0, 1), radius);
+    table.speeds.push_back(v);
+    table.P.push_back(P);
+  }
+
+  if (!SaveTerminalTable(out_path, table)) {
+    cerr << "Failed to write " << out_path << endl;
+    return -1;
+  }
+  printf("wrote %s\n", out_path.c_str());
+  return 0;
+}
@@ -1,78 +1,298 @@
 #include <math.h>
 #include <uWS/uWS.h>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdlib>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <thread>
 #include <vector>
-#include "Eigen-3.3/Eigen/Core"
-#include "Eigen-3.3/Eigen/QR"
 #include "MPC.h"
+#include "archive.h"
+#include "controller.h"
+#include "feedback.h"
 #include "json.hpp"
+#include "memory.h"
+#include "obstacles.h"
+#include "planner.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include "send_policy.h"
+#include "wire.h"
 
 // for convenience
 using json = nlohmann::json;
 
-// For converting back and forth between radians and degrees.
-constexpr double pi() { return M_PI; }
-double deg2rad(double x) { return x * pi() / 180; }
-double rad2deg(double x) { return x * 180 / pi(); }
-
-// Checks if the SocketIO event has JSON data.
-// If there is data the JSON object in string format will be returned,
-// else the empty string "" will be returned.
-string hasData(string s) {
-  auto found_null = s.find("null");
-  auto b1 = s.find_first_of("[");
-  auto b2 = s.rfind("}]");
-  if (found_null != string::npos) {
-    return "";
-  } else if (b1 != string::npos && b2 != string::npos) {
-    return s.substr(b1, b2 - b1 + 2);
-  }
-  return "";
+// Latency
+// The purpose is to mimic real driving conditions where
+// the car does actuate the commands instantly.
+//
+// Feel free to play around with this value but should be to drive
+// around the track with 100ms latency.
+//
+// NOTE: REMEMBER TO SET THIS TO 100 MILLISECONDS BEFORE
+// SUBMITTING.
+const int latency_ms = 100;
+
+// A websocket connection shared with the batch workers.
+// Only the event loop thread touches it.
+struct Connection {
+  uWS::WebSocket<uWS::SERVER> ws;
+  bool open;
+  // bytes of replies handed to uWS and not yet written to the socket
+  size_t buffered = 0;
+  // obstacles and last plan of the vehicle, shared with the workers
+  std::shared_ptr<ObstacleField> obstacles;
+  // the plan followed between full solves, see feedback.h
+  std::shared_ptr<PlanFeedback> feedback;
+};
+
+// Replies solved by the batch workers, sent from the event loop by a timer
+// once the simulated latency has passed.
+// They are encoded when sent, trimmed to the connection's backlog then.
+struct Reply {
+  std::shared_ptr<Connection> conn;
+  Steer steer;
+  bool binary;
+  chrono::steady_clock::time_point send_at;
+};
+
+struct Outbox {
+  std::mutex mutex;
+  std::vector<Reply> replies;
+  SendPolicy *policy;
+};
+
+// A reply until uWS has written it to the socket, or dropped it with
+// the connection.
+struct InFlight {
+  std::shared_ptr<Connection> conn;
+  size_t bytes;
+};
+
+void Written(uWS::WebSocket<uWS::SERVER> ws, void *data, bool cancelled,
+             void *reserved) {
+  InFlight *sent = static_cast<InFlight *>(data);
+  sent->conn->buffered -= sent->bytes;
+  delete sent;
 }
 
-// Evaluate a polynomial.
-double polyeval(Eigen::VectorXd coeffs, double x) {
-  double result = 0.0;
-  for (int i = 0; i < coeffs.size(); i++) {
-    result += coeffs[i] * pow(x, i);
-  }
-  return result;
+// Send the commands, and as much of the lines as the backlog allows, see
+// send_policy.h. Returns the message sent.
+std::string SendReply(const std::shared_ptr<Connection> &conn,
+                      SendPolicy *policy, const Steer &steer, bool binary) {
+  std::string msg = policy->Reply(steer, binary, conn->buffered);
+  conn->buffered += msg.length();
+  conn->ws.send(msg.data(), msg.length(),
+                binary ? uWS::OpCode::BINARY : uWS::OpCode::TEXT, Written,
+                new InFlight{conn, msg.length()});
+  return msg;
 }
 
-// Fit a polynomial.
-// Adapted from
-// https://github.com/JuliaMath/Polynomials.jl/blob/master/src/Polynomials.jl#L676-L716
-Eigen::VectorXd polyfit(Eigen::VectorXd xvals, Eigen::VectorXd yvals,
-                        int order) {
-  assert(xvals.size() == yvals.size());
-  assert(order >= 1 && order <= xvals.size() - 1);
-  Eigen::MatrixXd A(xvals.size(), order + 1);
-
-  for (int i = 0; i < xvals.size(); i++) {
-    A(i, 0) = 1.0;
+void FlushOutbox(uS::Timer *timer) {
+  Outbox *outbox = static_cast<Outbox *>(timer->getData());
+  auto now = chrono::steady_clock::now();
+  std::vector<Reply> ready;
+  {
+    std::lock_guard<std::mutex> lock(outbox->mutex);
+    // keep the order the replies were queued in, so a connection never
+    // gets an older command after a newer one
+    auto &replies = outbox->replies;
+    auto waiting = std::stable_partition(
+        replies.begin(), replies.end(),
+        [now](const Reply &reply) { return reply.send_at > now; });
+    std::move(waiting, replies.end(), std::back_inserter(ready));
+    replies.erase(waiting, replies.end());
   }
-
-  for (int j = 0; j < xvals.size(); j++) {
-    for (int i = 0; i < order; i++) {
-      A(j, i + 1) = A(j, i) * xvals(j);
+  for (auto &reply : ready) {
+    if (reply.conn->open) {
+      SendReply(reply.conn, outbox->policy, reply.steer, reply.binary);
     }
   }
+}
+
+json MemoryToJson(const MPCMemory &memory) {
+  return {{"setup", memory.setup},
+          {"workspace", memory.workspace},
+          {"tape", memory.tape}};
+}
 
-  auto Q = A.householderQr();
-  auto result = Q.solve(yvals);
-  return result;
+// One archive row per tick, see archive.h.
+void ArchiveTick(ArchiveWriter *archive, chrono::system_clock::time_point time,
+                 const Telemetry &t, const Steer &steer, double solve_ms) {
+  double row[kArchiveColumns];
+  row[kArchiveTime] =
+      chrono::duration<double>(time.time_since_epoch()).count();
+  row[kArchiveX] = t.x;
+  row[kArchiveY] = t.y;
+  row[kArchivePsi] = t.psi;
+  row[kArchiveSpeed] = t.speed;
+  Eigen::VectorXd coeffs = ReferenceCoeffs(t);
+  for (int i = 0; i < 4; i++) {
+    row[kArchiveC0 + i] = coeffs[i];
+  }
+  row[kArchiveSteering] = steer.steering_angle;
+  row[kArchiveThrottle] = steer.throttle;
+  row[kArchiveSolveMs] = solve_ms;
+  archive->Append(row);
 }
 
-int main() {
+int main(int argc, char *argv[]) {
   uWS::Hub h;
 
+  // `./mpc --config <file>` overrides the tuned parameters, see config.h.
+  // With `--batch <window_ms> <workers>` telemetry from all connections
+  // is micro-batched and solved on a worker pool instead of on the event
+  // loop, see scheduler.h. `--two-rate` adds a slow long-horizon planner
+  // that the per-tick MPC tracks with a short horizon, see planner.h.
+  // `--archive <file>` appends every tick to a telemetry archive, see
+  // archive.h. Past `--send-buffer <bytes>` waiting to be written to a
+  // client, replies carry fewer points of the lines, see send_policy.h.
+  MPCConfig config;
+  std::string config_path;
+  double window_ms = 0.0;
+  int workers = 0;
+  bool two_rate = false;
+  std::unique_ptr<ArchiveWriter> archive;
+  size_t send_buffer = 16384;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--config" && i + 1 < argc) {
+      config_path = argv[++i];
+      if (!LoadConfig(config_path, &config)) {
+        std::cerr << "Failed to load config " << argv[i] << std::endl;
+        return -1;
+      }
+    } else if (arg == "--batch" && i + 2 < argc) {
+      window_ms = atof(argv[++i]);
+      workers = atoi(argv[++i]);
+    } else if (arg == "--two-rate") {
+      two_rate = true;
+    } else if (arg == "--archive" && i + 1 < argc) {
+      archive.reset(new ArchiveWriter(argv[++i]));
+      if (!archive->ok()) {
+        std::cerr << "Failed to open archive " << argv[i] << std::endl;
+        return -1;
+      }
+    } else if (arg == "--send-buffer" && i + 1 < argc) {
+      send_buffer = atol(argv[++i]);
+    }
+  }
+  if (two_rate && workers > 0) {
+    std::cerr << "--two-rate controls a single vehicle, it can't be "
+                 "combined with --batch" << std::endl;
+    return -1;
+  }
+
   // MPC is initialized here!
-  MPC mpc;
+  MPC mpc(config);
+
+  std::unique_ptr<TwoRateController> hierarchy;
+  if (two_rate) {
+    hierarchy.reset(new TwoRateController(config));
+  }
+
+  SendPolicy policy(send_buffer);
+  // the open connections, for /stats
+  std::set<std::shared_ptr<Connection>> connections;
+
+  std::unique_ptr<BatchScheduler> scheduler;
+  Outbox outbox;
+  outbox.policy = &policy;
+  uS::Timer *flush = nullptr;
+  if (workers > 0) {
+    scheduler.reset(new BatchScheduler(workers, window_ms, config));
+    flush = new uS::Timer(h.getLoop());
+    flush->setData(&outbox);
+    flush->start(FlushOutbox, 1, 1);
+    std::cout << "Batching solves: window " << window_ms << " ms, "
+              << workers << " workers" << std::endl;
+  }
+
+  // Solve on the event loop, or hand the telemetry to the scheduler.
+  // Replies go back in the format the client spoke.
+  auto respond = [&mpc, &hierarchy, &scheduler, &outbox, &archive, &policy](
+                     uWS::WebSocket<uWS::SERVER> ws,
+                     const Telemetry &telemetry, bool binary) {
+    auto received = chrono::steady_clock::now();
+    auto time = chrono::system_clock::now();
+    auto conn = *static_cast<std::shared_ptr<Connection> *>(ws.getUserData());
+    if (!scheduler) {
+      // STEP 1-4 in Drive(): fit the waypoints and solve the MPC
+      Steer steer = hierarchy
+                        ? hierarchy->Drive(telemetry, conn->obstacles.get())
+                        : DriveWithFeedback(
+                              mpc, telemetry,
+                              chrono::duration<double>(
+                                  received.time_since_epoch()).count(),
+                              conn->feedback.get(), conn->obstacles.get());
+      if (archive) {
+        ArchiveTick(archive.get(), time, telemetry, steer,
+                    chrono::duration<double, std::milli>(
+                        chrono::steady_clock::now() - received).count());
+      }
+
+      // STEP 6: send controls (steering angle and throttle) to the simulator
+      // NOTE: Remember to divide by deg2rad(25) before you send the steering value back.
+      // Otherwise the values will be in between [-deg2rad(25), deg2rad(25] instead of [-1, 1].
+      this_thread::sleep_for(chrono::milliseconds(latency_ms));
+      std::string msg = SendReply(conn, &policy, steer, binary);
+      if (!binary) {
+        std::cout << msg << std::endl;
+      }
+      return;
+    }
+
+    Outbox *out = &outbox;
+    ArchiveWriter *arch = archive.get();
+    // the callback only keeps a copy of the telemetry for the archive
+    Telemetry kept = arch ? telemetry : Telemetry();
+    scheduler->Submit(telemetry, [conn, binary, out, arch, time,
+                                  received, kept](const Steer &steer) {
+      if (arch) {
+        ArchiveTick(arch, time, kept, steer,
+                    chrono::duration<double, std::milli>(
+                        chrono::steady_clock::now() - received).count());
+      }
+      Reply reply;
+      reply.conn = conn;
+      reply.steer = steer;
+      reply.binary = binary;
+      reply.send_at = chrono::steady_clock::now() +
+                      chrono::milliseconds(latency_ms);
+      std::lock_guard<std::mutex> lock(out->mutex);
+      out->replies.push_back(std::move(reply));
+    }, conn->obstacles, conn->feedback);
+  };
+
+  h.onMessage([&respond](uWS::WebSocket<uWS::SERVER> ws, char *data,
+                         size_t length, uWS::OpCode opCode) {
+    // Our own clients talk the compact binary protocol from wire.h.
+    // Answer in binary, or with a hello carrying our version if the
+    // client speaks a version we don't know.
+    if (opCode == uWS::OpCode::BINARY) {
+      uint8_t version, type;
+      if (!WireHeader(data, length, &version, &type)) {
+        return;
+      }
+      Telemetry telemetry;
+      if (version != kWireVersion) {
+        std::string msg = EncodeHello();
+        ws.send(msg.data(), msg.length(), uWS::OpCode::BINARY);
+      } else if (type == kWireTelemetry &&
+                 DecodeTelemetry(data, length, &telemetry)) {
+        respond(ws, telemetry, true);
+      } else if (type == kWireManual) {
+        std::string msg = EncodeManual();
+        ws.send(msg.data(), msg.length(), uWS::OpCode::BINARY);
+      }
+      return;
+    }
 
-  h.onMessage([&mpc](uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length,
-                     uWS::OpCode opCode) {
     // "42" at the start of the message means there's a websocket message event.
     // The 4 signifies a websocket message
     // The 2 signifies a websocket event
@@ -83,125 +303,10 @@ int main() {
       if (s != "") {
         auto j = json::parse(s);
         string event = j[0].get<string>();
-        if (event == "telemetry") {
-          /*
-          * Calculate steering angle and throttle using MPC.
-          * Both are in between [-1, 1].
-          */
-          // j[1] is the data JSON object
-
-          // STEP 1: get data from the simulator 
-          // https://github.com/udacity/CarND-MPC-Project/blob/master/DATA.md
-          // ptsx, ptsy: the global x, y positions of the waypoints 
-          // px, py: the global x, y position of the vehicle
-          // psi, v: the orientation, the current velocity of the vehicle
-          vector<double> ptsx = j[1]["ptsx"];
-          vector<double> ptsy = j[1]["ptsy"];
-          double px = j[1]["x"];
-          double py = j[1]["y"];
-          double psi = j[1]["psi"];
-          double v = j[1]["speed"];
-          std::vector<double> delta_vals = {};
-          std::vector<double> a_vals = {};
-
-          // STEP 2: Fit a 3rd order polynomial to the waypoints (reference trajectory)
-          // with respect to the car frame of coordinates
-          // Transfer the waypoints w.r.t the global to car frame of reference 
-          // "The simulator returns waypoints using the map's coordinate system, which is 
-          // different than the car's coordinate system. Transforming these waypoints 
-          // will make it easier to both display them and to calculate the CTE and epsi values"
-          Eigen::VectorXd ptsx_car = Eigen::VectorXd(ptsx.size());
-          Eigen::VectorXd ptsy_car = Eigen::VectorXd(ptsy.size());
-
-          // loop all waypoints 
-          for(int i = 0; i < ptsx.size(); i++){
-            double dx_global = ptsx[i] - px;
-            double dy_global = ptsy[i] - py; 
-            ptsx_car[i] =  cos(psi) * dx_global + sin(psi) * dy_global;
-            ptsy_car[i] = -sin(psi) * dx_global + cos(psi) * dy_global;
-          }
-
-          auto coeffs = polyfit(ptsx_car, ptsy_car, 3);
-
-          // STEP 3: Set initial state values 
-          // Calculate cross track error and orientation error values. 
-          // The cross track error is calculated by evaluating at polynomial at x, f(x)
-          // and subtracting y. 
-          // Because only the first waypoint (w.r.t the car frame) is used to calculate 
-          // the cross track error and orientation error, x = y = 0.0, psi = 0.0. 
-          double cte = polyeval(coeffs, 0.0) - 0.0;
-          // Due to the sign starting at 0, the orientation error is -f'(x).
-          // derivative of coeffs[0] + coeffs[1] * x -> coeffs[1]
-          double epsi = 0.0 - atan(coeffs[1]);
-
-          double px_initial = 0.0;
-          double py_initial = 0.0;
-          double psi_initial = 0.0;
-
-          Eigen::VectorXd state(6);
-          state << px_initial, py_initial, psi_initial, v, cte, epsi;
-
-          // STEP 4: solve steering angle and throttle using MPC
-          auto solutions = mpc.Solve(state, coeffs);
-
-          double steer_value = -solutions[0]; // psi values are reverse in the simulator 
-          double throttle_value = solutions[1];
-
-          // STEP 6: send controls (steering angle and throttle) to the simulator
-          json msgJson;
-          // NOTE: Remember to divide by deg2rad(25) before you send the steering value back.
-          // Otherwise the values will be in between [-deg2rad(25), deg2rad(25] instead of [-1, 1].
-          msgJson["steering_angle"] = steer_value;
-          msgJson["throttle"] = throttle_value;
-
-          /* 
-          Display predicted trajectory and waypoints/reference line
-          "These (x,y) points are displayed in reference to the vehicle's coordinate system. 
-          Recall that the x axis always points in the direction of the car’s heading and 
-          the y axis points to the left of the car. So if you wanted to display a point 
-          10 units directly in front of the car, you could set next_x = {10.0} and next_y = {0.0}."
-          */
-          // Display the MPC predicted trajectory 
-          vector<double> mpc_x_vals;
-          vector<double> mpc_y_vals;
-          //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
-          // the points in the simulator are connected by a Green line
-          for (int i = 2; i < solutions.size(); i++){
-            if (i % 2 == 0){
-              mpc_x_vals.push_back(solutions[i]);
-            }
-            else {
-              mpc_y_vals.push_back(solutions[i]);
-            }
-          }
-          msgJson["mpc_x"] = mpc_x_vals;
-          msgJson["mpc_y"] = mpc_y_vals;
-
-          //Display the waypoints/reference line
-          vector<double> next_x_vals;
-          vector<double> next_y_vals;
-          //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
-          // the points in the simulator are connected by a Yellow line
-          for (int i = 0; i < ptsx_car.size(); i++) {
-            next_x_vals.push_back(ptsx_car[i]);
-            next_y_vals.push_back(ptsy_car[i]);
-          }          
-          msgJson["next_x"] = next_x_vals;
-          msgJson["next_y"] = next_y_vals;
-
-          auto msg = "42[\"steer\"," + msgJson.dump() + "]";
-          std::cout << msg << std::endl;
-          // Latency
-          // The purpose is to mimic real driving conditions where
-          // the car does actuate the commands instantly.
-          //
-          // Feel free to play around with this value but should be to drive
-          // around the track with 100ms latency.
-          //
-          // NOTE: REMEMBER TO SET THIS TO 100 MILLISECONDS BEFORE
-          // SUBMITTING.
-          this_thread::sleep_for(chrono::milliseconds(100));
-          ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+        Telemetry telemetry;
+        // j[1] is the data JSON object
+        if (event == "telemetry" && TelemetryFromJson(j[1], &telemetry)) {
+          respond(ws, telemetry, false);
         }
       } else {
         // Manual driving
@@ -211,26 +316,193 @@ int main() {
     }
   });
 
-  // We don't need this since we're not using HTTP but if it's removed the
-  // program
-  // doesn't compile :-(
-  h.onHttpRequest([](uWS::HttpResponse *res, uWS::HttpRequest req, char *data,
-                     size_t, size_t) {
-    const std::string s = "<h1>Hello world!</h1>";
-    if (req.getUrl().valueLength == 1) {
-      res->end(s.data(), s.length());
+  // Hot reload of the controller config without dropping connections.
+  // The new setup is prepared on a separate thread and then swapped into
+  // every MPC; solves in flight finish with the config they started with.
+  std::mutex reload_mutex;
+  std::atomic<int> reload_generation(0);
+  auto reload = [&](const MPCConfig &next) {
+    int generation = ++reload_generation;
+    std::thread([&, next, generation] {
+      auto setup = MPC::Prepare(next);
+      std::lock_guard<std::mutex> lock(reload_mutex);
+      // a newer config may have been posted meanwhile
+      if (generation != reload_generation) {
+        return;
+      }
+      mpc.SetSetup(setup);
+      if (scheduler) {
+        scheduler->SetSetup(setup);
+      }
+      if (hierarchy) {
+        hierarchy->SetConfig(next);
+      }
+      std::cout << "Config reloaded" << std::endl;
+    }).detach();
+  };
+
+  //   GET  /config         the config in use
+  //   POST /config         JSON with the fields to change
+  //   POST /config/reload  read the --config file again
+  //   GET  /stats          counters of the replies sent, and memory held
+  //                        by the process, each controller, each
+  //                        connection and the recorders, bytes
+  //   POST /profile/start  start sampling the process, optional JSON
+  //                        {"hz": 99, "max_samples": 20000}
+  //   POST /profile/stop   stop, and get the folded stacks (profiler.h)
+  //   GET  /profile        whether a profile runs, and its sample counts
+  auto handle_http = [&](uWS::HttpResponse *res, const std::string &url,
+                         uWS::HttpMethod method, const std::string &body) {
+    std::string reply;
+    if (url == "/config" && method == uWS::HttpMethod::METHOD_GET) {
+      reply = ConfigToJson(mpc.Config());
+    } else if (url == "/config" && method == uWS::HttpMethod::METHOD_POST) {
+      MPCConfig next = mpc.Config();
+      if (ConfigFromJson(body, &next)) {
+        reload(next);
+        reply = "ok\n";
+      } else {
+        reply = "error: invalid config\n";
+      }
+    } else if (url == "/config/reload" &&
+               method == uWS::HttpMethod::METHOD_POST) {
+      MPCConfig next;
+      if (!config_path.empty() && LoadConfig(config_path, &next)) {
+        reload(next);
+        reply = "ok\n";
+      } else {
+        reply = "error: can't load config file\n";
+      }
+    } else if (url == "/stats" && method == uWS::HttpMethod::METHOD_GET) {
+      const SendStats &sent = policy.Stats();
+      json send = {{"replies", sent.replies},
+                   {"thinned", sent.thinned},
+                   {"stripped", sent.stripped},
+                   {"bytes_sent", sent.bytes_sent},
+                   {"bytes_trimmed", sent.bytes_trimmed}};
+      json controllers = json::array();
+      controllers.push_back(MemoryToJson(mpc.Memory()));
+      if (scheduler) {
+        for (const auto &worker : scheduler->Memory()) {
+          controllers.push_back(MemoryToJson(worker));
+        }
+      }
+      json clients = json::array();
+      for (const auto &conn : connections) {
+        clients.push_back({{"send_backlog", conn->buffered},
+                           {"obstacles", conn->obstacles->Bytes()}});
+      }
+      size_t queued = 0;
+      {
+        std::lock_guard<std::mutex> lock(outbox.mutex);
+        for (const auto &r : outbox.replies) {
+          queued += sizeof(Reply) +
+                    (r.steer.mpc_x.capacity() + r.steer.mpc_y.capacity() +
+                     r.steer.next_x.capacity() + r.steer.next_y.capacity()) *
+                        sizeof(double);
+        }
+      }
+      json memory = {{"rss", ResidentBytes()},
+                     {"peak_rss", PeakResidentBytes()},
+                     {"cppad_inuse", CppADInUseBytes()},
+                     {"cppad_available", CppADAvailableBytes()},
+                     {"controllers", controllers},
+                     {"connections", clients},
+                     {"outbox", queued},
+                     {"archive", archive ? archive->BufferBytes() : 0}};
+      json stats = {{"send", send}, {"memory", memory}};
+      reply = stats.dump(2) + "\n";
+    } else if (url == "/profile/start" &&
+               method == uWS::HttpMethod::METHOD_POST) {
+      int hz = 99;
+      size_t max_samples = 20000;
+      std::string error = "invalid options";
+      json j;
+      try {
+        j = json::parse(body.empty() ? "{}" : body);
+      } catch (const std::exception &) {
+      }
+      if (j.is_object() && (!j.count("hz") || j["hz"].is_number()) &&
+          (!j.count("max_samples") || j["max_samples"].is_number())) {
+        hz = j.value("hz", hz);
+        max_samples = j.value("max_samples", max_samples);
+        if (StartProfile(hz, max_samples, &error)) {
+          error.clear();
+        }
+      }
+      reply = error.empty() ? "ok\n" : "error: " + error + "\n";
+    } else if (url == "/profile/stop" &&
+               method == uWS::HttpMethod::METHOD_POST) {
+      reply = StopProfile();
+    } else if (url == "/profile" && method == uWS::HttpMethod::METHOD_GET) {
+      ProfileStatus status = GetProfileStatus();
+      json j = {{"running", status.running},
+                {"hz", status.hz},
+                {"samples", status.samples},
+                {"dropped", status.dropped},
+                {"max_samples", status.max_samples}};
+      reply = j.dump(2) + "\n";
+    } else if (url == "/") {
+      reply = "<h1>Hello world!</h1>";
+    }
+    res->end(reply.data(), reply.length());
+  };
+
+  // Bodies larger than one packet arrive in pieces through onHttpData.
+  // The request itself is only valid in onHttpRequest, keep what we need.
+  struct PendingRequest {
+    std::string url;
+    uWS::HttpMethod method;
+    std::string body;
+  };
+  h.onHttpRequest([&handle_http](uWS::HttpResponse *res,
+                                 uWS::HttpRequest req, char *data,
+                                 size_t length, size_t remainingBytes) {
+    std::string url(req.getUrl().value, req.getUrl().valueLength);
+    if (remainingBytes == 0) {
+      handle_http(res, url, req.getMethod(), std::string(data, length));
     } else {
-      // i guess this should be done more gracefully?
-      res->end(nullptr, 0);
+      res->setUserData(new PendingRequest{url, req.getMethod(),
+                                          std::string(data, length)});
     }
   });
 
-  h.onConnection([&h](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
+  h.onHttpData([&handle_http](uWS::HttpResponse *res, char *data,
+                              size_t length, size_t remainingBytes) {
+    auto pending = static_cast<PendingRequest *>(res->getUserData());
+    if (!pending) {
+      return;
+    }
+    pending->body.append(data, length);
+    if (remainingBytes == 0) {
+      res->setUserData(nullptr);
+      handle_http(res, pending->url, pending->method, pending->body);
+      delete pending;
+    }
+  });
+
+  h.onConnection([&h, &connections](uWS::WebSocket<uWS::SERVER> ws,
+                                   uWS::HttpRequest req) {
     std::cout << "Connected!!!" << std::endl;
+    auto conn = std::make_shared<Connection>();
+    conn->ws = ws;
+    conn->open = true;
+    conn->obstacles = std::make_shared<ObstacleField>();
+    conn->feedback = std::make_shared<PlanFeedback>();
+    ws.setUserData(new std::shared_ptr<Connection>(conn));
+    connections.insert(conn);
   });
 
-  h.onDisconnection([&h](uWS::WebSocket<uWS::SERVER> ws, int code,
-                         char *message, size_t length) {
+  h.onDisconnection([&h, &connections](uWS::WebSocket<uWS::SERVER> ws,
+                                      int code, char *message, size_t length) {
+    // replies still queued for this connection are dropped
+    auto conn = static_cast<std::shared_ptr<Connection> *>(ws.getUserData());
+    if (conn) {
+      (*conn)->open = false;
+      connections.erase(*conn);
+      delete conn;
+      ws.setUserData(nullptr);
+    }
     ws.close();
     std::cout << "Disconnected" << std::endl;
   });
@@ -0,0 +1,46 @@
+#include "memory.h"
+#include <unistd.h>
+#include <cppad/cppad.hpp>
+#include <fstream>
+#include <limits>
+#include <string>
+
+size_t ResidentBytes() {
+  // size and resident, in pages
+  std::ifstream statm("/proc/self/statm");
+  size_t pages = 0, resident = 0;
+  if (!(statm >> pages >> resident)) {
+    return 0;
+  }
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+size_t PeakResidentBytes() {
+  std::ifstream status("/proc/self/status");
+  std::string key;
+  while (status >> key) {
+    if (key == "VmHWM:") {
+      size_t kb = 0;
+      status >> kb;
+      return kb * 1024;
+    }
+    status.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+  }
+  return 0;
+}
+
+size_t CppADInUseBytes() {
+  size_t sum = 0;
+  for (size_t t = 0; t < CppAD::thread_alloc::num_threads(); t++) {
+    sum += CppAD::thread_alloc::inuse(t);
+  }
+  return sum;
+}
+
+size_t CppADAvailableBytes() {
+  size_t sum = 0;
+  for (size_t t = 0; t < CppAD::thread_alloc::num_threads(); t++) {
+    sum += CppAD::thread_alloc::available(t);
+  }
+  return sum;
+}
@@ -0,0 +1,23 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stddef.h>
+
+/*
+Memory accounting, to size how many controllers fit on a box.
+
+The process totals come from the kernel (Linux /proc, 0 elsewhere) and
+from CppAD's allocator, which every tape is recorded into. What each
+controller, connection and recorder holds is reported by the owner:
+MPC::Memory(), ObstacleField::Bytes(), ArchiveWriter::BufferBytes().
+*/
+
+// Resident set size of the process now and at its peak, bytes.
+size_t ResidentBytes();
+size_t PeakResidentBytes();
+
+// CppAD's thread_alloc over all threads: handed out, and kept for reuse.
+size_t CppADInUseBytes();
+size_t CppADAvailableBytes();
+
+#endif /* MEMORY_H */
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "MPC.h"
+#include "config.h"
+#include "controller.h"
+#include "json.hpp"
+#include "scenario.h"
+#include "stats.h"
+#include "track.h"
+#include "vehicle_model.h"
+
+// for convenience
+using json = nlohmann::json;
+
+/*
+Cost of each process model.
+
+For every model: the time of one model step on doubles (the code the
+solver inlines into its evaluator), the solve time over a telemetry
+corpus of random cars around the track, and one closed-loop lap of the
+headless simulator.
+
+  model_bench [synthetic] [steps] [track]
+*/
+
+// Nanoseconds per Model::step, driving a constant turn.
+template <class Model>
+double StepNs(int steps) {
+  double s[Model::n_state] = {};
+  s[Model::V] = 30.0;
+  double u[Model::n_input] = {};
+  u[Model::DELTA] = 0.05;
+  u[Model::A] = 0.1;
+  double next[Model::n_state];
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < steps; i++) {
+    Model::step(s, u, 0.1, next);
+    for (size_t k = 0; k < Model::n_state; k++) {
+      s[k] = next[k];
+    }
+  }
+  double ns = MsSince(start) * 1e6 / steps;
+  // keep the loop from being optimized away
+  if (s[Model::X] == 12345.0) {
+    printf("\n");
+  }
+  return ns;
+}
+
+template <class Model>
+void Bench(const string &name, int steps, const vector<Telemetry> &corpus,
+           const Track &track) {
+  MPCConfig config;
+  config.model = name;
+  MPC mpc(config);
+
+  double step_ns = StepNs<Model>(steps);
+
+  vector<double> solve_ms;
+  for (const auto &telemetry : corpus) {
+    auto start = chrono::steady_clock::now();
+    Drive(mpc, telemetry);
+    solve_ms.push_back(MsSince(start));
+  }
+
+  json lap = RunScenario(mpc, "lap:0:0", track);
+  printf("%-10s %9.1f %9.2f %9.2f %9.2f %9.2f %9.2f %8.2f\n", name.c_str(),
+         step_ns, Mean(solve_ms), Percentile(solve_ms, 50),
+         Percentile(solve_ms, 99), lap["lap_time"].get<double>(),
+         lap["progress"].get<double>(), lap["max_cte"].get<double>());
+}
+
+int main(int argc, char *argv[]) {
+  int synthetic = argc > 1 ? atoi(argv[1]) : 200;
+  int steps = argc > 2 ? atoi(argv[2]) : 1000000;
+  string path = argc > 3 ? argv[3] : "../lake_track_waypoints.csv";
+
+  Track track;
+  if (!LoadTrack(path, &track)) {
+    cerr << "Failed to load track " << path << endl;
+    return -1;
+  }
+  vector<Telemetry> corpus = TelemetryCorpus(track, {}, synthetic);
+
+  printf("%-10s %9s %9s %9s %9s %9s %9s %8s\n", "model", "step_ns",
+         "mean_ms", "p50_ms", "p99_ms", "lap_time", "progress", "max_cte");
+  Bench<KinematicModel>("kinematic", steps, corpus, track);
+  Bench<DynamicModel>("dynamic", steps, corpus, track);
+  return 0;
+}
@@ -0,0 +1,221 @@
+#include <math.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "MPC.h"
+#include "config.h"
+#include "controller.h"
+#include "farm.h"
+#include "json.hpp"
+#include "stats.h"
+#include "wire.h"
+
+// for convenience
+using json = nlohmann::json;
+
+/*
+Differential replay: the same recorded drives through two or more
+controller configs, to show that a faster code path or solver setting
+does not change what the car is told to do.
+
+Every (config, log) pair runs as its own farm shard, so the configs solve
+concurrently on separate cores (farm.h). Per tick, each config's solution
+in MPC::Solve's layout (delta, a, then the predicted x/y pairs) is
+compared with the first config's, the baseline; a tick diverges if the
+actuations or any predicted point differ by more than the tolerances.
+The report gives the divergences and each config's speedup over the
+baseline.
+
+  mpc_diff [-j workers] [--delta-tol rad] [--a-tol a] [--path-tol m]
+           [--out report.json] --config base.json --config fast.json log ...
+
+With a single --config the baseline is the built-in default config.
+*/
+
+// Runs in a farm worker: replay one log with one config.
+json Replay(const MPCConfig &config, const string &path) {
+  vector<Telemetry> log;
+  if (!ReadTelemetryLog(path, &log)) {
+    return {{"ok", false}, {"error", "can't read " + path}};
+  }
+  MPC mpc(config);
+  json solutions = json::array();
+  vector<double> solve_ms;
+  for (const auto &telemetry : log) {
+    auto start = chrono::steady_clock::now();
+    Steer steer = Drive(mpc, telemetry);
+    solve_ms.push_back(MsSince(start));
+    // back to the layout of MPC::Solve
+    vector<double> solution = {-steer.steering_angle, steer.throttle};
+    for (size_t i = 0; i < steer.mpc_x.size(); i++) {
+      solution.push_back(steer.mpc_x[i]);
+      solution.push_back(steer.mpc_y[i]);
+    }
+    solutions.push_back(solution);
+  }
+  return {{"ok", true}, {"solutions", solutions}, {"solve_ms", solve_ms}};
+}
+
+struct Divergence {
+  size_t ticks = 0;
+  size_t diverged = 0;
+  double max_delta = 0.0;
+  double max_a = 0.0;
+  double max_path = 0.0;
+  string first;
+};
+
+int main(int argc, char *argv[]) {
+  FarmOptions opts;
+  opts.workers = sysconf(_SC_NPROCESSORS_ONLN);
+  opts.timeout = 1800.0;
+  opts.verbose = false;
+  double delta_tol = 0.005;
+  double a_tol = 0.01;
+  double path_tol = 0.1;
+  string out_path;
+  vector<string> config_paths;
+  vector<string> logs;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "-j" && has_value) {
+      opts.workers = atoi(argv[++i]);
+    } else if (arg == "--delta-tol" && has_value) {
+      delta_tol = atof(argv[++i]);
+    } else if (arg == "--a-tol" && has_value) {
+      a_tol = atof(argv[++i]);
+    } else if (arg == "--path-tol" && has_value) {
+      path_tol = atof(argv[++i]);
+    } else if (arg == "--config" && has_value) {
+      config_paths.push_back(argv[++i]);
+    } else if (arg == "--out" && has_value) {
+      out_path = argv[++i];
+    } else {
+      logs.push_back(arg);
+    }
+  }
+
+  vector<string> names;
+  vector<MPCConfig> configs;
+  if (config_paths.size() == 1) {
+    names.push_back("default");
+    configs.push_back(MPCConfig());
+  }
+  for (const auto &path : config_paths) {
+    MPCConfig config;
+    if (!LoadConfig(path, &config)) {
+      cerr << "Failed to load config " << path << endl;
+      return -1;
+    }
+    names.push_back(path);
+    configs.push_back(config);
+  }
+  if (configs.size() < 2 || logs.empty()) {
+    cerr << "Give at least one --config and a recorded log" << endl;
+    return -1;
+  }
+
+  // shard "c:l" replays log l with config c
+  vector<string> shards;
+  for (size_t c = 0; c < configs.size(); c++) {
+    for (size_t l = 0; l < logs.size(); l++) {
+      shards.push_back(to_string(c) + ":" + to_string(l));
+    }
+  }
+  vector<json> results = RunFarm(shards, opts, [&](const string &shard) {
+    size_t colon = shard.find(':');
+    int c = atoi(shard.substr(0, colon).c_str());
+    int l = atoi(shard.substr(colon + 1).c_str());
+    return Replay(configs[c], logs[l]);
+  });
+
+  bool failed = false;
+  for (size_t k = 0; k < results.size(); k++) {
+    if (!results[k].value("ok", false)) {
+      cerr << "shard " << shards[k] << " failed: "
+           << results[k].value("error", string("?")) << endl;
+      failed = true;
+    }
+  }
+  if (failed) {
+    return 1;
+  }
+
+  // compare every config with the baseline, tick by tick
+  json report = json::array();
+  vector<double> base_ms;
+  printf("%-30s %7s %9s %10s %8s %9s %9s %9s %8s\n", "config", "ticks",
+         "diverged", "max_delta", "max_a", "max_path", "mean_ms", "p99_ms",
+         "speedup");
+  bool diverged = false;
+  for (size_t c = 0; c < configs.size(); c++) {
+    Divergence d;
+    vector<double> solve_ms;
+    for (size_t l = 0; l < logs.size(); l++) {
+      const json &base = results[l]["solutions"];
+      const json &mine = results[c * logs.size() + l]["solutions"];
+      for (double ms : results[c * logs.size() + l]["solve_ms"]) {
+        solve_ms.push_back(ms);
+      }
+      for (size_t t = 0; t < base.size() && t < mine.size(); t++) {
+        vector<double> a = base[t];
+        vector<double> b = mine[t];
+        double dd = fabs(a[0] - b[0]);
+        double da = fabs(a[1] - b[1]);
+        double dp = 0.0;
+        for (size_t i = 2; i + 1 < a.size() && i + 1 < b.size(); i += 2) {
+          dp = std::max(dp, hypot(a[i] - b[i], a[i + 1] - b[i + 1]));
+        }
+        // a different horizon can't be compared point by point
+        if (a.size() != b.size()) {
+          dp = std::max(dp, path_tol * 2.0);
+        }
+        d.ticks++;
+        d.max_delta = std::max(d.max_delta, dd);
+        d.max_a = std::max(d.max_a, da);
+        d.max_path = std::max(d.max_path, dp);
+        if (dd > delta_tol || da > a_tol || dp > path_tol) {
+          if (d.diverged == 0) {
+            d.first = logs[l] + " tick " + to_string(t);
+          }
+          d.diverged++;
+        }
+      }
+    }
+    if (c == 0) {
+      base_ms = solve_ms;
+    }
+    double speedup = Mean(solve_ms) > 0.0 ? Mean(base_ms) / Mean(solve_ms) : 0.0;
+    diverged = diverged || d.diverged > 0;
+    printf("%-30s %7zu %9zu %10.5f %8.5f %9.4f %9.2f %9.2f %7.2fx\n",
+           names[c].c_str(), d.ticks, d.diverged, d.max_delta, d.max_a,
+           d.max_path, Mean(solve_ms), Percentile(solve_ms, 99), speedup);
+    if (d.diverged > 0) {
+      printf("  first divergence: %s\n", d.first.c_str());
+    }
+    report.push_back({{"config", names[c]},
+                      {"ticks", d.ticks},
+                      {"diverged", d.diverged},
+                      {"first_divergence", d.first},
+                      {"max_delta", d.max_delta},
+                      {"max_a", d.max_a},
+                      {"max_path", d.max_path},
+                      {"solve_mean_ms", Mean(solve_ms)},
+                      {"solve_p99_ms", Percentile(solve_ms, 99)},
+                      {"speedup", speedup}});
+  }
+
+  if (!out_path.empty()) {
+    ofstream out(out_path);
+    out << report.dump(2) << endl;
+  }
+  return diverged ? 1 : 0;
+}
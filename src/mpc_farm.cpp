@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "MPC.h"
+#include "farm.h"
+#include "json.hpp"
+#include "scenario.h"
+#include "track.h"
+
+// for convenience
+using json = nlohmann::json;
+
+/*
+Scenario farm: replay recorded drives and synthetic laps through the
+controller on every core and merge the results into one report.
+
+  mpc_farm [-j workers] [--retries n] [--timeout s] [--laps n]
+           [--track path] [--out report.json] [log ...]
+
+Each worker is a separate process with its own controller, see farm.h.
+Exits non-zero if any scenario failed.
+*/
+
+int main(int argc, char *argv[]) {
+  FarmOptions opts;
+  opts.workers = sysconf(_SC_NPROCESSORS_ONLN);
+  opts.timeout = 600.0;
+  int laps = 0;
+  string track_path = "../lake_track_waypoints.csv";
+  string out_path;
+  vector<string> shards;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "-j" && has_value) {
+      opts.workers = atoi(argv[++i]);
+    } else if (arg == "--retries" && has_value) {
+      opts.retries = atoi(argv[++i]);
+    } else if (arg == "--timeout" && has_value) {
+      opts.timeout = atof(argv[++i]);
+    } else if (arg == "--laps" && has_value) {
+      laps = atoi(argv[++i]);
+    } else if (arg == "--track" && has_value) {
+      track_path = argv[++i];
+    } else if (arg == "--out" && has_value) {
+      out_path = argv[++i];
+    } else {
+      shards.push_back(arg);
+    }
+  }
+
+  Track track;
+  if (!LoadTrack(track_path, &track)) {
+    cerr << "Failed to load track " << track_path << endl;
+    return -1;
+  }
+  for (const auto &spec : SyntheticScenarios(track, laps)) {
+    shards.push_back(spec);
+  }
+  if (shards.empty()) {
+    cerr << "Nothing to run: give recorded logs and/or --laps n" << endl;
+    return -1;
+  }
+
+  vector<json> results = RunFarm(shards, opts, [&track](const string &spec) {
+    MPC mpc;
+    return RunScenario(mpc, spec, track);
+  });
+
+  // merge
+  int failed = 0;
+  double worst_p99 = 0.0;
+  size_t ticks = 0;
+  printf("%-40s %4s %6s %9s %9s %9s %8s\n", "scenario", "ok", "ticks",
+         "p50_ms", "p99_ms", "lap_time", "max_cte");
+  for (auto &r : results) {
+    bool ok = r.value("ok", false);
+    failed += !ok;
+    ticks += r.value("ticks", 0);
+    worst_p99 = std::max(worst_p99, r.value("solve_p99_ms", 0.0));
+    printf("%-40s %4s %6d %9.2f %9.2f %9.2f %8.2f\n",
+           r.value("scenario", r.value("shard", string("?"))).c_str(),
+           ok ? "yes" : "NO", r.value("ticks", 0),
+           r.value("solve_p50_ms", 0.0), r.value("solve_p99_ms", 0.0),
+           r.value("lap_time", 0.0), r.value("max_cte", 0.0));
+  }
+  json summary = {{"scenarios", results.size()},
+                  {"failed", failed},
+                  {"ticks", ticks},
+                  {"worst_solve_p99_ms", worst_p99}};
+  printf("%zu scenarios, %d failed, %zu ticks, worst p99 %.2f ms\n",
+         results.size(), failed, ticks, worst_p99);
+
+  if (!out_path.empty()) {
+    ofstream out(out_path);
+    out << json({{"summary", summary}, {"scenarios", results}}).dump(2)
+        << endl;
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "MPC.h"
+#include "config.h"
+#include "farm.h"
+#include "json.hpp"
+#include "sim.h"
+#include "stats.h"
+#include "track.h"
+
+// for convenience
+using json = nlohmann::json;
+
+/*
+Monte Carlo latency sensitivity of the closed loop.
+
+Every run drives the headless simulator (sim.h) from a random waypoint
+with randomly drawn perturbations:
+
+  latency          actuation delay, uniform in [--latency-min, --latency-max]
+  jitter           extra delay per command, uniform in [0, jitter] with
+                   jitter uniform in [0, --jitter-max]
+  drop rate        telemetry loss, uniform in [0, --drop-max]
+  noise            pose and speed noise, a uniform fraction of the maxima
+
+Runs are spread over all cores (farm.h). A run succeeds if the car stays
+on the track, for a full lap or until --max-time. The report gives the
+success rate, percentiles over runs of each run's cross track error, and
+the success rate by effective delay (latency + mean jitter, plus the solve
+time with --count-solve-time). The latency envelope is the largest delay
+up to which every bin succeeds at least --target of the time.
+
+The controller predicts latency_dt ahead as usual; with --compensate it is
+told the nominal delay of each run instead.
+
+  mpc_latency_sweep [-j workers] [--runs n] [--latency-min s]
+                    [--latency-max s] [--jitter-max s] [--drop-max p]
+                    [--pos-noise-max m] [--psi-noise-max rad]
+                    [--speed-noise-max mph] [--max-time s] [--bin s]
+                    [--target rate] [--compensate] [--count-solve-time]
+                    [--config c.json] [--track path] [--out runs.json]
+*/
+
+struct SweepOptions {
+  double latency_min = 0.0;
+  double latency_max = 0.4;
+  double jitter_max = 0.1;
+  double drop_max = 0.3;
+  double pos_noise_max = 0.3;
+  double psi_noise_max = 0.02;
+  double speed_noise_max = 1.0;
+  double max_time = 120.0;
+  bool compensate = false;
+  bool count_solve_time = false;
+};
+
+// Runs in a farm worker: one closed-loop run with perturbations drawn
+// from the run number.
+json RunOne(int run, const SweepOptions &sweep, const MPCConfig &base,
+            const Track &track) {
+  std::mt19937 rng(run);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+  SimOptions opts;
+  opts.seed = run;
+  opts.max_time = sweep.max_time;
+  opts.start_index = static_cast<int>(uniform(rng) * track.x.size());
+  opts.latency = sweep.latency_min +
+                 (sweep.latency_max - sweep.latency_min) * uniform(rng);
+  opts.latency_jitter = sweep.jitter_max * uniform(rng);
+  opts.drop_rate = sweep.drop_max * uniform(rng);
+  double noise = uniform(rng);
+  opts.pos_noise = noise * sweep.pos_noise_max;
+  opts.psi_noise = noise * sweep.psi_noise_max;
+  opts.speed_noise = noise * sweep.speed_noise_max;
+  opts.solve_time_scale = sweep.count_solve_time ? 1.0 : 0.0;
+
+  MPCConfig config = base;
+  if (sweep.compensate) {
+    config.latency_dt = opts.latency + opts.latency_jitter / 2.0;
+  }
+  MPC mpc(config);
+  LapResult lap = RunLap(mpc, track, opts);
+
+  double delay = opts.latency + opts.latency_jitter / 2.0 +
+                 opts.solve_time_scale * Mean(lap.solve_ms) / 1000.0;
+  return {{"ok", true},
+          {"run", run},
+          {"latency", opts.latency},
+          {"jitter", opts.latency_jitter},
+          {"drop_rate", opts.drop_rate},
+          {"noise", noise},
+          {"delay", delay},
+          {"success", !lap.off_track},
+          {"completed", lap.completed},
+          {"progress", lap.progress},
+          {"max_cte", lap.max_cte},
+          {"cte_p50", Percentile(lap.cte, 50)},
+          {"cte_p99", Percentile(lap.cte, 99)},
+          {"solve_p99_ms", Percentile(lap.solve_ms, 99)}};
+}
+
+int main(int argc, char *argv[]) {
+  FarmOptions opts;
+  opts.workers = sysconf(_SC_NPROCESSORS_ONLN);
+  opts.timeout = 900.0;
+  opts.verbose = false;
+  SweepOptions sweep;
+  int runs = 1000;
+  double bin = 0.025;
+  double target = 0.99;
+  MPCConfig base;
+  string track_path = "../lake_track_waypoints.csv";
+  string out_path;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "-j" && has_value) {
+      opts.workers = atoi(argv[++i]);
+    } else if (arg == "--runs" && has_value) {
+      runs = atoi(argv[++i]);
+    } else if (arg == "--latency-min" && has_value) {
+      sweep.latency_min = atof(argv[++i]);
+    } else if (arg == "--latency-max" && has_value) {
+      sweep.latency_max = atof(argv[++i]);
+    } else if (arg == "--jitter-max" && has_value) {
+      sweep.jitter_max = atof(argv[++i]);
+    } else if (arg == "--drop-max" && has_value) {
+      sweep.drop_max = atof(argv[++i]);
+    } else if (arg == "--pos-noise-max" && has_value) {
+      sweep.pos_noise_max = atof(argv[++i]);
+    } else if (arg == "--psi-noise-max" && has_value) {
+      sweep.psi_noise_max = atof(argv[++i]);
+    } else if (arg == "--speed-noise-max" && has_value) {
+      sweep.speed_noise_max = atof(argv[++i]);
+    } else if (arg == "--max-time" && has_value) {
+      sweep.max_time = atof(argv[++i]);
+    } else if (arg == "--bin" && has_value) {
+      bin = atof(argv[++i]);
+    } else if (arg == "--target" && has_value) {
+      target = atof(argv[++i]);
+    } else if (arg == "--compensate") {
+      sweep.compensate = true;
+    } else if (arg == "--count-solve-time") {
+      sweep.count_solve_time = true;
+    } else if (arg == "--config" && has_value) {
+      if (!LoadConfig(argv[++i], &base)) {
+        cerr << "Failed to load config " << argv[i] << endl;
+        return -1;
+      }
+    } else if (arg == "--track" && has_value) {
+      track_path = argv[++i];
+    } else if (arg == "--out" && has_value) {
+      out_path = argv[++i];
+    }
+  }
+
+  Track track;
+  if (!LoadTrack(track_path, &track)) {
+    cerr << "Failed to load track " << track_path << endl;
+    return -1;
+  }
+
+  vector<string> shards;
+  for (int k = 0; k < runs; k++) {
+    shards.push_back(to_string(k));
+  }
+  printf("%d runs on %d workers\n", runs, opts.workers);
+  vector<json> results = RunFarm(shards, opts, [&](const string &shard) {
+    return RunOne(atoi(shard.c_str()), sweep, base, track);
+  });
+
+  // overall
+  int done = 0;
+  int succeeded = 0;
+  vector<double> cte_p50, cte_p99, max_cte;
+  for (auto &r : results) {
+    if (!r.value("ok", false)) {
+      continue;
+    }
+    done++;
+    succeeded += r["success"].get<bool>();
+    cte_p50.push_back(r["cte_p50"]);
+    cte_p99.push_back(r["cte_p99"]);
+    max_cte.push_back(r["max_cte"]);
+  }
+  printf("%d of %d runs finished, success rate %.3f\n", done, runs,
+         done ? double(succeeded) / done : 0.0);
+  printf("%-18s %8s %8s %8s %8s\n", "cte over runs", "p50", "p90", "p99",
+         "max");
+  const char *names[] = {"run p50", "run p99", "run max"};
+  vector<double> *columns[] = {&cte_p50, &cte_p99, &max_cte};
+  for (int c = 0; c < 3; c++) {
+    printf("%-18s %8.3f %8.3f %8.3f %8.3f\n", names[c],
+           Percentile(*columns[c], 50), Percentile(*columns[c], 90),
+           Percentile(*columns[c], 99), Percentile(*columns[c], 100));
+  }
+
+  // success by effective delay
+  int n_bins = 1;
+  for (auto &r : results) {
+    if (r.value("ok", false)) {
+      n_bins = std::max(n_bins, int(r["delay"].get<double>() / bin) + 1);
+    }
+  }
+  vector<int> bin_runs(n_bins, 0), bin_success(n_bins, 0);
+  vector<vector<double>> bin_cte(n_bins);
+  for (auto &r : results) {
+    if (!r.value("ok", false)) {
+      continue;
+    }
+    int b = int(r["delay"].get<double>() / bin);
+    bin_runs[b]++;
+    bin_success[b] += r["success"].get<bool>();
+    bin_cte[b].push_back(r["max_cte"]);
+  }
+  printf("%-15s %6s %9s %12s\n", "delay_s", "runs", "success", "max_cte_p99");
+  double envelope = 0.0;
+  bool within = true;
+  for (int b = 0; b < n_bins; b++) {
+    if (bin_runs[b] == 0) {
+      continue;
+    }
+    double rate = double(bin_success[b]) / bin_runs[b];
+    printf("%6.3f - %6.3f %6d %9.3f %12.3f\n", b * bin, (b + 1) * bin,
+           bin_runs[b], rate, Percentile(bin_cte[b], 99));
+    within = within && rate >= target;
+    if (within) {
+      envelope = (b + 1) * bin;
+    }
+  }
+  printf("latency envelope: %.3f s at %.1f%% success\n", envelope,
+         target * 100.0);
+
+  if (!out_path.empty()) {
+    ofstream out(out_path);
+    out << json({{"success_rate", done ? double(succeeded) / done : 0.0},
+                 {"envelope_s", envelope},
+                 {"runs", results}}).dump(2)
+        << endl;
+  }
+  return 0;
+}
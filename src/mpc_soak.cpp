@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "MPC.h"
+#include "archive.h"
+#include "config.h"
+#include "controller.h"
+#include "json.hpp"
+#include "memory.h"
+#include "obstacles.h"
+#include "scenario.h"
+#include "scheduler.h"
+#include "send_policy.h"
+#include "track.h"
+#include "wire.h"
+
+// for convenience
+using json = nlohmann::json;
+
+/*
+Soak test for memory: the same telemetry replayed many times through one
+controller the way the server handles a connection. Each tick parses the
+socket.io message, drives with the connection's obstacle state, encodes
+both kinds of reply and appends to an archive. Memory is sampled after
+every pass over the corpus.
+
+With --workers n the corpus goes through a BatchScheduler of n workers
+instead, the way `./mpc --batch` serves it: the messages are dealt out
+round robin to --vehicles vehicles, each with its own obstacle state and
+plan feedback, a tick of every vehicle at a time. The workers queue their
+replies in an outbox, which the calling thread empties as the server's
+event loop does, encoding the replies and archiving the ticks.
+
+The first --warmup passes fill the allocators' pools and are not judged.
+After them the resident set and CppAD's memory in use must not grow by
+more than --max-growth-kb; the exit status is 1 if they do.
+
+  mpc_soak [--passes n] [--warmup n] [--max-growth-kb kb] [--synthetic n]
+           [--workers n] [--vehicles n] [--window-ms ms]
+           [--config c.json] [--track path] [log ...]
+*/
+
+// A solved tick waiting for the calling thread, like the server's Reply.
+struct Queued {
+  Telemetry telemetry;
+  Steer steer;
+};
+
+struct Outbox {
+  std::mutex mutex;
+  std::vector<Queued> replies;
+};
+
+// Encode both kinds of reply and archive the tick, as the server does
+// once a tick is solved.
+void Send(SendPolicy *policy, ArchiveWriter *archive,
+          const Telemetry &telemetry, const Steer &steer) {
+  policy->Reply(steer, false, 0);
+  policy->Reply(steer, true, 0);
+  double row[kArchiveColumns] = {};
+  row[kArchiveX] = telemetry.x;
+  row[kArchiveY] = telemetry.y;
+  row[kArchivePsi] = telemetry.psi;
+  row[kArchiveSpeed] = telemetry.speed;
+  row[kArchiveSteering] = steer.steering_angle;
+  row[kArchiveThrottle] = steer.throttle;
+  archive->Append(row);
+}
+
+// Send what the workers have queued, returns how many.
+size_t FlushOutbox(Outbox *outbox, SendPolicy *policy,
+                   ArchiveWriter *archive) {
+  std::vector<Queued> ready;
+  {
+    std::lock_guard<std::mutex> lock(outbox->mutex);
+    // moved out, so the outbox keeps its capacity as the server's does
+    auto &replies = outbox->replies;
+    std::move(replies.begin(), replies.end(), std::back_inserter(ready));
+    replies.clear();
+  }
+  for (const auto &reply : ready) {
+    Send(policy, archive, reply.telemetry, reply.steer);
+  }
+  return ready.size();
+}
+
+int main(int argc, char *argv[]) {
+  int passes = 20;
+  int warmup = 3;
+  double max_growth_kb = 1024.0;
+  int synthetic = 200;
+  int workers = 0;
+  int vehicles = 8;
+  double window_ms = 1.0;
+  MPCConfig config;
+  string track_path = "../lake_track_waypoints.csv";
+  vector<string> logs;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--passes" && has_value) {
+      passes = atoi(argv[++i]);
+    } else if (arg == "--warmup" && has_value) {
+      warmup = atoi(argv[++i]);
+    } else if (arg == "--max-growth-kb" && has_value) {
+      max_growth_kb = atof(argv[++i]);
+    } else if (arg == "--synthetic" && has_value) {
+      synthetic = atoi(argv[++i]);
+    } else if (arg == "--workers" && has_value) {
+      workers = atoi(argv[++i]);
+    } else if (arg == "--vehicles" && has_value) {
+      vehicles = atoi(argv[++i]);
+    } else if (arg == "--window-ms" && has_value) {
+      window_ms = atof(argv[++i]);
+    } else if (arg == "--config" && has_value) {
+      if (!LoadConfig(argv[++i], &config)) {
+        cerr << "Failed to load config " << argv[i] << endl;
+        return -1;
+      }
+    } else if (arg == "--track" && has_value) {
+      track_path = argv[++i];
+    } else {
+      logs.push_back(arg);
+    }
+  }
+  if (warmup >= passes) {
+    cerr << "--passes must be larger than --warmup" << endl;
+    return -1;
+  }
+  if (vehicles < 1) {
+    cerr << "--vehicles must be at least 1" << endl;
+    return -1;
+  }
+
+  Track track;
+  if (!LoadTrack(track_path, &track)) {
+    cerr << "Failed to load track " << track_path << endl;
+    return -1;
+  }
+  // as the server gets them
+  vector<string> messages;
+  for (const auto &t : TelemetryCorpus(track, logs, synthetic)) {
+    messages.push_back(TelemetryMessage(t));
+  }
+
+  string archive_path = "/tmp/mpc_soak_" + to_string(getpid()) + ".mpca";
+  // a pointer, to close the file before it is removed; small chunks so
+  // its buffer is at full size within the first pass
+  ArchiveWriter *archive = new ArchiveWriter(archive_path, 256);
+  MPC mpc(config);
+  ObstacleField field;
+  SendPolicy policy;
+  // the batch path: the scheduler, the vehicles' state and the outbox
+  std::unique_ptr<BatchScheduler> scheduler;
+  vector<std::shared_ptr<ObstacleField>> fields;
+  vector<std::shared_ptr<PlanFeedback>> feedback;
+  Outbox outbox;
+  if (workers > 0) {
+    scheduler.reset(new BatchScheduler(workers, window_ms, config));
+    for (int v = 0; v < vehicles; v++) {
+      fields.push_back(std::make_shared<ObstacleField>());
+      feedback.push_back(std::make_shared<PlanFeedback>());
+    }
+    printf("batching: %d workers, %d vehicles, window %.1f ms\n", workers,
+           vehicles, window_ms);
+  }
+
+  printf("%zu messages per pass\n", messages.size());
+  printf("%6s %10s %12s %12s %9s %10s %10s %10s\n", "pass", "rss_kb",
+         "cppad_kb", "cppad_pool", "tape_kb", "field_kb", "archive_kb",
+         "outbox_kb");
+  double base_rss = 0.0;
+  double base_cppad = 0.0;
+  double rss_growth = 0.0;
+  double cppad_growth = 0.0;
+  for (int pass = 0; pass < passes; pass++) {
+    size_t submitted = 0;
+    size_t sent = 0;
+    for (const auto &msg : messages) {
+      json j = json::parse(hasData(msg));
+      Telemetry telemetry;
+      if (!TelemetryFromJson(j[1], &telemetry)) {
+        continue;
+      }
+      if (!scheduler) {
+        Send(&policy, archive, telemetry, Drive(mpc, telemetry, &field));
+        continue;
+      }
+      Outbox *out = &outbox;
+      size_t v = submitted % vehicles;
+      scheduler->Submit(telemetry, [out, telemetry](const Steer &steer) {
+        std::lock_guard<std::mutex> lock(out->mutex);
+        out->replies.push_back({telemetry, steer});
+      }, fields[v], feedback[v]);
+      submitted++;
+      // wait for the tick of every vehicle before the next one
+      if (submitted % vehicles == 0) {
+        while (sent < submitted) {
+          sent += FlushOutbox(&outbox, &policy, archive);
+          std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+      }
+    }
+    while (sent < submitted) {
+      sent += FlushOutbox(&outbox, &policy, archive);
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    size_t tape = mpc.Memory().tape;
+    size_t field_bytes = field.Bytes();
+    size_t outbox_bytes = 0;
+    if (scheduler) {
+      for (const auto &memory : scheduler->Memory()) {
+        tape = std::max(tape, memory.tape);
+      }
+      for (const auto &f : fields) {
+        field_bytes += f->Bytes();
+      }
+      std::lock_guard<std::mutex> lock(outbox.mutex);
+      outbox_bytes = outbox.replies.capacity() * sizeof(Queued);
+    }
+    double rss = ResidentBytes() / 1024.0;
+    double cppad = CppADInUseBytes() / 1024.0;
+    printf("%6d %10.0f %12.1f %12.1f %9.1f %10.1f %10.1f %10.1f\n", pass,
+           rss, cppad, CppADAvailableBytes() / 1024.0, tape / 1024.0,
+           field_bytes / 1024.0, archive->BufferBytes() / 1024.0,
+           outbox_bytes / 1024.0);
+    if (pass == warmup) {
+      base_rss = rss;
+      base_cppad = cppad;
+    } else if (pass > warmup) {
+      rss_growth = rss - base_rss;
+      cppad_growth = cppad - base_cppad;
+    }
+  }
+  // the workers are done with the outbox and the vehicles' state
+  scheduler.reset();
+  delete archive;
+  unlink(archive_path.c_str());
+
+  printf("growth after warmup: rss %.0f kB, cppad %.1f kB (limit %.0f kB)\n",
+         rss_growth, cppad_growth, max_growth_kb);
+  bool ok = rss_growth <= max_growth_kb && cppad_growth <= max_growth_kb;
+  if (!ok) {
+    printf("memory grew\n");
+  }
+  return ok ? 0 : 1;
+}
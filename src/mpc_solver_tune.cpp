@@ -0,0 +1,205 @@
+#include <math.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "MPC.h"
+#include "config.h"
+#include "controller.h"
+#include "farm.h"
+#include "json.hpp"
+#include "scenario.h"
+#include "stats.h"
+#include "track.h"
+
+// for convenience
+using json = nlohmann::json;
+
+/*
+Offline Ipopt option autotuner.
+
+Every combination of the options below is tried on a telemetry corpus
+(recorded logs plus random cars around the track), one candidate per farm
+worker. A candidate qualifies if its first actuation (delta, a) stays
+within tolerance of a tightly converged reference solve on every message;
+of those the one with the lowest p99 + mean solve time wins and is
+written as the ipopt_options of a config file for `./mpc --config`.
+
+  mpc_solver_tune [-j workers] [--synthetic n] [--linear-solvers mumps,ma27]
+                  [--delta-tol rad] [--a-tol a] [--config base.json]
+                  [--out solver_config.json] [log ...]
+
+Solve times are measured with all workers busy, so compare candidates with
+each other rather than with a quiet box.
+*/
+
+// the reference: converge much further than the controller ever needs
+const std::string kReferenceOptions =
+    "Numeric tol 1e-10\n"
+    "Integer max_iter 3000\n"
+    "Numeric max_cpu_time 10.0\n";
+
+std::vector<std::string> Split(const std::string &s, char sep) {
+  std::vector<std::string> parts;
+  std::stringstream in(s);
+  std::string part;
+  while (std::getline(in, part, sep)) {
+    parts.push_back(part);
+  }
+  return parts;
+}
+
+// The searched option space, as CppAD::ipopt::solve option lines. Every
+// solve starts cold with no multipliers to pass in, so Ipopt's
+// warm_start_init_point isn't searched: CppAD's get_starting_point
+// asserts it off.
+std::vector<std::string> OptionSpace(const std::vector<std::string> &solvers) {
+  const char *tols[] = {"1e-8", "1e-6", "1e-4"};
+  const char *mu_strategies[] = {"monotone", "adaptive"};
+  const char *hessians[] = {"exact", "limited-memory"};
+  const char *mu_inits[] = {"0.1", "0.01"};
+
+  std::vector<std::string> space;
+  for (auto tol : tols)
+    for (auto mu : mu_strategies)
+      for (auto hessian : hessians)
+        for (auto &solver : solvers)
+          for (auto mu_init : mu_inits) {
+            std::string o;
+            o += std::string("Numeric tol ") + tol + "\n";
+            o += std::string("Numeric acceptable_tol ") + tol + "\n";
+            o += std::string("String mu_strategy ") + mu + "\n";
+            o += std::string("Numeric mu_init ") + mu_init + "\n";
+            o += std::string("String hessian_approximation ") + hessian + "\n";
+            o += "String linear_solver " + solver + "\n";
+            space.push_back(o);
+          }
+  return space;
+}
+
+int main(int argc, char *argv[]) {
+  FarmOptions opts;
+  opts.workers = sysconf(_SC_NPROCESSORS_ONLN);
+  opts.timeout = 1800.0;
+  opts.verbose = false;
+  int synthetic = 200;
+  double delta_tol = 0.005;
+  double a_tol = 0.01;
+  std::vector<std::string> solvers = {"mumps"};
+  std::string track_path = "../lake_track_waypoints.csv";
+  std::string out_path = "solver_config.json";
+  MPCConfig base;
+  std::vector<std::string> logs;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "-j" && has_value) {
+      opts.workers = atoi(argv[++i]);
+    } else if (arg == "--synthetic" && has_value) {
+      synthetic = atoi(argv[++i]);
+    } else if (arg == "--linear-solvers" && has_value) {
+      solvers = Split(argv[++i], ',');
+    } else if (arg == "--delta-tol" && has_value) {
+      delta_tol = atof(argv[++i]);
+    } else if (arg == "--a-tol" && has_value) {
+      a_tol = atof(argv[++i]);
+    } else if (arg == "--track" && has_value) {
+      track_path = argv[++i];
+    } else if (arg == "--config" && has_value) {
+      if (!LoadConfig(argv[++i], &base)) {
+        std::cerr << "Failed to load config " << argv[i] << std::endl;
+        return -1;
+      }
+    } else if (arg == "--out" && has_value) {
+      out_path = argv[++i];
+    } else {
+      logs.push_back(arg);
+    }
+  }
+
+  Track track;
+  if (!LoadTrack(track_path, &track)) {
+    std::cerr << "Failed to load track " << track_path << std::endl;
+    return -1;
+  }
+  std::vector<Telemetry> corpus = TelemetryCorpus(track, logs, synthetic);
+  std::cout << corpus.size() << " telemetry messages" << std::endl;
+
+  // reference actuations
+  MPCConfig reference_config = base;
+  reference_config.ipopt_options += kReferenceOptions;
+  std::vector<Steer> reference(corpus.size());
+  {
+    MPC mpc(reference_config);
+    for (size_t i = 0; i < corpus.size(); i++) {
+      reference[i] = Drive(mpc, corpus[i]);
+    }
+  }
+
+  std::vector<std::string> space = OptionSpace(solvers);
+  std::vector<std::string> shards;
+  for (size_t k = 0; k < space.size(); k++) {
+    shards.push_back(std::to_string(k));
+  }
+  std::cout << space.size() << " option sets on " << opts.workers
+            << " workers" << std::endl;
+
+  std::vector<json> results = RunFarm(shards, opts, [&](const std::string &shard) {
+    MPCConfig config = base;
+    config.ipopt_options += space[atoi(shard.c_str())];
+    MPC mpc(config);
+    std::vector<double> solve_ms;
+    double delta_err = 0.0;
+    double a_err = 0.0;
+    for (size_t i = 0; i < corpus.size(); i++) {
+      auto start = std::chrono::steady_clock::now();
+      Steer steer = Drive(mpc, corpus[i]);
+      solve_ms.push_back(MsSince(start));
+      delta_err = std::max(delta_err, fabs(steer.steering_angle - reference[i].steering_angle));
+      a_err = std::max(a_err, fabs(steer.throttle - reference[i].throttle));
+    }
+    return json({{"ok", true},
+                 {"mean_ms", Mean(solve_ms)},
+                 {"p99_ms", Percentile(solve_ms, 99)},
+                 {"delta_err", delta_err},
+                 {"a_err", a_err}});
+  });
+
+  int winner = -1;
+  double winner_score = 0.0;
+  printf("%4s %9s %9s %10s %10s  %s\n", "set", "mean_ms", "p99_ms",
+         "delta_err", "a_err", "within tolerance");
+  for (size_t k = 0; k < results.size(); k++) {
+    json &r = results[k];
+    if (!r.value("ok", false)) {
+      printf("%4zu failed: %s\n", k, r.value("error", std::string("?")).c_str());
+      continue;
+    }
+    bool within = r["delta_err"].get<double>() <= delta_tol &&
+                  r["a_err"].get<double>() <= a_tol;
+    double score = r["p99_ms"].get<double>() + r["mean_ms"].get<double>();
+    printf("%4zu %9.2f %9.2f %10.5f %10.5f  %s\n", k,
+           r["mean_ms"].get<double>(), r["p99_ms"].get<double>(),
+           r["delta_err"].get<double>(), r["a_err"].get<double>(),
+           within ? "yes" : "no");
+    if (within && (winner < 0 || score < winner_score)) {
+      winner = k;
+      winner_score = score;
+    }
+  }
+
+  if (winner < 0) {
+    std::cerr << "No option set stays within tolerance" << std::endl;
+    return 1;
+  }
+  MPCConfig tuned = base;
+  tuned.ipopt_options += space[winner];
+  SaveConfig(out_path, tuned);
+  std::cout << "winner: set " << winner << " -> " << out_path << std::endl
+            << space[winner];
+  return 0;
+}
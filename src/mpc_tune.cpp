@@ -0,0 +1,250 @@
+#include <math.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/Eigenvalues"
+#include "MPC.h"
+#include "config.h"
+#include "farm.h"
+#include "json.hpp"
+#include "scenario.h"
+#include "track.h"
+
+// for convenience
+using json = nlohmann::json;
+
+/*
+Offline tuner for the cost weights and reference velocity.
+
+CMA-ES searches the log of the seven weights and of ref_v. Every candidate
+drives full closed-loop laps of the headless simulator on the lake track;
+the candidates of a generation run in parallel on all cores (farm.h).
+The objective to minimize is
+
+  sum over laps of lap_time (or a penalty for the part not driven)
+  + w_cte * worst max_cte + w_p99 * worst solve p99 in ms
+
+and the best config found is written as a file for `./mpc --config`.
+
+  mpc_tune [-j workers] [--generations n] [--w-cte w] [--w-p99 w]
+           [--track path] [--config start.json] [--out tuned_config.json]
+*/
+
+// penalty for a lap that was not finished, per unit of lap not driven
+const double kLapPenalty = 1000.0;
+
+const int n_dims = 8;
+
+// the smallest weight searched: a weight of 0 in the start config has no
+// log, and CMA-ES can't recover from a mean of -inf
+const double kMinWeight = 1e-6;
+
+double LogWeight(double w) { return log(std::max(w, kMinWeight)); }
+
+Eigen::VectorXd ToVector(const MPCConfig &c) {
+  Eigen::VectorXd x(n_dims);
+  x << LogWeight(c.weight_cet), LogWeight(c.weight_epsi),
+      LogWeight(c.weight_constant_vel), LogWeight(c.weight_delta),
+      LogWeight(c.weight_a), LogWeight(c.weight_delta_diff),
+      LogWeight(c.weight_a_diff), LogWeight(c.ref_v);
+  return x;
+}
+
+MPCConfig FromVector(const Eigen::VectorXd &x, MPCConfig c) {
+  c.weight_cet = exp(x[0]);
+  c.weight_epsi = exp(x[1]);
+  c.weight_constant_vel = exp(x[2]);
+  c.weight_delta = exp(x[3]);
+  c.weight_a = exp(x[4]);
+  c.weight_delta_diff = exp(x[5]);
+  c.weight_a_diff = exp(x[6]);
+  // keep the reference speed in what the simulator can do
+  c.ref_v = std::min(std::max(exp(x[7]), 10.0), 120.0);
+  return c;
+}
+
+// Runs in a farm worker: drive the laps with this config.
+json Evaluate(const MPCConfig &config, const Track &track, double w_cte,
+              double w_p99) {
+  const vector<string> laps = {"lap:0:0", "lap:" + to_string(track.x.size() / 2) + ":40"};
+  MPC mpc(config);
+  double cost = 0.0;
+  double worst_cte = 0.0;
+  double worst_p99 = 0.0;
+  double lap_time = 0.0;
+  for (const auto &lap : laps) {
+    json r = RunScenario(mpc, lap, track);
+    if (r["completed"].get<bool>()) {
+      cost += r["lap_time"].get<double>();
+      lap_time += r["lap_time"].get<double>();
+    } else {
+      cost += kLapPenalty * (1.0 - r["progress"].get<double>());
+    }
+    worst_cte = std::max(worst_cte, r["max_cte"].get<double>());
+    worst_p99 = std::max(worst_p99, r["solve_p99_ms"].get<double>());
+  }
+  cost += w_cte * worst_cte + w_p99 * worst_p99;
+  return {{"cost", cost}, {"lap_time", lap_time}, {"max_cte", worst_cte},
+          {"solve_p99_ms", worst_p99}};
+}
+
+int main(int argc, char *argv[]) {
+  FarmOptions opts;
+  opts.workers = sysconf(_SC_NPROCESSORS_ONLN);
+  opts.timeout = 600.0;
+  opts.verbose = false;
+  int generations = 30;
+  double w_cte = 20.0;
+  double w_p99 = 0.5;
+  string track_path = "../lake_track_waypoints.csv";
+  string out_path = "tuned_config.json";
+  MPCConfig start;
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    string arg = argv[i];
+    if (arg == "-j") {
+      opts.workers = atoi(argv[i + 1]);
+    } else if (arg == "--generations") {
+      generations = atoi(argv[i + 1]);
+    } else if (arg == "--w-cte") {
+      w_cte = atof(argv[i + 1]);
+    } else if (arg == "--w-p99") {
+      w_p99 = atof(argv[i + 1]);
+    } else if (arg == "--track") {
+      track_path = argv[i + 1];
+    } else if (arg == "--config") {
+      if (!LoadConfig(argv[i + 1], &start)) {
+        cerr << "Failed to load config " << argv[i + 1] << endl;
+        return -1;
+      }
+    } else if (arg == "--out") {
+      out_path = argv[i + 1];
+    }
+  }
+
+  Track track;
+  if (!LoadTrack(track_path, &track)) {
+    cerr << "Failed to load track " << track_path << endl;
+    return -1;
+  }
+
+  //
+  // CMA-ES, following Hansen's "The CMA Evolution Strategy: A Tutorial".
+  //
+  const int n = n_dims;
+  const int lambda = std::max(4 + int(3 * log(n)), opts.workers);
+  const int mu = lambda / 2;
+  Eigen::VectorXd weights(mu);
+  for (int i = 0; i < mu; i++) {
+    weights[i] = log(mu + 0.5) - log(i + 1.0);
+  }
+  weights /= weights.sum();
+  const double mueff = 1.0 / weights.squaredNorm();
+  const double cc = (4.0 + mueff / n) / (n + 4.0 + 2.0 * mueff / n);
+  const double cs = (mueff + 2.0) / (n + mueff + 5.0);
+  const double c1 = 2.0 / ((n + 1.3) * (n + 1.3) + mueff);
+  const double cmu = std::min(1.0 - c1, 2.0 * (mueff - 2.0 + 1.0 / mueff) /
+                                            ((n + 2.0) * (n + 2.0) + mueff));
+  const double damps = 1.0 + 2.0 * std::max(0.0, sqrt((mueff - 1.0) / (n + 1.0)) - 1.0) + cs;
+  const double chiN = sqrt(n) * (1.0 - 1.0 / (4.0 * n) + 1.0 / (21.0 * n * n));
+
+  Eigen::VectorXd mean = ToVector(start);
+  double sigma = 0.5;
+  Eigen::MatrixXd C = Eigen::MatrixXd::Identity(n, n);
+  Eigen::VectorXd pc = Eigen::VectorXd::Zero(n);
+  Eigen::VectorXd ps = Eigen::VectorXd::Zero(n);
+  std::mt19937 rng(1);
+  std::normal_distribution<double> normal(0.0, 1.0);
+
+  // the starting point is the baseline to beat
+  MPCConfig best = start;
+  json best_result = RunFarm({"start"}, opts, [&](const string &) {
+    return Evaluate(start, track, w_cte, w_p99);
+  })[0];
+  double best_cost = best_result.value("cost", 1e9);
+  printf("start: cost %.2f lap_time %.2f max_cte %.2f p99 %.2f ms\n",
+         best_cost, best_result.value("lap_time", 0.0),
+         best_result.value("max_cte", 0.0),
+         best_result.value("solve_p99_ms", 0.0));
+
+  for (int g = 1; g <= generations; g++) {
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eigen(C);
+    Eigen::MatrixXd B = eigen.eigenvectors();
+    Eigen::VectorXd D = eigen.eigenvalues().cwiseMax(1e-20).cwiseSqrt();
+
+    vector<Eigen::VectorXd> ys(lambda);
+    vector<MPCConfig> candidates(lambda);
+    vector<string> shards(lambda);
+    for (int k = 0; k < lambda; k++) {
+      Eigen::VectorXd z(n);
+      for (int i = 0; i < n; i++) {
+        z[i] = normal(rng);
+      }
+      ys[k] = B * D.asDiagonal() * z;
+      candidates[k] = FromVector(mean + sigma * ys[k], start);
+      shards[k] = to_string(k);
+    }
+
+    vector<json> results = RunFarm(shards, opts, [&](const string &shard) {
+      return Evaluate(candidates[atoi(shard.c_str())], track, w_cte, w_p99);
+    });
+
+    vector<int> order(lambda);
+    vector<double> costs(lambda);
+    for (int k = 0; k < lambda; k++) {
+      order[k] = k;
+      // a crashed candidate is as bad as it gets
+      costs[k] = results[k].value("cost", 1e9);
+    }
+    std::sort(order.begin(), order.end(),
+              [&costs](int a, int b) { return costs[a] < costs[b]; });
+
+    if (costs[order[0]] < best_cost) {
+      best_cost = costs[order[0]];
+      best = candidates[order[0]];
+      best_result = results[order[0]];
+      SaveConfig(out_path, best);
+    }
+    printf("generation %d: best %.2f, this generation %.2f, sigma %.3f\n", g,
+           best_cost, costs[order[0]], sigma);
+
+    // move the mean towards the best mu candidates
+    Eigen::VectorXd y_w = Eigen::VectorXd::Zero(n);
+    for (int i = 0; i < mu; i++) {
+      y_w += weights[i] * ys[order[i]];
+    }
+    mean += sigma * y_w;
+
+    // cumulation of the evolution paths
+    Eigen::MatrixXd C_invsqrt = B * D.cwiseInverse().asDiagonal() * B.transpose();
+    ps = (1.0 - cs) * ps + sqrt(cs * (2.0 - cs) * mueff) * C_invsqrt * y_w;
+    bool hsig = ps.norm() / sqrt(1.0 - pow(1.0 - cs, 2.0 * g)) / chiN <
+                1.4 + 2.0 / (n + 1.0);
+    pc = (1.0 - cc) * pc + (hsig ? sqrt(cc * (2.0 - cc) * mueff) : 0.0) * y_w;
+
+    // rank-one and rank-mu update of the covariance
+    Eigen::MatrixXd rank_mu = Eigen::MatrixXd::Zero(n, n);
+    for (int i = 0; i < mu; i++) {
+      rank_mu += weights[i] * ys[order[i]] * ys[order[i]].transpose();
+    }
+    C = (1.0 - c1 - cmu) * C +
+        c1 * (pc * pc.transpose() + (hsig ? 0.0 : cc * (2.0 - cc)) * C) +
+        cmu * rank_mu;
+
+    sigma *= exp(cs / damps * (ps.norm() / chiN - 1.0));
+  }
+
+  SaveConfig(out_path, best);
+  printf("best: cost %.2f lap_time %.2f max_cte %.2f p99 %.2f ms -> %s\n",
+         best_cost, best_result.value("lap_time", 0.0),
+         best_result.value("max_cte", 0.0),
+         best_result.value("solve_p99_ms", 0.0), out_path.c_str());
+  cout << ConfigToJson(best) << endl;
+  return 0;
+}
@@ -0,0 +1,124 @@
+#include "obstacles.h"
+#include <math.h>
+
+// Distance from (x, y) to the segment from (x0, y0) to (x1, y1).
+static double SegmentDistance(double x, double y, double x0, double y0,
+                              double x1, double y1) {
+  double dx = x1 - x0;
+  double dy = y1 - y0;
+  double len2 = dx * dx + dy * dy;
+  double s = len2 > 0.0 ? ((x - x0) * dx + (y - y0) * dy) / len2 : 0.0;
+  if (s < 0.0) s = 0.0;
+  if (s > 1.0) s = 1.0;
+  return hypot(x - (x0 + s * dx), y - (y0 + s * dy));
+}
+
+// BVIntersect query: collects the obstacles within `reach` of a polyline.
+// A single point is a polyline too.
+struct EnvelopeQuery {
+  const vector<Obstacle> &obstacles;
+  const vector<double> &xs;
+  const vector<double> &ys;
+  double reach;
+  // bounding boxes of the segments, grown by `reach`
+  vector<Eigen::AlignedBox2d> segments;
+  vector<int> hits;
+
+  EnvelopeQuery(const vector<Obstacle> &obstacles, const vector<double> &xs,
+                const vector<double> &ys, double reach)
+      : obstacles(obstacles), xs(xs), ys(ys), reach(reach) {
+    for (size_t i = 0; i < xs.size(); i++) {
+      size_t j = i + 1 < xs.size() ? i + 1 : i;
+      Eigen::AlignedBox2d box(Eigen::Vector2d(xs[i], ys[i]));
+      box.extend(Eigen::Vector2d(xs[j], ys[j]));
+      box.min().array() -= reach;
+      box.max().array() += reach;
+      segments.push_back(box);
+    }
+  }
+
+  bool intersectVolume(const Eigen::AlignedBox2d &volume) {
+    for (const auto &segment : segments) {
+      if (volume.intersects(segment)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool intersectObject(const int &i) {
+    const Obstacle &o = obstacles[i];
+    for (size_t k = 0; k < xs.size(); k++) {
+      size_t j = k + 1 < xs.size() ? k + 1 : k;
+      if (SegmentDistance(o.x, o.y, xs[k], ys[k], xs[j], ys[j]) <=
+          reach + o.radius) {
+        hits.push_back(i);
+        break;
+      }
+    }
+    // keep searching
+    return false;
+  }
+};
+
+void ObstacleField::SetObstacles(const vector<Obstacle> &next) {
+  std::lock_guard<std::mutex> lock(mutex);
+  bool same = next.size() == obstacles.size();
+  for (size_t i = 0; same && i < next.size(); i++) {
+    same = next[i].x == obstacles[i].x && next[i].y == obstacles[i].y &&
+           next[i].radius == obstacles[i].radius;
+  }
+  if (same) {
+    return;
+  }
+  obstacles = next;
+  vector<int> indices(obstacles.size());
+  vector<Eigen::AlignedBox2d> boxes(obstacles.size());
+  for (size_t i = 0; i < obstacles.size(); i++) {
+    const Obstacle &o = obstacles[i];
+    indices[i] = i;
+    boxes[i] = Eigen::AlignedBox2d(Eigen::Vector2d(o.x - o.radius, o.y - o.radius),
+                                   Eigen::Vector2d(o.x + o.radius, o.y + o.radius));
+  }
+  tree.init(indices.begin(), indices.end(), boxes.begin(), boxes.end());
+}
+
+void ObstacleField::SetPlan(const vector<double> &x, const vector<double> &y) {
+  std::lock_guard<std::mutex> lock(mutex);
+  plan_x = x;
+  plan_y = y;
+}
+
+vector<Obstacle> ObstacleField::Nearby(double x, double y, double fallback,
+                                       double reach) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  vector<Obstacle> nearby;
+  if (obstacles.empty()) {
+    return nearby;
+  }
+  // from where the car is now along the previous plan
+  vector<double> xs(1, x);
+  vector<double> ys(1, y);
+  xs.insert(xs.end(), plan_x.begin(), plan_x.end());
+  ys.insert(ys.end(), plan_y.begin(), plan_y.end());
+  if (plan_x.empty()) {
+    reach += fallback;
+  }
+  EnvelopeQuery query(obstacles, xs, ys, reach);
+  Eigen::BVIntersect(tree, query);
+  for (int i : query.hits) {
+    nearby.push_back(obstacles[i]);
+  }
+  return nearby;
+}
+
+size_t ObstacleField::Bytes() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  // The tree keeps an object per obstacle and a box and two children per
+  // node, about two nodes per obstacle.
+  size_t n = obstacles.size();
+  return sizeof(*this) + obstacles.capacity() * sizeof(Obstacle) +
+         n * sizeof(int) +
+         2 * n * (sizeof(Eigen::AlignedBox2d) + 2 * sizeof(int)) +
+         (plan_x.capacity() + plan_y.capacity()) * sizeof(double);
+}
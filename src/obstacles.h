@@ -0,0 +1,50 @@
+#ifndef OBSTACLES_H
+#define OBSTACLES_H
+
+#include <mutex>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/Geometry"
+#include "Eigen-3.3/unsupported/Eigen/BVH"
+#include "wire.h"
+
+/*
+Static obstacles around one vehicle.
+
+The MPC gets one distance constraint per obstacle and stage, so only the
+obstacles the car may actually get close to are passed on: those within
+`reach` of the swept envelope of the plan solved last tick, or of a disk
+around the car while there is no plan yet. The obstacles live in a KdBVH,
+so culling walks the tree once per plan segment instead of testing every
+obstacle, and the problem size follows the nearby obstacles, not the
+total count.
+
+Keep one per vehicle. It may be used from several threads.
+*/
+class ObstacleField {
+ public:
+  // Obstacles in map coordinates, the tree is only rebuilt when they change.
+  void SetObstacles(const vector<Obstacle> &obstacles);
+
+  // The plan from the last solve, in map coordinates.
+  void SetPlan(const vector<double> &x, const vector<double> &y);
+
+  // Obstacles whose disk comes within `reach` of the path from the car at
+  // (x, y) along the previous plan, or within `fallback` + `reach` of the
+  // car if there is no plan.
+  vector<Obstacle> Nearby(double x, double y, double fallback,
+                          double reach) const;
+
+  // Memory held, bytes.
+  size_t Bytes() const;
+
+ private:
+  mutable std::mutex mutex;
+  vector<Obstacle> obstacles;
+  // indices into `obstacles`, with their bounding boxes
+  Eigen::KdBVH<double, 2, int> tree;
+  vector<double> plan_x;
+  vector<double> plan_y;
+};
+
+#endif /* OBSTACLES_H */
@@ -0,0 +1,137 @@
+#include "planner.h"
+#include <math.h>
+#include "controller.h"
+#include "scheduler.h"
+
+TwoRateController::TwoRateController(const MPCConfig &config,
+                                     const TwoRateOptions &opts)
+    : opts(opts),
+      planner(PlannerConfig(config)),
+      tracker(TrackerConfig(config)),
+      has_plan(false),
+      stop(false) {
+  // the caller's thread is CppAD thread 0, the planner 1
+  SetupCppADThreads(2);
+  thread = std::thread(&TwoRateController::PlanLoop, this);
+}
+
+TwoRateController::~TwoRateController() {
+  stop = true;
+  thread.join();
+}
+
+MPCConfig TwoRateController::PlannerConfig(const MPCConfig &config) const {
+  MPCConfig c = config;
+  c.N = opts.plan_N;
+  c.dt = opts.plan_dt;
+  return c;
+}
+
+MPCConfig TwoRateController::TrackerConfig(const MPCConfig &config) const {
+  MPCConfig c = config;
+  c.N = opts.track_N;
+  c.dt = opts.track_dt;
+  return c;
+}
+
+void TwoRateController::SetConfig(const MPCConfig &config) {
+  planner.SetConfig(PlannerConfig(config));
+  tracker.SetConfig(TrackerConfig(config));
+}
+
+void TwoRateController::PlanLoop() {
+  SetCppADThread(1);
+  auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(1.0 / opts.plan_hz));
+  auto next = std::chrono::steady_clock::now();
+  while (!stop) {
+    if (latest.Update()) {
+      const TimedTelemetry &in = latest.Front();
+      // the planner has no obstacles, the in-tree solvers leave Ipopt
+      // free for the tracker
+      std::unique_lock<std::mutex> lock(ipopt, std::defer_lock);
+      if (planner.Config().solver == "ipopt") {
+        lock.lock();
+      }
+      Steer steer = ::Drive(planner, in.telemetry);
+      if (lock.owns_lock()) {
+        lock.unlock();
+      }
+
+      // the predicted path back to map coordinates
+      const Telemetry &t = in.telemetry;
+      Plan &plan = plans.Back();
+      plan.made = in.time;
+      plan.dt = opts.plan_dt;
+      plan.latency = planner.Config().latency_dt;
+      plan.x.clear();
+      plan.y.clear();
+      plan.v.clear();
+      for (size_t i = 0; i < steer.mpc_x.size(); i++) {
+        plan.x.push_back(t.x + cos(t.psi) * steer.mpc_x[i] - sin(t.psi) * steer.mpc_y[i]);
+        plan.y.push_back(t.y + sin(t.psi) * steer.mpc_x[i] + cos(t.psi) * steer.mpc_y[i]);
+      }
+      // the model moves v * dt per step
+      for (size_t i = 1; i < plan.x.size(); i++) {
+        plan.v.push_back(hypot(plan.x[i] - plan.x[i - 1],
+                               plan.y[i] - plan.y[i - 1]) / plan.dt);
+      }
+      plan.v.insert(plan.v.begin(), plan.v.empty() ? t.speed : plan.v[0]);
+      plans.Publish();
+    }
+
+    next += period;
+    auto now = std::chrono::steady_clock::now();
+    if (next < now) {
+      // a slow solve, start over from now rather than catch up
+      next = now;
+    }
+    std::this_thread::sleep_until(next);
+  }
+}
+
+Steer TwoRateController::Drive(const Telemetry &t, ObstacleField *field) {
+  auto now = std::chrono::steady_clock::now();
+  TimedTelemetry &out = latest.Back();
+  out.telemetry = t;
+  out.time = now;
+  latest.Publish();
+  // any solve of the tracker may be Ipopt's (ticks with obstacles are),
+  // see the header
+  std::lock_guard<std::mutex> lock(ipopt);
+
+  if (plans.Update()) {
+    has_plan = true;
+  }
+  // until the first plan, track the waypoints
+  if (!has_plan) {
+    return ::Drive(tracker, t, field);
+  }
+
+  // the plan points from just behind the car to past the short horizon
+  const Plan &plan = plans.Front();
+  const MPCConfig config = tracker.Config();
+  double elapsed = std::chrono::duration<double>(now - plan.made).count();
+  double horizon = config.N * config.dt;
+  int n = plan.x.size();
+  int first = static_cast<int>((elapsed - plan.latency) / plan.dt) - 1;
+  int last = static_cast<int>(ceil((elapsed - plan.latency + horizon) / plan.dt)) + 2;
+  if (first < 0) first = 0;
+  if (last < first + 4) last = first + 4;
+  if (last > n) last = n;
+  if (last - first < 4) {
+    // the plan has run out, the planner is lagging behind
+    return ::Drive(tracker, t, field);
+  }
+
+  Telemetry tracking = t;
+  tracking.ptsx.assign(plan.x.begin() + first, plan.x.begin() + last);
+  tracking.ptsy.assign(plan.y.begin() + first, plan.y.begin() + last);
+
+  // the planned speed at the end of the short horizon, for this solve
+  // only: the tracker's config stays as set
+  int at = static_cast<int>((elapsed - plan.latency + horizon) / plan.dt);
+  if (at < 0) at = 0;
+  if (at > n - 1) at = n - 1;
+  return ::Drive(tracker, tracking, field, nullptr, plan.v[at]);
+}
@@ -0,0 +1,124 @@
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "MPC.h"
+#include "obstacles.h"
+#include "wire.h"
+
+/*
+Two-rate control.
+
+A slow planner thread solves a long horizon (several seconds at a coarse
+dt) a couple of times per second and turns the predicted path into a plan:
+positions in map coordinates and the speed along them. Every tick, a fast
+MPC with a short horizon tracks the part of the newest plan just ahead of
+the car: the plan replaces the waypoints the reference polynomial is fit
+to, and the plan's speed at the end of the short horizon becomes the ref_v of
+that solve.
+
+Telemetry goes to the planner and plans come back through a SwapBuffer
+each. Ipopt with the default linear solver (MUMPS) is not thread-safe, so
+the two levels take turns in Ipopt: with the "ipopt" solver the tracker
+waits for a planner solve that is under way. With "riccati" or
+"riccati_mixed" the planner never calls Ipopt and the two threads never
+wait for each other.
+*/
+
+// Lock-free hand-over of the newest value from one writer thread to one
+// reader thread. A double buffer (the writer fills the back slot, the
+// reader keeps the front one) plus a third slot in the middle, swapped
+// atomically, so the writer can publish again while the reader still
+// holds the previous value.
+template <class T>
+class SwapBuffer {
+ public:
+  SwapBuffer() : front(0), middle(1), back(2) {}
+
+  // Writer: fill Back(), then Publish() it.
+  T &Back() { return slots[back]; }
+  void Publish() { back = middle.exchange(back | kFresh) & kIndex; }
+
+  // Reader: Update() takes the newest published value, if there is one
+  // it hasn't seen, and Front() reads it.
+  bool Update() {
+    if (!(middle.load() & kFresh)) {
+      return false;
+    }
+    front = middle.exchange(front) & kIndex;
+    return true;
+  }
+  const T &Front() const { return slots[front]; }
+
+ private:
+  static const int kIndex = 3;
+  static const int kFresh = 4;
+  T slots[3];
+  int front;
+  std::atomic<int> middle;
+  int back;
+};
+
+// The planner's output.
+struct Plan {
+  // when the telemetry it was solved for came in
+  std::chrono::steady_clock::time_point made;
+  // predicted positions in map coordinates, `dt` apart after the latency
+  vector<double> x;
+  vector<double> y;
+  // and the speed there
+  vector<double> v;
+  double dt = 0.0;
+  double latency = 0.0;
+};
+
+struct TwoRateOptions {
+  // planner: horizon, step and how often it runs
+  size_t plan_N = 30;
+  double plan_dt = 0.2;
+  double plan_hz = 2.0;
+  // tracker
+  size_t track_N = 6;
+  double track_dt = 0.1;
+};
+
+// One vehicle. Drive() runs the tracker on the caller's thread, the
+// planner has its own; CppAD is set up for the two (see scheduler.h).
+class TwoRateController {
+ public:
+  TwoRateController(const MPCConfig &config,
+                    const TwoRateOptions &opts = TwoRateOptions());
+  virtual ~TwoRateController();
+
+  Steer Drive(const Telemetry &t, ObstacleField *field = nullptr);
+
+  // New weights etc. for both levels, horizons stay as in the options.
+  void SetConfig(const MPCConfig &config);
+
+ private:
+  struct TimedTelemetry {
+    Telemetry telemetry;
+    std::chrono::steady_clock::time_point time;
+  };
+
+  void PlanLoop();
+  MPCConfig PlannerConfig(const MPCConfig &config) const;
+  MPCConfig TrackerConfig(const MPCConfig &config) const;
+
+  TwoRateOptions opts;
+  MPC planner;
+  MPC tracker;
+  SwapBuffer<TimedTelemetry> latest;
+  SwapBuffer<Plan> plans;
+  bool has_plan;
+  // held by the planner around an Ipopt solve, and by the tracker
+  std::mutex ipopt;
+  std::atomic<bool> stop;
+  std::thread thread;
+};
+
+#endif /* PLANNER_H */
@@ -0,0 +1,185 @@
+#include "profiler.h"
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+
+// frames kept per sample, and the ones on top that are the handler and
+// the signal trampoline
+const int kMaxDepth = 64;
+const int kSkipFrames = 2;
+
+// What the handler touches; set up before the timer starts and torn down
+// after it stops and the last handler has returned.
+static std::atomic<bool> sampling(false);
+static std::atomic<int> in_handler(0);
+static std::atomic<size_t> next_sample(0);
+static std::atomic<size_t> dropped(0);
+static void **frames = nullptr;
+static int *depths = nullptr;
+static size_t capacity = 0;
+
+// Everything else, under the mutex.
+static std::mutex profile_mutex;
+static bool running = false;
+static int running_hz = 0;
+static std::unique_ptr<void *[]> frame_buffer;
+static std::unique_ptr<int[]> depth_buffer;
+static struct sigaction previous_action;
+
+static void OnSigprof(int, siginfo_t *, void *) {
+  int saved_errno = errno;
+  in_handler++;
+  if (sampling) {
+    size_t i = next_sample.fetch_add(1);
+    if (i < capacity) {
+      depths[i] = backtrace(frames + i * kMaxDepth, kMaxDepth);
+    } else {
+      dropped++;
+    }
+  }
+  in_handler--;
+  errno = saved_errno;
+}
+
+bool StartProfile(int hz, size_t max_samples, std::string *error) {
+  std::lock_guard<std::mutex> lock(profile_mutex);
+  if (running) {
+    *error = "a profile is already running";
+    return false;
+  }
+  // at most 100 MB of frames
+  if (hz < 1 || hz > 10000 || max_samples < 1 || max_samples > 200000) {
+    *error = "need 1 <= hz <= 10000 and 1 <= max_samples <= 200000";
+    return false;
+  }
+  // backtrace() loads the unwinder on its first call, which isn't safe
+  // in a signal handler
+  void *warm[kMaxDepth];
+  backtrace(warm, kMaxDepth);
+
+  frame_buffer.reset(new void *[max_samples * kMaxDepth]);
+  depth_buffer.reset(new int[max_samples]());
+  frames = frame_buffer.get();
+  depths = depth_buffer.get();
+  capacity = max_samples;
+  next_sample = 0;
+  dropped = 0;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = OnSigprof;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, &previous_action) != 0) {
+    *error = strerror(errno);
+    return false;
+  }
+  sampling = true;
+  struct itimerval timer;
+  long period_us = 1000000 / hz;
+  timer.it_interval.tv_sec = period_us / 1000000;
+  timer.it_interval.tv_usec = period_us % 1000000;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    *error = strerror(errno);
+    sampling = false;
+    sigaction(SIGPROF, &previous_action, nullptr);
+    return false;
+  }
+  running = true;
+  running_hz = hz;
+  return true;
+}
+
+// "function", or "[module]" for code without a dynamic symbol.
+static std::string FrameName(void *pc) {
+  Dl_info info;
+  char text[64];
+  if (dladdr(pc, &info) == 0) {
+    snprintf(text, sizeof(text), "%p", pc);
+    return text;
+  }
+  if (info.dli_sname) {
+    int status = 0;
+    char *demangled =
+        abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    std::string name = status == 0 ? demangled : info.dli_sname;
+    free(demangled);
+    // ';' separates the frames of a folded stack
+    for (auto &c : name) {
+      if (c == ';') {
+        c = ':';
+      }
+    }
+    return name;
+  }
+  const char *module = info.dli_fname ? strrchr(info.dli_fname, '/') : nullptr;
+  module = module ? module + 1 : (info.dli_fname ? info.dli_fname : "?");
+  return "[" + std::string(module) + "]";
+}
+
+std::string StopProfile() {
+  std::lock_guard<std::mutex> lock(profile_mutex);
+  if (!running) {
+    return "";
+  }
+  struct itimerval off;
+  memset(&off, 0, sizeof(off));
+  setitimer(ITIMER_PROF, &off, nullptr);
+  sampling = false;
+  // a signal raised just before the timer stopped may still be handled
+  while (in_handler > 0) {
+  }
+  sigaction(SIGPROF, &previous_action, nullptr);
+  running = false;
+
+  // name every address once, then count the stacks by their names, root
+  // first
+  size_t samples = std::min(next_sample.load(), capacity);
+  std::map<void *, std::string> names;
+  std::map<std::string, size_t> stacks;
+  for (size_t i = 0; i < samples; i++) {
+    void **pcs = frames + i * kMaxDepth;
+    std::string stack;
+    for (int f = depths[i] - 1; f >= kSkipFrames; f--) {
+      auto name = names.find(pcs[f]);
+      if (name == names.end()) {
+        name = names.insert(std::make_pair(pcs[f], FrameName(pcs[f]))).first;
+      }
+      if (!stack.empty()) {
+        stack += ';';
+      }
+      stack += name->second;
+    }
+    if (!stack.empty()) {
+      stacks[stack]++;
+    }
+  }
+  std::string folded;
+  for (const auto &s : stacks) {
+    folded += s.first + ' ' + std::to_string(s.second) + '\n';
+  }
+  return folded;
+}
+
+ProfileStatus GetProfileStatus() {
+  std::lock_guard<std::mutex> lock(profile_mutex);
+  ProfileStatus status;
+  status.running = running;
+  status.hz = running_hz;
+  status.samples = std::min(next_sample.load(), capacity);
+  status.dropped = dropped;
+  status.max_samples = capacity;
+  return status;
+}
@@ -0,0 +1,48 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stddef.h>
+#include <string>
+
+/*
+In-process sampling profiler, for hosts where attaching perf isn't
+allowed.
+
+While a profile runs, an ITIMER_PROF timer raises SIGPROF `hz` times per
+second of CPU time the process uses, in whichever thread is running. The
+handler only captures the stack with backtrace() into a slot of a buffer
+allocated when the profile starts, so it takes no locks and allocates
+nothing. Samples past the buffer's capacity are counted and dropped.
+When no profile runs there is no timer and no handler, so there is no
+overhead.
+
+StopProfile() symbolizes the stacks with dladdr() and returns them
+folded, one line per distinct stack with the root first and its count:
+
+  main;uWS::Hub::run;...;MPC::Solve 42
+
+ready for flamegraph.pl or speedscope. Functions the dynamic symbol
+table doesn't name show as module+offset; the server is linked with
+its symbols exported for this.
+
+The server starts and stops profiles over HTTP, see main.cpp.
+*/
+
+// Process wide, one profile at a time. False with `error` set if one is
+// already running or the timer can't be set up.
+bool StartProfile(int hz, size_t max_samples, std::string *error);
+
+// Stops the running profile and returns its folded stacks; "" if none
+// runs.
+std::string StopProfile();
+
+struct ProfileStatus {
+  bool running = false;
+  int hz = 0;
+  size_t samples = 0;
+  size_t dropped = 0;
+  size_t max_samples = 0;
+};
+ProfileStatus GetProfileStatus();
+
+#endif /* PROFILER_H */
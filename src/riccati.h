@@ -0,0 +1,375 @@
+#ifndef RICCATI_H
+#define RICCATI_H
+
+#include <math.h>
+#include <stddef.h>
+#include <vector>
+#include "Eigen-3.3/Eigen/Cholesky"
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/unsupported/Eigen/AutoDiff"
+#include "config.h"
+#include "vehicle_model.h"
+
+/*
+In-tree solver for the MPC problem without obstacles: iterative LQR.
+
+Every iteration linearizes the model along the current trajectory and
+solves the resulting LQ problem exactly with a backward Riccati
+recursion, then rolls the model forward with the new feedback law under
+a line search. The cost is the controller's (see ControllerCost in
+cost.h); all its residuals are linear, so only the model needs
+linearizing, which is done with Eigen's forward mode AutoDiff through
+the same Model::step the Ipopt path tapes. Actuator bounds are enforced
+by clamping in the forward pass.
+
+The state the recursion works on is the model's, then cte and epsi, then
+the previous actuations so the rate terms become stage costs:
+
+  z = (model state..., cte, epsi, previous delta, previous a)
+
+`Scalar` is float or double. The matrices are fixed size, so with float
+Eigen's packet math handles twice the lanes. RiccatiSolve() runs the bulk
+of the iterations in float and finishes with a few in double if asked to
+(see MPCConfig::solver).
+*/
+
+template <class Model, class Scalar>
+class Riccati {
+ public:
+  enum { NZ = Model::n_state + 4, NU = Model::n_input };
+  enum { CTE = Model::n_state, EPSI, PREV_DELTA, PREV_A };
+  typedef Eigen::Matrix<Scalar, NZ, 1> State;
+  typedef Eigen::Matrix<Scalar, NU, 1> Input;
+  typedef Eigen::Matrix<Scalar, NZ, NZ> StateMatrix;
+  typedef Eigen::Matrix<Scalar, NU, NZ> Gain;
+  typedef Eigen::Matrix<Scalar, NU, NU> InputMatrix;
+  // fixed size Eigen types need their alignment in containers
+  typedef std::vector<State, Eigen::aligned_allocator<State>> States;
+  typedef std::vector<Input, Eigen::aligned_allocator<Input>> Inputs;
+  typedef std::vector<Gain, Eigen::aligned_allocator<Gain>> Gains;
+
+  // `terminal` weighs (cte, epsi) at the last stage, see terminal_cost.h;
+  // none if null.
+  Riccati(const MPCConfig &config, const Eigen::VectorXd &coeffs,
+          const Eigen::Matrix2d *terminal = nullptr)
+      : c(config), N(config.N), dt(config.dt), states(N), inputs(N - 1),
+        k(N - 1), K(N - 1) {
+    for (int i = 0; i < 4; i++) {
+      poly[i] = coeffs[i];
+    }
+    has_terminal = terminal != nullptr;
+    P.setZero();
+    if (has_terminal) {
+      P = terminal->template cast<Scalar>();
+    }
+  }
+
+  // z = F(z, u), as the constraints of FG_eval.
+  template <class T>
+  void Dynamics(const T *z, const T *u, T *next) const {
+    T s1[Model::n_state];
+    Model::step(z, u, dt, s1);
+    for (size_t i = 0; i < Model::n_state; i++) {
+      next[i] = s1[i];
+    }
+    ErrorStep<Model>(poly, z, z[EPSI], s1, dt, &next[CTE], &next[EPSI]);
+    next[PREV_DELTA] = u[Model::DELTA];
+    next[PREV_A] = u[Model::A];
+  }
+
+  // Start from z0 with the inputs in `u` (N - 1 of them).
+  void Start(const State &z0, const Inputs &u) {
+    inputs = u;
+    states[0] = z0;
+    cost = Rollout(inputs, &states);
+    mu = 1e-6;
+  }
+
+  // One iteration. False once converged, when the LQ model promises a
+  // decrease of less than `tol` relative to the cost, or stuck. A step
+  // is taken if it achieves a tenth of the promised decrease; if none
+  // does, the next iteration is regularized more.
+  bool Iterate(Scalar tol) {
+    Backward();
+    if (-(expected[0] + expected[1]) < tol * cost) {
+      return false;
+    }
+    States z(N);
+    Inputs u(N - 1);
+    z[0] = states[0];
+    for (Scalar alpha = 1; alpha > 1e-3; alpha /= 2) {
+      Scalar next = Forward(alpha, &z, &u);
+      Scalar promised = -(alpha * expected[0] + alpha * alpha * expected[1]);
+      if (cost - next > Scalar(0.1) * promised) {
+        cost = next;
+        states.swap(z);
+        inputs.swap(u);
+        mu = std::max<Scalar>(mu / 10, 1e-9);
+        return true;
+      }
+    }
+    mu *= 100;
+    return mu < 1e6;
+  }
+
+  // Returns the number of iterations.
+  int Solve(int max_iter, Scalar tol) {
+    int i = 0;
+    while (i < max_iter && Iterate(tol)) {
+      i++;
+    }
+    return i;
+  }
+
+  // The time-varying LQR feedback around the current trajectory, from one
+  // more backward pass: u = u_t + K_t (z - z_t) to first order.
+  const Gains &FeedbackGains() {
+    Backward();
+    return K;
+  }
+
+  const States &StateTrajectory() const { return states; }
+  const Inputs &InputTrajectory() const { return inputs; }
+  Scalar Cost() const { return cost; }
+
+ private:
+  // the actuator bounds of MPCSetup
+  static constexpr Scalar max_delta = 0.436332;
+
+  Input Clamp(Input u) const {
+    u[Model::DELTA] = std::min(std::max(u[Model::DELTA], -max_delta), max_delta);
+    u[Model::A] = std::min<Scalar>(std::max<Scalar>(u[Model::A], -1), 1);
+    return u;
+  }
+
+  Scalar Square(Scalar x) const { return x * x; }
+
+  // the state entries the terminal weights apply to, and their errors
+  Eigen::Matrix<Scalar, 2, 1> TerminalError(const State &z) const {
+    return Eigen::Matrix<Scalar, 2, 1>(z[CTE] - c.ref_cte,
+                                       z[EPSI] - c.ref_epsi);
+  }
+
+  // Cost of the states at stage t, and of the inputs between t and t + 1.
+  Scalar StateCost(const State &z, size_t t) const {
+    Scalar sum = c.weight_cet * Square(z[CTE] - c.ref_cte) +
+                 c.weight_epsi * Square(z[EPSI] - c.ref_epsi) +
+                 c.weight_constant_vel * Square(z[Model::V] - c.ref_v);
+    if (t == N - 1) {
+      sum += c.weight_terminal_cte * Square(z[CTE] - c.ref_cte) +
+             c.weight_terminal_epsi * Square(z[EPSI] - c.ref_epsi);
+      if (has_terminal) {
+        Eigen::Matrix<Scalar, 2, 1> e = TerminalError(z);
+        sum += e.dot(P * e);
+      }
+    }
+    return sum;
+  }
+
+  Scalar InputCost(const State &z, const Input &u, size_t t) const {
+    Scalar sum = c.weight_delta * Square(u[Model::DELTA]) +
+                 c.weight_a * Square(u[Model::A]);
+    if (t > 0) {
+      sum += c.weight_delta_diff * Square(u[Model::DELTA] - z[PREV_DELTA]) +
+             c.weight_a_diff * Square(u[Model::A] - z[PREV_A]);
+    }
+    return sum;
+  }
+
+  Scalar Rollout(const Inputs &u, States *z) const {
+    Scalar sum = 0;
+    for (size_t t = 0; t + 1 < N; t++) {
+      sum += StateCost((*z)[t], t) + InputCost((*z)[t], u[t], t);
+      Dynamics((*z)[t].data(), u[t].data(), (*z)[t + 1].data());
+    }
+    return sum + StateCost((*z)[N - 1], N - 1);
+  }
+
+  // A = dF/dz, B = dF/du at (z, u).
+  void Linearize(const State &z, const Input &u, StateMatrix *A,
+                 Eigen::Matrix<Scalar, NZ, NU> *B) const {
+    typedef Eigen::Matrix<Scalar, NZ + NU, 1> Derivatives;
+    typedef Eigen::AutoDiffScalar<Derivatives> AD;
+    AD zd[NZ], ud[NU], next[NZ];
+    for (int i = 0; i < NZ; i++) {
+      zd[i] = AD(z[i], NZ + NU, i);
+    }
+    for (int i = 0; i < NU; i++) {
+      ud[i] = AD(u[i], NZ + NU, NZ + i);
+    }
+    Dynamics(zd, ud, next);
+    for (int i = 0; i < NZ; i++) {
+      A->row(i) = next[i].derivatives().template head<NZ>().transpose();
+      B->row(i) = next[i].derivatives().template tail<NU>().transpose();
+    }
+  }
+
+  // The Riccati recursion for the feedforward k and feedback K.
+  void Backward() {
+    // value function gradient and Hessian at the last stage
+    State vx = State::Zero();
+    StateMatrix vxx = StateMatrix::Zero();
+    StateGradient(states[N - 1], N - 1, &vx, &vxx);
+
+    expected[0] = expected[1] = 0;
+
+    StateMatrix A;
+    Eigen::Matrix<Scalar, NZ, NU> B;
+    for (int t = N - 2; t >= 0; t--) {
+      const State &z = states[t];
+      const Input &u = inputs[t];
+      Linearize(z, u, &A, &B);
+
+      State qx = State::Zero();
+      StateMatrix qxx = StateMatrix::Zero();
+      StateGradient(z, t, &qx, &qxx);
+      Input qu;
+      InputMatrix quu = InputMatrix::Zero();
+      Gain qux = Gain::Zero();
+      qu[Model::DELTA] = 2 * c.weight_delta * u[Model::DELTA];
+      qu[Model::A] = 2 * c.weight_a * u[Model::A];
+      quu(Model::DELTA, Model::DELTA) = 2 * c.weight_delta;
+      quu(Model::A, Model::A) = 2 * c.weight_a;
+      if (t > 0) {
+        qu[Model::DELTA] += 2 * c.weight_delta_diff * (u[Model::DELTA] - z[PREV_DELTA]);
+        qu[Model::A] += 2 * c.weight_a_diff * (u[Model::A] - z[PREV_A]);
+        quu(Model::DELTA, Model::DELTA) += 2 * c.weight_delta_diff;
+        quu(Model::A, Model::A) += 2 * c.weight_a_diff;
+        qux(Model::DELTA, PREV_DELTA) = -2 * c.weight_delta_diff;
+        qux(Model::A, PREV_A) = -2 * c.weight_a_diff;
+        qxx(PREV_DELTA, PREV_DELTA) += 2 * c.weight_delta_diff;
+        qxx(PREV_A, PREV_A) += 2 * c.weight_a_diff;
+        qx[PREV_DELTA] -= 2 * c.weight_delta_diff * (u[Model::DELTA] - z[PREV_DELTA]);
+        qx[PREV_A] -= 2 * c.weight_a_diff * (u[Model::A] - z[PREV_A]);
+      }
+
+      Eigen::Matrix<Scalar, NZ, NU> vxx_b = vxx * B;
+      qx += A.transpose() * vx;
+      qu += B.transpose() * vx;
+      qxx += A.transpose() * vxx * A;
+      quu += B.transpose() * vxx_b;
+      qux += vxx_b.transpose() * A;
+
+      // Inputs at a bound that the gradient pushes further out are held
+      // there (no feedforward, no feedback), the rest solve the reduced
+      // system.
+      InputMatrix free = InputMatrix::Identity();
+      for (int i = 0; i < NU; i++) {
+        Scalar lo = i == Model::DELTA ? -max_delta : -1;
+        Scalar hi = i == Model::DELTA ? max_delta : 1;
+        if ((u[i] >= hi && qu[i] < 0) || (u[i] <= lo && qu[i] > 0)) {
+          free(i, i) = 0;
+        }
+      }
+      InputMatrix reg = free * quu * free + mu * InputMatrix::Identity() +
+                        (InputMatrix::Identity() - free);
+      Eigen::LLT<InputMatrix> llt(reg);
+      k[t] = -llt.solve(free * qu);
+      K[t] = -llt.solve(free * qux);
+      // the change of cost the step promises, linear and quadratic part
+      expected[0] += k[t].dot(qu);
+      expected[1] += k[t].dot(quu * k[t]) / 2;
+
+      vx = qx + K[t].transpose() * quu * k[t] + K[t].transpose() * qu +
+           qux.transpose() * k[t];
+      vxx = qxx + K[t].transpose() * quu * K[t] + K[t].transpose() * qux +
+            qux.transpose() * K[t];
+      vxx = (vxx + vxx.transpose()) / 2;
+    }
+  }
+
+  void StateGradient(const State &z, size_t t, State *g, StateMatrix *H) const {
+    Scalar w_cte = c.weight_cet + (t == N - 1 ? c.weight_terminal_cte : 0.0);
+    Scalar w_epsi = c.weight_epsi + (t == N - 1 ? c.weight_terminal_epsi : 0.0);
+    (*g)[CTE] += 2 * w_cte * (z[CTE] - c.ref_cte);
+    (*g)[EPSI] += 2 * w_epsi * (z[EPSI] - c.ref_epsi);
+    (*g)[Model::V] += 2 * c.weight_constant_vel * (z[Model::V] - c.ref_v);
+    (*H)(CTE, CTE) += 2 * w_cte;
+    (*H)(EPSI, EPSI) += 2 * w_epsi;
+    (*H)(Model::V, Model::V) += 2 * c.weight_constant_vel;
+    if (has_terminal && t == N - 1) {
+      Eigen::Matrix<Scalar, 2, 1> Pe = P * TerminalError(z);
+      g->template segment<2>(CTE) += 2 * Pe;
+      H->template block<2, 2>(CTE, CTE) += 2 * P;
+    }
+  }
+
+  Scalar Forward(Scalar alpha, States *z, Inputs *u) const {
+    Scalar sum = 0;
+    for (size_t t = 0; t + 1 < N; t++) {
+      (*u)[t] = Clamp(inputs[t] + alpha * k[t] + K[t] * ((*z)[t] - states[t]));
+      sum += StateCost((*z)[t], t) + InputCost((*z)[t], (*u)[t], t);
+      Dynamics((*z)[t].data(), (*u)[t].data(), (*z)[t + 1].data());
+    }
+    return sum + StateCost((*z)[N - 1], N - 1);
+  }
+
+  const MPCConfig &c;
+  size_t N;
+  double dt;
+  Scalar poly[4];
+  bool has_terminal;
+  Eigen::Matrix<Scalar, 2, 2> P;
+  States states;
+  Inputs inputs;
+  Inputs k;
+  Gains K;
+  Scalar cost = 0;
+  Scalar expected[2];
+  Scalar mu = 1e-6;
+};
+
+// Solve from the initial model state s0 and errors cte, epsi, returning
+// the inputs and states along the horizon. With `float_iterations` > 0
+// that many iterations (at most) run in float first, then at most
+// `double_iterations` in double refine the result. `terminal` is the
+// terminal weight for the car's speed, or null. The iterations start from
+// the `initial` inputs if given, else from zero.
+template <class Model>
+void RiccatiSolve(const MPCConfig &config, const Eigen::VectorXd &coeffs,
+                  const double *s0, double cte, double epsi,
+                  int float_iterations, int double_iterations,
+                  typename Riccati<Model, double>::Inputs *u,
+                  typename Riccati<Model, double>::States *z,
+                  const Eigen::Matrix2d *terminal = nullptr,
+                  const typename Riccati<Model, double>::Inputs *initial =
+                      nullptr) {
+  typedef Riccati<Model, float> Single;
+  typedef Riccati<Model, double> Double;
+  size_t N = config.N;
+
+  typename Double::State z0 = Double::State::Zero();
+  for (size_t i = 0; i < Model::n_state; i++) {
+    z0[i] = s0[i];
+  }
+  z0[Double::CTE] = cte;
+  z0[Double::EPSI] = epsi;
+  typename Double::Inputs start(N - 1, Double::Input::Zero());
+  if (initial) {
+    start = *initial;
+  }
+
+  if (float_iterations > 0) {
+    Single single(config, coeffs, terminal);
+    typename Single::Inputs u0(N - 1);
+    for (size_t t = 0; t + 1 < N; t++) {
+      u0[t] = start[t].template cast<float>();
+    }
+    single.Start(z0.template cast<float>(), u0);
+    single.Solve(float_iterations, 1e-5f);
+    for (size_t t = 0; t + 1 < N; t++) {
+      start[t] = single.InputTrajectory()[t].template cast<double>();
+    }
+  }
+
+  Double refine(config, coeffs, terminal);
+  refine.Start(z0, start);
+  refine.Solve(double_iterations, 1e-10);
+  *u = refine.InputTrajectory();
+  *z = refine.StateTrajectory();
+}
+
+template <class Model, class Scalar>
+constexpr Scalar Riccati<Model, Scalar>::max_delta;
+
+#endif /* RICCATI_H */
@@ -0,0 +1,96 @@
+#include "scenario.h"
+#include <stdlib.h>
+#include <random>
+#include "controller.h"
+#include "sim.h"
+#include "stats.h"
+
+// for convenience
+using json = nlohmann::json;
+
+static void AddSolveStats(json &result, const vector<double> &solve_ms) {
+  result["ticks"] = solve_ms.size();
+  result["solve_mean_ms"] = Mean(solve_ms);
+  result["solve_p50_ms"] = Percentile(solve_ms, 50);
+  result["solve_p99_ms"] = Percentile(solve_ms, 99);
+  result["solve_max_ms"] = Percentile(solve_ms, 100);
+}
+
+json RunScenario(MPC &mpc, const string &spec, const Track &track) {
+  json result;
+  result["scenario"] = spec;
+
+  if (spec.compare(0, 4, "lap:") == 0) {
+    SimOptions opts;
+    opts.start_index = atoi(spec.c_str() + 4);
+    size_t colon = spec.find(':', 4);
+    if (colon != string::npos) {
+      opts.start_speed = atof(spec.c_str() + colon + 1);
+    }
+    LapResult lap = RunLap(mpc, track, opts);
+    result["ok"] = lap.completed;
+    result["completed"] = lap.completed;
+    result["lap_time"] = lap.lap_time;
+    result["progress"] = lap.progress;
+    result["max_cte"] = lap.max_cte;
+    result["mean_cte"] = lap.mean_cte;
+    AddSolveStats(result, lap.solve_ms);
+    return result;
+  }
+
+  vector<Telemetry> log;
+  if (!ReadTelemetryLog(spec, &log)) {
+    result["ok"] = false;
+    result["error"] = "can't read " + spec;
+    return result;
+  }
+  vector<double> solve_ms;
+  double max_steer = 0.0;
+  for (const auto &telemetry : log) {
+    auto start = chrono::steady_clock::now();
+    Steer steer = Drive(mpc, telemetry);
+    solve_ms.push_back(MsSince(start));
+    if (fabs(steer.steering_angle) > max_steer) {
+      max_steer = fabs(steer.steering_angle);
+    }
+  }
+  result["ok"] = !log.empty();
+  result["max_steer"] = max_steer;
+  AddSolveStats(result, solve_ms);
+  return result;
+}
+
+vector<string> SyntheticScenarios(const Track &track, int count) {
+  const double speeds[] = {0.0, 30.0, 60.0};
+  vector<string> specs;
+  for (int i = 0; i < count; i++) {
+    int index = i * track.x.size() / count;
+    specs.push_back("lap:" + to_string(index) + ":" +
+                    to_string(static_cast<int>(speeds[i % 3])));
+  }
+  return specs;
+}
+
+vector<Telemetry> TelemetryCorpus(const Track &track,
+                                  const vector<string> &logs, int synthetic,
+                                  unsigned seed) {
+  vector<Telemetry> corpus;
+  for (const auto &path : logs) {
+    vector<Telemetry> log;
+    if (ReadTelemetryLog(path, &log)) {
+      corpus.insert(corpus.end(), log.begin(), log.end());
+    }
+  }
+
+  mt19937 rng(seed);
+  uniform_int_distribution<int> index(0, track.x.size() - 1);
+  uniform_real_distribution<double> along(0.0, 1.0);
+  uniform_real_distribution<double> offset(-2.0, 2.0);
+  uniform_real_distribution<double> dpsi(-0.2, 0.2);
+  uniform_real_distribution<double> speed(0.0, 100.0);
+  for (int i = 0; i < synthetic; i++) {
+    corpus.push_back(TelemetryOnTrack(track, index(rng), along(rng),
+                                      offset(rng), dpsi(rng), speed(rng)));
+  }
+  return corpus;
+}
@@ -0,0 +1,36 @@
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+#include <string>
+#include <vector>
+#include "MPC.h"
+#include "json.hpp"
+#include "track.h"
+
+using namespace std;
+
+/*
+Regression scenarios for the controller.
+
+  lap:<start_index>:<start_speed>  a closed-loop lap of the headless
+                                   simulator (sim.h) from that waypoint
+  <path>                           a recorded drive (text or binary log),
+                                   every telemetry message is solved again
+
+Results are JSON objects with "scenario", "ok", "ticks" and solve time
+percentiles; laps add "completed", "lap_time", "progress", "max_cte" and
+"mean_cte".
+*/
+nlohmann::json RunScenario(MPC &mpc, const string &spec, const Track &track);
+
+// `count` laps spread around the track at a few start speeds.
+vector<string> SyntheticScenarios(const Track &track, int count);
+
+// Telemetry for open-loop solver benchmarks: every message of the recorded
+// `logs` plus `synthetic` random cars around the track (offset, heading
+// error and speed), the same set for the same `seed`.
+vector<Telemetry> TelemetryCorpus(const Track &track,
+                                  const vector<string> &logs, int synthetic,
+                                  unsigned seed = 42);
+
+#endif /* SCENARIO_H */
@@ -0,0 +1,219 @@
+#include "scheduler.h"
+#include <atomic>
+#include <cppad/cppad.hpp>
+#include "controller.h"
+#include "feedback.h"
+#include "stats.h"
+
+//
+// CppAD keeps per-thread tapes and memory pools, so it has to be told how
+// to find out which thread it is running on.
+//
+static std::atomic<bool> cppad_in_parallel(false);
+static thread_local size_t cppad_thread_num = 0;
+
+static bool CppADInParallel() { return cppad_in_parallel; }
+static size_t CppADThreadNum() { return cppad_thread_num; }
+
+void SetupCppADThreads(size_t n_threads) {
+  static std::mutex setup_mutex;
+  static size_t setup_threads = 0;
+  std::lock_guard<std::mutex> lock(setup_mutex);
+  if (n_threads <= setup_threads) {
+    return;
+  }
+  // parallel_setup and parallel_ad have to run in sequential mode
+  cppad_in_parallel = false;
+  CppAD::thread_alloc::parallel_setup(n_threads, CppADInParallel,
+                                      CppADThreadNum);
+  CppAD::thread_alloc::hold_memory(true);
+  CppAD::parallel_ad<double>();
+  setup_threads = n_threads;
+  cppad_in_parallel = n_threads > 1;
+}
+
+void SetCppADThread(size_t thread_num) { cppad_thread_num = thread_num; }
+
+//
+// BatchScheduler class definition implementation.
+//
+BatchScheduler::BatchScheduler(int n_workers, double window_ms,
+                               const MPCConfig &config)
+    : window_ms(window_ms),
+      stop(false),
+      pending(0),
+      finished(false),
+      record_latencies(false) {
+  if (n_workers < 1) {
+    n_workers = 1;
+  }
+  SetupCppADThreads(n_workers + 1);
+  for (int i = 0; i < n_workers; i++) {
+    workers.emplace_back(new Worker(config));
+  }
+  for (int i = 0; i < n_workers; i++) {
+    threads.emplace_back(&BatchScheduler::Work, this, i);
+  }
+  dispatcher = std::thread(&BatchScheduler::Dispatch, this);
+}
+
+BatchScheduler::~BatchScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(incoming_mutex);
+    stop = true;
+  }
+  arrived.notify_all();
+  // the dispatcher hands out what is left and then releases the workers
+  dispatcher.join();
+  for (auto &t : threads) {
+    t.join();
+  }
+}
+
+void BatchScheduler::Submit(const Telemetry &telemetry, Callback done,
+                            std::shared_ptr<ObstacleField> field,
+                            std::shared_ptr<PlanFeedback> feedback) {
+  Job job;
+  job.telemetry = telemetry;
+  job.done = done;
+  job.field = field;
+  job.feedback = feedback;
+  job.submitted = std::chrono::steady_clock::now();
+  {
+    std::lock_guard<std::mutex> lock(incoming_mutex);
+    incoming.push_back(std::move(job));
+  }
+  arrived.notify_one();
+}
+
+void BatchScheduler::SetSetup(std::shared_ptr<const MPCSetup> setup) {
+  for (auto &w : workers) {
+    w->mpc.SetSetup(setup);
+  }
+}
+
+BatchScheduler::Stats BatchScheduler::TakeStats() {
+  std::lock_guard<std::mutex> lock(stats_mutex);
+  Stats taken = stats;
+  stats = Stats();
+  return taken;
+}
+
+void BatchScheduler::RecordLatencies(bool on) {
+  std::lock_guard<std::mutex> lock(stats_mutex);
+  record_latencies = on;
+}
+
+std::vector<MPCMemory> BatchScheduler::Memory() {
+  std::vector<MPCMemory> memory;
+  for (auto &worker : workers) {
+    memory.push_back(worker->mpc.Memory());
+  }
+  return memory;
+}
+
+void BatchScheduler::Dispatch() {
+  std::vector<Job> batch;
+  size_t next = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(incoming_mutex);
+      arrived.wait(lock, [this] { return stop || !incoming.empty(); });
+      if (stop && incoming.empty()) {
+        break;
+      }
+      // keep gathering until the window of the first request closes
+      auto close = incoming.front().submitted +
+                   std::chrono::microseconds(static_cast<long>(window_ms * 1000));
+      arrived.wait_until(lock, close, [this] { return stop; });
+      batch.swap(incoming);
+    }
+
+    // deal the batch out round-robin, stealing evens out the rest
+    for (auto &job : batch) {
+      Worker &w = *workers[next++ % workers.size()];
+      std::lock_guard<std::mutex> lock(w.mutex);
+      w.jobs.push_back(std::move(job));
+    }
+    {
+      std::lock_guard<std::mutex> lock(work_mutex);
+      pending += batch.size();
+    }
+    {
+      std::lock_guard<std::mutex> lock(stats_mutex);
+      stats.batches++;
+    }
+    work_ready.notify_all();
+    batch.clear();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(work_mutex);
+    finished = true;
+  }
+  work_ready.notify_all();
+}
+
+bool BatchScheduler::Take(int id, Job *job) {
+  // own jobs from the front first
+  {
+    Worker &w = *workers[id];
+    std::lock_guard<std::mutex> lock(w.mutex);
+    if (!w.jobs.empty()) {
+      *job = std::move(w.jobs.front());
+      w.jobs.pop_front();
+      return true;
+    }
+  }
+  // then steal from the back of the others
+  for (size_t k = 1; k < workers.size(); k++) {
+    Worker &w = *workers[(id + k) % workers.size()];
+    std::lock_guard<std::mutex> lock(w.mutex);
+    if (!w.jobs.empty()) {
+      *job = std::move(w.jobs.back());
+      w.jobs.pop_back();
+      std::lock_guard<std::mutex> stats_lock(stats_mutex);
+      stats.steals++;
+      return true;
+    }
+  }
+  return false;
+}
+
+void BatchScheduler::Work(int id) {
+  SetCppADThread(id + 1);
+  Job job;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(work_mutex);
+      work_ready.wait(lock, [this] { return finished || pending > 0; });
+      if (pending == 0) {
+        break;
+      }
+      pending--;
+    }
+    // a job is reserved for us, it is in one of the deques
+    while (!Take(id, &job)) {
+      std::this_thread::yield();
+    }
+
+    // the plan's age counts from when the telemetry came in
+    Steer steer =
+        job.feedback
+            ? DriveWithFeedback(workers[id]->mpc, job.telemetry,
+                                std::chrono::duration<double>(
+                                    job.submitted.time_since_epoch())
+                                    .count(),
+                                job.feedback.get(), job.field.get())
+            : Drive(workers[id]->mpc, job.telemetry, job.field.get());
+    double latency = MsSince(job.submitted);
+    {
+      std::lock_guard<std::mutex> lock(stats_mutex);
+      stats.jobs++;
+      if (record_latencies) {
+        stats.latency_ms.push_back(latency);
+      }
+    }
+    job.done(steer);
+  }
+}
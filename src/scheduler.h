@@ -0,0 +1,113 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "MPC.h"
+#include "feedback.h"
+#include "obstacles.h"
+#include "wire.h"
+
+/*
+Micro-batching scheduler for many simultaneous vehicles.
+
+Telemetry from all connections is gathered for `window_ms` after the first
+request of a batch arrives, then the whole batch is dealt out to a pool of
+workers. Each worker owns its own MPC and a deque of jobs; a worker that
+runs dry steals from the back of the other deques, which balances uneven
+solve times. `done` is called on the worker thread.
+
+NOTE: Ipopt has to be built with a thread-safe linear solver (e.g. ma27)
+to run more than one worker; MUMPS is not.
+*/
+class BatchScheduler {
+ public:
+  typedef std::function<void(const Steer &)> Callback;
+
+  struct Stats {
+    size_t jobs = 0;
+    size_t batches = 0;
+    size_t steals = 0;
+    // submit to done, milliseconds, only while RecordLatencies() is on
+    std::vector<double> latency_ms;
+  };
+
+  BatchScheduler(int n_workers, double window_ms,
+                 const MPCConfig &config = MPCConfig());
+  virtual ~BatchScheduler();
+
+  // `field` is the vehicle's obstacle state, see Drive(), and `feedback`
+  // its plan between full solves, see DriveWithFeedback().
+  void Submit(const Telemetry &telemetry, Callback done,
+              std::shared_ptr<ObstacleField> field = nullptr,
+              std::shared_ptr<PlanFeedback> feedback = nullptr);
+
+  // Swap a prepared config into every worker, see MPC::SetSetup().
+  void SetSetup(std::shared_ptr<const MPCSetup> setup);
+
+  // Stats since the last call.
+  Stats TakeStats();
+
+  // Keep every job's latency in the stats. Off by default: the list
+  // grows with every solve until TakeStats(), which the server never
+  // calls, so only benches turn it on.
+  void RecordLatencies(bool on);
+
+  // What each worker's controller holds, see MPC::Memory().
+  std::vector<MPCMemory> Memory();
+
+ private:
+  struct Job {
+    Telemetry telemetry;
+    Callback done;
+    std::shared_ptr<ObstacleField> field;
+    std::shared_ptr<PlanFeedback> feedback;
+    std::chrono::steady_clock::time_point submitted;
+  };
+
+  struct Worker {
+    explicit Worker(const MPCConfig &config) : mpc(config) {}
+    std::mutex mutex;
+    std::deque<Job> jobs;
+    MPC mpc;
+  };
+
+  void Dispatch();
+  void Work(int id);
+  bool Take(int id, Job *job);
+
+  double window_ms;
+  bool stop;
+
+  // requests waiting for the current batch window to close
+  std::mutex incoming_mutex;
+  std::condition_variable arrived;
+  std::vector<Job> incoming;
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::mutex work_mutex;
+  std::condition_variable work_ready;
+  size_t pending;
+  bool finished;
+
+  std::mutex stats_mutex;
+  Stats stats;
+  bool record_latencies;
+
+  std::thread dispatcher;
+  std::vector<std::thread> threads;
+};
+
+// Let CppAD run on `n_threads` threads; call before starting them.
+// The calling thread is CppAD thread 0, workers set their own number
+// with SetCppADThread().
+void SetupCppADThreads(size_t n_threads);
+void SetCppADThread(size_t thread_num);
+
+#endif /* SCHEDULER_H */
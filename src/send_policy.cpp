@@ -0,0 +1,44 @@
+#include "send_policy.h"
+
+static std::string Encode(const Steer &steer, bool binary) {
+  return binary ? EncodeSteer(steer) : SteerMessage(steer);
+}
+
+// Every n-th point and the last.
+static vector<double> Thin(const vector<double> &line, size_t n) {
+  vector<double> thinned;
+  for (size_t i = 0; i < line.size(); i += n) {
+    thinned.push_back(line[i]);
+  }
+  if (!line.empty() && (line.size() - 1) % n != 0) {
+    thinned.push_back(line.back());
+  }
+  return thinned;
+}
+
+std::string SendPolicy::Reply(const Steer &steer, bool binary,
+                              size_t buffered) {
+  stats.replies++;
+  std::string msg = Encode(steer, binary);
+  if (buffered <= threshold) {
+    stats.bytes_sent += msg.length();
+    return msg;
+  }
+
+  Steer trimmed;
+  trimmed.steering_angle = steer.steering_angle;
+  trimmed.throttle = steer.throttle;
+  if (buffered <= 4 * threshold) {
+    trimmed.mpc_x = Thin(steer.mpc_x, thin);
+    trimmed.mpc_y = Thin(steer.mpc_y, thin);
+    trimmed.next_x = Thin(steer.next_x, thin);
+    trimmed.next_y = Thin(steer.next_y, thin);
+    stats.thinned++;
+  } else {
+    stats.stripped++;
+  }
+  std::string short_msg = Encode(trimmed, binary);
+  stats.bytes_trimmed += msg.length() - short_msg.length();
+  stats.bytes_sent += short_msg.length();
+  return short_msg;
+}
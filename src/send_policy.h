@@ -0,0 +1,52 @@
+#ifndef SEND_POLICY_H
+#define SEND_POLICY_H
+
+#include <stddef.h>
+#include <string>
+#include "wire.h"
+
+/*
+Backpressure on the replies to a slow client.
+
+Every reply carries the two commands and four lines for the simulator to
+draw (mpc_x/y, next_x/y), which are most of its bytes. When a client
+doesn't read fast enough the replies pile up in the server's send buffer,
+and the commands queue behind old lines. Before each send the policy
+looks at how many bytes of earlier replies the connection still has
+waiting and keeps the commands at full rate, but
+
+  up to `threshold`          sends the lines as they are
+  up to 4 x `threshold`      thins them to every `thin`-th point (and
+                             the last, so they still reach the horizon)
+  beyond                     drops them
+
+The bytes saved are counted. Use it from the event loop only.
+*/
+
+struct SendStats {
+  size_t replies = 0;
+  size_t thinned = 0;
+  size_t stripped = 0;
+  // bytes handed to the socket, and saved by trimming
+  size_t bytes_sent = 0;
+  size_t bytes_trimmed = 0;
+};
+
+class SendPolicy {
+ public:
+  explicit SendPolicy(size_t threshold = 16384, size_t thin = 4)
+      : threshold(threshold), thin(thin) {}
+
+  // The reply to a connection with `buffered` bytes not yet written,
+  // JSON (socket.io) or binary (wire.h) like the telemetry was.
+  std::string Reply(const Steer &steer, bool binary, size_t buffered);
+
+  const SendStats &Stats() const { return stats; }
+
+ private:
+  size_t threshold;
+  size_t thin;
+  SendStats stats;
+};
+
+#endif /* SEND_POLICY_H */
@@ -0,0 +1,141 @@
+#include "sim.h"
+#include <math.h>
+#include <deque>
+#include <random>
+#include "controller.h"
+#include "feedback.h"
+#include "stats.h"
+
+// plant parameters, roughly what the Unity car does
+const double Lf = 2.67;
+const double mph_to_ms = 0.44704;
+// mph per second at full throttle, and the drag that caps top speed
+const double max_accel = 12.0;
+const double drag = 0.1;
+// integration step, seconds
+const double h = 0.01;
+
+// Distance from (x, y) to the segment from waypoint i to i + 1 and how far
+// along it the closest point is, 0 at i and 1 at i + 1.
+static double SegmentDistance(const Track &track, int i, double x, double y,
+                              double *along) {
+  int n = track.x.size();
+  int i0 = ((i % n) + n) % n;
+  int i1 = (i0 + 1) % n;
+  double dx = track.x[i1] - track.x[i0];
+  double dy = track.y[i1] - track.y[i0];
+  double s = ((x - track.x[i0]) * dx + (y - track.y[i0]) * dy) /
+             (dx * dx + dy * dy);
+  *along = s;
+  if (s < 0.0) s = 0.0;
+  if (s > 1.0) s = 1.0;
+  return hypot(x - (track.x[i0] + s * dx), y - (track.y[i0] + s * dy));
+}
+
+LapResult RunLap(MPC &mpc, const Track &track, const SimOptions &opts) {
+  LapResult result;
+  int n = track.x.size();
+  int segment = opts.start_index;
+
+  // start on the center line, heading along the track
+  Telemetry start = TelemetryOnTrack(track, segment, 0.0, 0.0, 0.0,
+                                     opts.start_speed);
+  double x = start.x;
+  double y = start.y;
+  double psi = start.psi;
+  double v = opts.start_speed;
+
+  // commands waiting for the latency to pass, and the one being applied
+  deque<pair<double, Steer>> pending;
+  Steer applied;
+  PlanFeedback feedback;
+  double cte_sum = 0.0;
+  double next_tick = 0.0;
+
+  std::mt19937 rng(opts.seed);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  std::normal_distribution<double> normal(0.0, 1.0);
+
+  for (double t = 0.0; t < opts.max_time; t += h) {
+    // keep track of the segment the car is on
+    double along;
+    double cte = SegmentDistance(track, segment, x, y, &along);
+    while (along > 1.0) {
+      segment++;
+      cte = SegmentDistance(track, segment, x, y, &along);
+    }
+    if (segment - opts.start_index >= n) {
+      result.completed = true;
+      result.lap_time = t;
+      break;
+    }
+    if (cte > opts.off_track) {
+      result.off_track = true;
+      break;
+    }
+
+    if (t >= next_tick && opts.drop_rate > 0.0 &&
+        uniform(rng) < opts.drop_rate) {
+      // lost on the way, the car keeps its last command
+      next_tick += opts.tick;
+    } else if (t >= next_tick) {
+      next_tick += opts.tick;
+      Telemetry telemetry = TelemetryOnTrack(track, segment - 1, 0.0, 0.0,
+                                             0.0, v);
+      telemetry.x = x + opts.pos_noise * normal(rng);
+      telemetry.y = y + opts.pos_noise * normal(rng);
+      telemetry.psi = psi + opts.psi_noise * normal(rng);
+      telemetry.speed = v + opts.speed_noise * normal(rng);
+      telemetry.steering_angle = applied.steering_angle;
+      telemetry.throttle = applied.throttle;
+
+      auto solve_start = chrono::steady_clock::now();
+      Steer steer = DriveWithFeedback(mpc, telemetry, t, &feedback);
+      double solve_ms = MsSince(solve_start);
+      result.solve_ms.push_back(solve_ms);
+      double delay = opts.latency + opts.latency_jitter * uniform(rng) +
+                     opts.solve_time_scale * solve_ms / 1000.0;
+      pending.push_back(make_pair(t + delay, steer));
+
+      result.ticks++;
+      result.cte.push_back(cte);
+      cte_sum += cte;
+      if (cte > result.max_cte) {
+        result.max_cte = cte;
+      }
+    }
+
+    // with jitter a later command may overtake an earlier one, and the
+    // older one still gets applied when it arrives, like on a real bus
+    for (size_t i = 0; i < pending.size();) {
+      if (pending[i].first <= t) {
+        applied = pending[i].second;
+        pending.erase(pending.begin() + i);
+      } else {
+        i++;
+      }
+    }
+
+    // kinematic bicycle, speed in mph, positions in meters
+    double steering = applied.steering_angle;
+    if (steering > 1.0) steering = 1.0;
+    if (steering < -1.0) steering = -1.0;
+    double delta = -steering * deg2rad(25);
+    double v_ms = v * mph_to_ms;
+    x += v_ms * cos(psi) * h;
+    y += v_ms * sin(psi) * h;
+    psi += v_ms / Lf * delta * h;
+    v += (applied.throttle * max_accel - drag * v) * h;
+    if (v < 0.0) v = 0.0;
+  }
+
+  result.progress = double(segment - opts.start_index) / n;
+  if (result.progress > 1.0) {
+    result.progress = 1.0;
+  }
+  result.solves = feedback.solves;
+  if (result.ticks > 0) {
+    result.mean_cte = cte_sum / result.ticks;
+  }
+  return result;
+}
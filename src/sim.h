@@ -0,0 +1,73 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <vector>
+#include "MPC.h"
+#include "track.h"
+
+using namespace std;
+
+/*
+Headless stand-in for the Unity simulator.
+
+A kinematic bicycle is driven around a Track by the controller. Like the
+simulator it reports speed in mph, reads steering_angle in [-1, 1] as a
+fraction of 25 degrees (sign reversed) and applies every command `latency`
+seconds after the telemetry it was computed from.
+
+For robustness sweeps the loop can be perturbed: random extra delay per
+command, the solve's own wall time counted as delay, lost telemetry
+messages (no new command that tick) and Gaussian noise on the reported
+pose and speed. All of it is off by default.
+*/
+struct SimOptions {
+  // seconds between telemetry messages
+  double tick = 0.1;
+  // actuation delay, seconds
+  double latency = 0.1;
+  // give up after this much simulated time, seconds
+  double max_time = 120.0;
+  // distance from the center line that counts as leaving the track
+  double off_track = 5.0;
+  // waypoint the lap starts from, and speed in mph there
+  int start_index = 0;
+  double start_speed = 0.0;
+
+  // extra actuation delay per command, uniform in [0, latency_jitter] s
+  double latency_jitter = 0.0;
+  // wall time of the solve times this is added to the delay
+  double solve_time_scale = 0.0;
+  // probability that a telemetry message is lost
+  double drop_rate = 0.0;
+  // standard deviation of the noise on x, y (meters), psi (radians) and
+  // speed (mph) in the telemetry
+  double pos_noise = 0.0;
+  double psi_noise = 0.0;
+  double speed_noise = 0.0;
+  unsigned seed = 1;
+};
+
+struct LapResult {
+  bool completed = false;
+  // left the track before finishing or running out of time
+  bool off_track = false;
+  // simulated seconds to get back to the start waypoint
+  double lap_time = 0.0;
+  // fraction of the lap driven
+  double progress = 0.0;
+  double max_cte = 0.0;
+  double mean_cte = 0.0;
+  // cross track error at every tick
+  vector<double> cte;
+  int ticks = 0;
+  // ticks that ran a full solve, the rest followed the last plan with its
+  // feedback (see feedback.h)
+  int solves = 0;
+  // wall time of each Drive() call
+  vector<double> solve_ms;
+};
+
+// Drive one lap, or until the car leaves the track or time runs out.
+LapResult RunLap(MPC &mpc, const Track &track, const SimOptions &opts);
+
+#endif /* SIM_H */
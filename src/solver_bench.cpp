@@ -0,0 +1,246 @@
+#include <math.h>
+#include <stdio.h>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "MPC.h"
+#include "config.h"
+#include "controller.h"
+#include "cost.h"
+#include "layout.h"
+#include "scenario.h"
+#include "stage_nlp.h"
+#include "stage_pool.h"
+#include "stats.h"
+#include "track.h"
+#include "vehicle_model.h"
+
+/*
+Accuracy and throughput of the solvers (MPCConfig::solver) on a telemetry
+corpus: recorded logs plus random cars around the track.
+
+For each model every message is solved with Ipopt, the in-tree iterative
+LQR in double and the same in mixed precision. The first actuation of the
+mixed precision solve must stay within --delta-tol/--a-tol of the double
+one on at least --min-agree of the messages; the cost is nearly flat along
+the throttle on a few, where either solve may stop anywhere in the flat
+part. Ipopt's distance to it is shown for reference (it also keeps psi
+bounded, the LQR doesn't).
+
+Ipopt also solves the reduced formulation (MPCConfig::formulation), which
+has the same optimum with 2N fewer variables and constraints; it must
+agree with the full one the same way.
+
+With --stage-pool threads it times the stage-parallel Ipopt problem
+(MPCConfig::eval_threads, stage_nlp.h) instead, at N = 40, 60 and 80 on
+the kinematic model: one round of Ipopt's callbacks (f, its gradient, g,
+its Jacobian and the Hessian of the Lagrangian) on the calling thread and
+on a pool of that many threads, and whole solves of the corpus with the
+pool against the CppAD tape, with how far their first actuations are
+apart.
+
+  solver_bench [--synthetic n] [--delta-tol rad] [--a-tol a]
+               [--min-agree fraction] [--config base.json] [--track path]
+               [--stage-pool threads] [log ...]
+*/
+
+struct Run {
+  vector<double> solve_ms;
+  vector<double> delta;
+  vector<double> a;
+};
+
+Run Solve(const MPCConfig &config, const vector<Telemetry> &corpus) {
+  MPC mpc(config);
+  Run run;
+  for (const auto &telemetry : corpus) {
+    auto start = chrono::steady_clock::now();
+    Steer steer = Drive(mpc, telemetry);
+    run.solve_ms.push_back(MsSince(start));
+    run.delta.push_back(-steer.steering_angle);
+    run.a.push_back(steer.throttle);
+  }
+  return run;
+}
+
+// Microseconds per round of Ipopt's callbacks on the stage problem of
+// `telemetry`, at a new x every round.
+double CallbackRoundUs(const MPCConfig &config, const Telemetry &telemetry,
+                       StagePool *pool, int rounds) {
+  typedef StageNLP<KinematicModel, ControllerCost> Problem;
+  typedef Ipopt::Index Index;
+  VarLayout layout(config.N, KinematicModel::n_state);
+  size_t n_vars = layout.a_start + config.N - 1;
+  size_t n_constraints = config.N * (KinematicModel::n_state + 2);
+  vector<double> xi(n_vars, 0.0);
+  for (size_t t = 0; t < config.N; t++) {
+    xi[layout.v_start + t] = telemetry.speed;
+  }
+  vector<double> xl(n_vars, -1.0e19), xu(n_vars, 1.0e19);
+  vector<double> gl(n_constraints, 0.0), gu(n_constraints, 0.0);
+  Problem problem(config, layout, ReferenceCoeffs(telemetry), pool, xi, xl,
+                  xu, gl, gu);
+
+  Index n, m, nnz_jac, nnz_hess;
+  Problem::IndexStyleEnum style;
+  problem.get_nlp_info(n, m, nnz_jac, nnz_hess, style);
+  vector<double> x = xi, grad(n), g(m), jac(nnz_jac), hess(nnz_hess);
+  vector<double> lambda(m, 1.0);
+  double f = 0.0;
+  auto start = chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    x[layout.delta_start] = 1e-3 * (r % 7);
+    problem.eval_f(n, x.data(), true, f);
+    problem.eval_grad_f(n, x.data(), false, grad.data());
+    problem.eval_g(n, x.data(), false, m, g.data());
+    problem.eval_jac_g(n, x.data(), false, m, nnz_jac, nullptr, nullptr,
+                       jac.data());
+    problem.eval_h(n, x.data(), false, 1.0, m, lambda.data(), true,
+                   nnz_hess, nullptr, nullptr, hess.data());
+  }
+  return MsSince(start) * 1000.0 / rounds;
+}
+
+int StagePoolBench(const MPCConfig &base, const vector<Telemetry> &corpus,
+                   int threads) {
+  unsigned cores = std::thread::hardware_concurrency();
+  if (threads < 2) {
+    cerr << "--stage-pool needs at least 2 threads" << endl;
+    return -1;
+  }
+  if (static_cast<unsigned>(threads) > cores) {
+    // MPCSetup doesn't start more threads than cores, the solves below
+    // would both run on the tape
+    printf("%u cores: solves use no pool of %d threads\n", cores, threads);
+  }
+  StagePool pool(threads);
+  printf("%4s %12s %12s %8s %10s %10s %10s %10s %8s %10s %8s\n", "N",
+         "serial_us", "pool_us", "speedup", "tape_ms", "tape_p99",
+         "pool_ms", "pool_p99", "speedup", "max_ddelta", "max_da");
+  for (size_t N : {40, 60, 80}) {
+    MPCConfig config = base;
+    config.model = "kinematic";
+    config.solver = "ipopt";
+    config.formulation = "full";
+    config.N = N;
+    config.eval_parallel_min_N = N;
+    const int rounds = 200;
+    double serial_us = CallbackRoundUs(config, corpus[0], nullptr, rounds);
+    double pool_us = CallbackRoundUs(config, corpus[0], &pool, rounds);
+
+    config.eval_threads = 1;
+    Run tape = Solve(config, corpus);
+    config.eval_threads = threads;
+    Run staged = Solve(config, corpus);
+    double max_ddelta = 0.0;
+    double max_da = 0.0;
+    for (size_t i = 0; i < corpus.size(); i++) {
+      max_ddelta = std::max(max_ddelta, fabs(staged.delta[i] - tape.delta[i]));
+      max_da = std::max(max_da, fabs(staged.a[i] - tape.a[i]));
+    }
+    double tape_ms = Mean(tape.solve_ms);
+    double pool_ms = Mean(staged.solve_ms);
+    printf("%4zu %12.1f %12.1f %8.2f %10.3f %10.3f %10.3f %10.3f %8.2f "
+           "%10.5f %8.5f\n",
+           N, serial_us, pool_us, serial_us / pool_us, tape_ms,
+           Percentile(tape.solve_ms, 99), pool_ms,
+           Percentile(staged.solve_ms, 99),
+           pool_ms > 0.0 ? tape_ms / pool_ms : 0.0, max_ddelta, max_da);
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int synthetic = 500;
+  double delta_tol = 0.005;
+  double a_tol = 0.01;
+  double min_agree = 0.98;
+  MPCConfig base;
+  int stage_pool = 0;
+  string track_path = "../lake_track_waypoints.csv";
+  vector<string> logs;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--synthetic" && has_value) {
+      synthetic = atoi(argv[++i]);
+    } else if (arg == "--delta-tol" && has_value) {
+      delta_tol = atof(argv[++i]);
+    } else if (arg == "--a-tol" && has_value) {
+      a_tol = atof(argv[++i]);
+    } else if (arg == "--min-agree" && has_value) {
+      min_agree = atof(argv[++i]);
+    } else if (arg == "--config" && has_value) {
+      if (!LoadConfig(argv[++i], &base)) {
+        cerr << "Failed to load config " << argv[i] << endl;
+        return -1;
+      }
+    } else if (arg == "--track" && has_value) {
+      track_path = argv[++i];
+    } else if (arg == "--stage-pool" && has_value) {
+      stage_pool = atoi(argv[++i]);
+    } else {
+      logs.push_back(arg);
+    }
+  }
+
+  Track track;
+  if (!LoadTrack(track_path, &track)) {
+    cerr << "Failed to load track " << track_path << endl;
+    return -1;
+  }
+  vector<Telemetry> corpus = TelemetryCorpus(track, logs, synthetic);
+  printf("%zu messages\n", corpus.size());
+  if (stage_pool > 0) {
+    return StagePoolBench(base, corpus, stage_pool);
+  }
+
+  printf("%-10s %-14s %9s %9s %9s %10s %10s %8s %8s\n", "model", "solver",
+         "mean_ms", "p50_ms", "p99_ms", "solves/s", "max_ddelta", "max_da",
+         "in_tol");
+  bool ok = true;
+  for (const char *model : {"kinematic", "dynamic"}) {
+    MPCConfig config = base;
+    config.model = model;
+    Run runs[4];
+    const char *solvers[] = {"riccati", "riccati_mixed", "ipopt",
+                             "ipopt"};
+    const char *formulations[] = {"full", "full", "full", "reduced"};
+    const char *labels[] = {"riccati", "riccati_mixed", "ipopt",
+                            "ipopt_reduced"};
+    // what each is compared with: the double precision LQR, or full Ipopt
+    const int references[] = {0, 0, 0, 2};
+    for (int s = 0; s < 4; s++) {
+      config.solver = solvers[s];
+      config.formulation = formulations[s];
+      runs[s] = Solve(config, corpus);
+    }
+    for (int s = 0; s < 4; s++) {
+      const Run &run = runs[s];
+      const Run &reference = runs[references[s]];
+      double max_ddelta = 0.0;
+      double max_da = 0.0;
+      size_t in_tol = 0;
+      for (size_t i = 0; i < corpus.size(); i++) {
+        double ddelta = fabs(run.delta[i] - reference.delta[i]);
+        double da = fabs(run.a[i] - reference.a[i]);
+        max_ddelta = std::max(max_ddelta, ddelta);
+        max_da = std::max(max_da, da);
+        in_tol += ddelta <= delta_tol && da <= a_tol;
+      }
+      double mean = Mean(run.solve_ms);
+      printf("%-10s %-14s %9.3f %9.3f %9.3f %10.0f %10.5f %8.5f %8zu\n",
+             model, labels[s], mean, Percentile(run.solve_ms, 50),
+             Percentile(run.solve_ms, 99), mean > 0.0 ? 1000.0 / mean : 0.0,
+             max_ddelta, max_da, in_tol);
+      if ((s == 1 || s == 3) && in_tol < min_agree * corpus.size()) {
+        printf("%s left the tolerance\n", labels[s]);
+        ok = false;
+      }
+    }
+  }
+  return ok ? 0 : 1;
+}
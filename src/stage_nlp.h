@@ -0,0 +1,465 @@
+#ifndef STAGE_NLP_H
+#define STAGE_NLP_H
+
+#include <math.h>
+#include <stddef.h>
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <coin/IpIpoptApplication.hpp>
+#include <coin/IpTNLP.hpp>
+#include <cppad/ipopt/solve.hpp>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/unsupported/Eigen/AutoDiff"
+#include "config.h"
+#include "layout.h"
+#include "stage_pool.h"
+#include "vehicle_model.h"
+
+/*
+The MPC problem handed to Ipopt stage by stage, for long horizons.
+
+CppAD::ipopt::solve evaluates the constraints and their derivatives from
+one tape of FG_eval, on one thread. With N in the 40 to 80 range the
+6(N - 1) model constraints dominate an Ipopt iteration, yet stage t only
+depends on the variables at t - 1 and t:
+
+  g[k * N + t] = vars[k * N + t] - f_k(w_t)
+  w_t = (model state, epsi, delta, a at t - 1)
+
+so every stage's rows of g, its block of the Jacobian and its block of
+the Hessian of the Lagrangian can be computed on their own. The sparsity
+pattern is laid out once per solve with a fixed slot per stage in Ipopt's
+value arrays, and a StagePool fills the slots of a range of stages per
+thread. f and its derivatives come from Eigen's forward mode AutoDiff,
+nested once for the Hessian, through the same Model::step as FG_eval.
+
+The cost is the controller's (Objective, see cost.h): quadratic, so its
+gradient is cheap and its Hessian constant; both are added on the
+calling thread. Obstacle constraints are left to the CppAD path.
+*/
+
+template <class Model, class Objective>
+class StageNLP : public Ipopt::TNLP {
+ public:
+  typedef Ipopt::Index Index;
+  typedef Ipopt::Number Number;
+  // the stage inputs w and outputs f
+  enum { NW = Model::n_state + 3, NF = Model::n_state + 2 };
+  enum { EPSI = Model::n_state, DELTA, A };
+
+  StageNLP(const MPCConfig &config, const VarLayout &layout,
+           const Eigen::VectorXd &coeffs, StagePool *pool,
+           const std::vector<double> &xi, const std::vector<double> &xl,
+           const std::vector<double> &xu, const std::vector<double> &gl,
+           const std::vector<double> &gu)
+      : config(config), layout(layout), N(config.N), pool(pool), xi(xi),
+        xl(xl), xu(xu), gl(gl), gu(gu), stale(true) {
+    for (int i = 0; i < 4; i++) {
+      poly[i] = coeffs[i];
+    }
+    Layout();
+  }
+
+  // The model's prediction for one stage, as the constraints of FG_eval.
+  template <class T>
+  void Predict(const T *w, T *f) const {
+    T u[Model::n_input];
+    u[Model::DELTA] = w[DELTA];
+    u[Model::A] = w[A];
+    T s1[Model::n_state];
+    Model::step(w, u, config.dt, s1);
+    for (size_t k = 0; k < Model::n_state; k++) {
+      f[k] = s1[k];
+    }
+    ErrorStep<Model>(poly, w, w[EPSI], s1, config.dt, &f[Model::n_state],
+                     &f[Model::n_state + 1]);
+  }
+
+  bool get_nlp_info(Index &n, Index &m, Index &nnz_jac_g, Index &nnz_h_lag,
+                    IndexStyleEnum &index_style) override {
+    n = xi.size();
+    m = gl.size();
+    nnz_jac_g = jac_rows.size();
+    nnz_h_lag = hess_rows.size();
+    index_style = C_STYLE;
+    return true;
+  }
+
+  bool get_bounds_info(Index n, Number *x_l, Number *x_u, Index m,
+                       Number *g_l, Number *g_u) override {
+    for (Index i = 0; i < n; i++) {
+      x_l[i] = xl[i];
+      x_u[i] = xu[i];
+    }
+    for (Index i = 0; i < m; i++) {
+      g_l[i] = gl[i];
+      g_u[i] = gu[i];
+    }
+    return true;
+  }
+
+  bool get_starting_point(Index n, bool init_x, Number *x, bool init_z,
+                          Number *z_L, Number *z_U, Index m, bool init_lambda,
+                          Number *lambda) override {
+    for (Index i = 0; init_x && i < n; i++) {
+      x[i] = xi[i];
+    }
+    // nothing to warm start the multipliers from
+    for (Index i = 0; init_z && i < n; i++) {
+      z_L[i] = z_U[i] = 0.0;
+    }
+    for (Index i = 0; init_lambda && i < m; i++) {
+      lambda[i] = 0.0;
+    }
+    return true;
+  }
+
+  bool eval_f(Index n, const Number *x, bool new_x, Number &obj_value) override {
+    stale |= new_x;
+    obj_value = Objective::template Eval<double>(layout, config, x);
+    return true;
+  }
+
+  bool eval_grad_f(Index n, const Number *x, bool new_x,
+                   Number *grad_f) override {
+    stale |= new_x;
+    for (Index i = 0; i < n; i++) {
+      grad_f[i] = 0.0;
+    }
+    Objective::Gradient(layout, config, x, grad_f);
+    return true;
+  }
+
+  bool eval_g(Index n, const Number *x, bool new_x, Index m,
+              Number *g) override {
+    stale |= new_x;
+    Linearize(x);
+    for (Index i = 0; i < m; i++) {
+      g[i] = g_values[i];
+    }
+    return true;
+  }
+
+  bool eval_jac_g(Index n, const Number *x, bool new_x, Index m,
+                  Index nele_jac, Index *iRow, Index *jCol,
+                  Number *values) override {
+    stale |= new_x;
+    if (values == nullptr) {
+      for (Index i = 0; i < nele_jac; i++) {
+        iRow[i] = jac_rows[i];
+        jCol[i] = jac_cols[i];
+      }
+      return true;
+    }
+    Linearize(x);
+    for (Index i = 0; i < nele_jac; i++) {
+      values[i] = jac_values[i];
+    }
+    return true;
+  }
+
+  bool eval_h(Index n, const Number *x, bool new_x, Number obj_factor,
+              Index m, const Number *lambda, bool new_lambda, Index nele_hess,
+              Index *iRow, Index *jCol, Number *values) override {
+    stale |= new_x;
+    if (values == nullptr) {
+      for (Index i = 0; i < nele_hess; i++) {
+        iRow[i] = hess_rows[i];
+        jCol[i] = hess_cols[i];
+      }
+      return true;
+    }
+    for (Index i = 0; i < nele_hess; i++) {
+      values[i] = 0.0;
+    }
+    // -sum of lambda_k * d2 f_k / dw2, stage by stage
+    Parallel([&](size_t t) {
+      typedef Eigen::Matrix<double, NW, 1> Inner;
+      typedef Eigen::AutoDiffScalar<Inner> AD1;
+      typedef Eigen::AutoDiffScalar<Eigen::Matrix<AD1, NW, 1>> AD2;
+      AD2 w[NW], f[NF];
+      for (int j = 0; j < NW; j++) {
+        w[j].value() = AD1(x[Column(t, j)], NW, j);
+        w[j].derivatives() = Eigen::Matrix<AD1, NW, 1>::Zero();
+        w[j].derivatives()[j] = AD1(1.0, Inner::Zero());
+      }
+      Predict(w, f);
+      Eigen::Matrix<double, NW, NW> h = Eigen::Matrix<double, NW, NW>::Zero();
+      for (int k = 0; k < NF; k++) {
+        double l = lambda[k * N + t];
+        for (int i = 0; i < NW; i++) {
+          h.row(i) -= l * f[k].derivatives()[i].derivatives().transpose();
+        }
+      }
+      size_t slot = HessianSlot(t);
+      for (int j = 0; j < NW; j++) {
+        for (int i = 0; i <= j; i++) {
+          values[slot++] = h(j, i);
+        }
+      }
+    });
+    // the cost's Hessian is constant
+    for (size_t i = 0; i < cost_hess_slots.size(); i++) {
+      values[cost_hess_slots[i]] += obj_factor * cost_hess_values[i];
+    }
+    return true;
+  }
+
+  void finalize_solution(Ipopt::SolverReturn status, Index n, const Number *x,
+                         const Number *z_L, const Number *z_U, Index m,
+                         const Number *g, const Number *lambda,
+                         Number obj_value, const Ipopt::IpoptData *ip_data,
+                         Ipopt::IpoptCalculatedQuantities *ip_cq) override {
+    this->status = status;
+    this->x.assign(x, x + n);
+    this->obj_value = obj_value;
+  }
+
+  // the solution
+  Ipopt::SolverReturn status = Ipopt::UNASSIGNED;
+  std::vector<double> x;
+  double obj_value = 0.0;
+
+  // what the problem keeps in place of a tape: the sparsity patterns and
+  // value slots of g, its Jacobian and the Hessian
+  size_t Bytes() const {
+    return (jac_rows.capacity() + jac_cols.capacity() +
+            hess_rows.capacity() + hess_cols.capacity()) *
+               sizeof(Index) +
+           cost_hess_slots.capacity() * sizeof(size_t) +
+           (cost_hess_values.capacity() + g_values.capacity() +
+            jac_values.capacity() + x.capacity()) *
+               sizeof(double);
+  }
+
+ private:
+  // The variable w_j of stage t.
+  size_t Column(size_t t, int j) const {
+    if (j < EPSI) {
+      return j * N + t - 1;
+    }
+    if (j == EPSI) {
+      return layout.epsi_start + t - 1;
+    }
+    return (j == DELTA ? layout.delta_start : layout.a_start) + t - 1;
+  }
+
+  // First slot of stage t in the Jacobian and the Hessian. The Jacobian
+  // starts with the NF rows fixing the initial state.
+  size_t JacobianSlot(size_t t) const { return NF + (t - 1) * NF * (1 + NW); }
+  size_t HessianSlot(size_t t) const { return (t - 1) * NW * (NW + 1) / 2; }
+
+  // Runs fn(t) for every stage, on the pool if there is one.
+  template <class Fn>
+  void Parallel(Fn fn) {
+    auto slice = [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        fn(i + 1);
+      }
+    };
+    if (pool != nullptr) {
+      pool->Run(N - 1, slice);
+    } else {
+      slice(0, N - 1);
+    }
+  }
+
+  // The sparsity patterns. In the Jacobian, row k * N + t of stage t has
+  // a 1 for vars[k * N + t] and -df_k/dw. In the Hessian (lower triangle)
+  // each stage has a dense block over its w, the cost's entries are added
+  // to those or get their own slots.
+  void Layout() {
+    for (int k = 0; k < NF; k++) {
+      jac_rows.push_back(k * N);
+      jac_cols.push_back(k * N);
+    }
+    for (size_t t = 1; t < N; t++) {
+      for (int k = 0; k < NF; k++) {
+        jac_rows.push_back(k * N + t);
+        jac_cols.push_back(k * N + t);
+        for (int j = 0; j < NW; j++) {
+          jac_rows.push_back(k * N + t);
+          jac_cols.push_back(Column(t, j));
+        }
+      }
+    }
+    jac_values.assign(jac_rows.size(), 0.0);
+    g_values.assign(gl.size(), 0.0);
+    for (int k = 0; k < NF; k++) {
+      jac_values[k] = 1.0;
+    }
+
+    // Column() grows with j, so (w_j, w_i) for i <= j is in the lower half
+    std::map<std::pair<size_t, size_t>, size_t> slots;
+    for (size_t t = 1; t < N; t++) {
+      for (int j = 0; j < NW; j++) {
+        for (int i = 0; i <= j; i++) {
+          slots[std::make_pair(Column(t, j), Column(t, i))] = hess_rows.size();
+          hess_rows.push_back(Column(t, j));
+          hess_cols.push_back(Column(t, i));
+        }
+      }
+    }
+    // 2 J^T J from the residuals' Jacobian J
+    std::vector<size_t> rows, cols;
+    std::vector<double> vals;
+    Objective::Jacobian(layout, config, &rows, &cols, &vals);
+    // entries of a row are next to each other
+    for (size_t a = 0; a < rows.size(); a++) {
+      for (size_t b = a; b < rows.size() && rows[b] == rows[a]; b++) {
+        auto key = std::make_pair(std::max(cols[a], cols[b]),
+                                  std::min(cols[a], cols[b]));
+        if (slots.find(key) == slots.end()) {
+          slots[key] = hess_rows.size();
+          hess_rows.push_back(key.first);
+          hess_cols.push_back(key.second);
+        }
+        cost_hess_slots.push_back(slots[key]);
+        cost_hess_values.push_back(2.0 * vals[a] * vals[b]);
+      }
+    }
+  }
+
+  // g and its Jacobian at x, once per new x.
+  void Linearize(const Number *x) {
+    if (!stale) {
+      return;
+    }
+    for (int k = 0; k < NF; k++) {
+      g_values[k * N] = x[k * N];
+    }
+    Parallel([&](size_t t) {
+      typedef Eigen::AutoDiffScalar<Eigen::Matrix<double, NW, 1>> AD;
+      AD w[NW], f[NF];
+      for (int j = 0; j < NW; j++) {
+        w[j] = AD(x[Column(t, j)], NW, j);
+      }
+      Predict(w, f);
+      size_t slot = JacobianSlot(t);
+      for (int k = 0; k < NF; k++) {
+        g_values[k * N + t] = x[k * N + t] - f[k].value();
+        jac_values[slot++] = 1.0;
+        for (int j = 0; j < NW; j++) {
+          jac_values[slot++] = -f[k].derivatives()[j];
+        }
+      }
+    });
+    stale = false;
+  }
+
+  const MPCConfig &config;
+  const VarLayout &layout;
+  const size_t N;
+  double poly[4];
+  StagePool *pool;
+
+  const std::vector<double> &xi, &xl, &xu, &gl, &gu;
+
+  std::vector<Index> jac_rows, jac_cols;
+  std::vector<Index> hess_rows, hess_cols;
+  std::vector<size_t> cost_hess_slots;
+  std::vector<double> cost_hess_values;
+
+  // g and its Jacobian at the last x seen
+  bool stale;
+  std::vector<double> g_values;
+  std::vector<double> jac_values;
+};
+
+// Ipopt options in CppAD::ipopt::solve's format ("Integer print_level 0",
+// "Numeric tol 1e-6", "String mu_strategy adaptive"); CppAD's own
+// ("Sparse", "Retape") don't apply.
+inline bool SetIpoptOptions(const std::string &options,
+                            Ipopt::OptionsList *list) {
+  std::istringstream lines(options);
+  std::string line;
+  bool ok = true;
+  while (std::getline(lines, line)) {
+    std::istringstream words(line);
+    std::string type, name, value;
+    if (!(words >> type >> name >> value)) {
+      continue;
+    }
+    if (type == "Integer") {
+      ok &= list->SetIntegerValue(name, atoi(value.c_str()));
+    } else if (type == "Numeric") {
+      ok &= list->SetNumericValue(name, atof(value.c_str()));
+    } else if (type == "String") {
+      ok &= list->SetStringValue(name, value);
+    }
+  }
+  return ok;
+}
+
+// Same interface as CppAD::ipopt::solve. `bytes`, if given, gets
+// StageNLP::Bytes() of the problem.
+template <class Model, class Objective, class Dvector>
+void SolveStages(const std::string &options, const MPCConfig &config,
+                 const VarLayout &layout, const Eigen::VectorXd &coeffs,
+                 StagePool *pool, const Dvector &xi, const Dvector &xl,
+                 const Dvector &xu, const Dvector &gl, const Dvector &gu,
+                 CppAD::ipopt::solve_result<Dvector> &solution,
+                 size_t *bytes = nullptr) {
+  typedef CppAD::ipopt::solve_result<Dvector> Result;
+  std::vector<double> x0(xi.size()), x_l(xi.size()), x_u(xi.size());
+  for (size_t i = 0; i < xi.size(); i++) {
+    x0[i] = xi[i];
+    x_l[i] = xl[i];
+    x_u[i] = xu[i];
+  }
+  std::vector<double> g_l(gl.size()), g_u(gl.size());
+  for (size_t i = 0; i < gl.size(); i++) {
+    g_l[i] = gl[i];
+    g_u[i] = gu[i];
+  }
+  StageNLP<Model, Objective> *stages = new StageNLP<Model, Objective>(
+      config, layout, coeffs, pool, x0, x_l, x_u, g_l, g_u);
+  // Ipopt owns the problem through the smart pointer
+  Ipopt::SmartPtr<Ipopt::TNLP> nlp = stages;
+
+  // a failed solve returns the starting point with status unknown, so
+  // the caller can always read x
+  Ipopt::SmartPtr<Ipopt::IpoptApplication> app = IpoptApplicationFactory();
+  solution.status = Result::unknown;
+  solution.x.resize(xi.size());
+  for (size_t i = 0; i < xi.size(); i++) {
+    solution.x[i] = xi[i];
+  }
+  if (!SetIpoptOptions(options, GetRawPtr(app->Options())) ||
+      app->Initialize() != Ipopt::Solve_Succeeded) {
+    return;
+  }
+  app->OptimizeTNLP(nlp);
+  if (bytes) {
+    *bytes = stages->Bytes();
+  }
+
+  // finalize_solution isn't called if Ipopt gave up before the first
+  // iterate
+  if (stages->x.size() != xi.size()) {
+    return;
+  }
+  for (size_t i = 0; i < stages->x.size(); i++) {
+    solution.x[i] = stages->x[i];
+  }
+  solution.obj_value = stages->obj_value;
+  switch (stages->status) {
+    case Ipopt::SUCCESS:
+      solution.status = Result::success;
+      break;
+    case Ipopt::MAXITER_EXCEEDED:
+      solution.status = Result::maxiter_exceeded;
+      break;
+    case Ipopt::STOP_AT_ACCEPTABLE_POINT:
+      solution.status = Result::stop_at_acceptable_point;
+      break;
+    default:
+      break;
+  }
+}
+
+#endif /* STAGE_NLP_H */
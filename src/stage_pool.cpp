@@ -0,0 +1,67 @@
+#include "stage_pool.h"
+
+// how many times a thread polls for the next range before sleeping;
+// roughly the gap between two Ipopt callbacks
+static const int kSpins = 20000;
+
+StagePool::StagePool(int n_threads)
+    : slice(nullptr), n(0), generation(0), pending(0), stop(false) {
+  for (int i = 1; i < n_threads; i++) {
+    threads.emplace_back(&StagePool::Work, this, i);
+  }
+}
+
+StagePool::~StagePool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  wake.notify_all();
+  for (auto &t : threads) {
+    t.join();
+  }
+}
+
+void StagePool::Run(size_t n, const Slice &fn) {
+  std::unique_lock<std::mutex> lock(busy, std::try_to_lock);
+  if (!lock.owns_lock() || threads.empty() || n < 2) {
+    fn(0, n);
+    return;
+  }
+  this->slice = &fn;
+  this->n = n;
+  pending = static_cast<int>(threads.size());
+  {
+    std::lock_guard<std::mutex> wake_lock(mutex);
+    generation++;
+  }
+  wake.notify_all();
+
+  fn(0, n / size());
+
+  while (pending.load() > 0) {
+    std::this_thread::yield();
+  }
+}
+
+void StagePool::Work(int id) {
+  size_t seen = 0;
+  for (;;) {
+    for (int i = 0; i < kSpins && generation.load() == seen; i++) {
+    }
+    if (generation.load() == seen) {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&] { return stop || generation.load() != seen; });
+      if (stop) {
+        return;
+      }
+    }
+    seen = generation.load();
+    size_t begin = n * id / size();
+    size_t end = n * (id + 1) / size();
+    if (begin < end) {
+      (*slice)(begin, end);
+    }
+    pending--;
+  }
+}
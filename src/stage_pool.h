@@ -0,0 +1,56 @@
+#ifndef STAGE_POOL_H
+#define STAGE_POOL_H
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+A small persistent thread pool for the per-stage work inside one solve
+(see stage_nlp.h). Run() splits a range of stages into one contiguous
+slice per thread, the calling thread takes the first, and returns when
+all are done.
+
+Ipopt calls back a few times per iteration, each call is a few hundred
+microseconds of work at most, so the threads spin briefly for the next
+call before going to sleep, and there is no queue: a pool runs one range
+at a time. A solve that finds the pool busy (another vehicle of the
+batch, say) runs its range on its own thread instead of waiting.
+*/
+class StagePool {
+ public:
+  typedef std::function<void(size_t begin, size_t end)> Slice;
+
+  // `n_threads` counts the calling thread, so n_threads - 1 are started.
+  explicit StagePool(int n_threads);
+  virtual ~StagePool();
+
+  int size() const { return static_cast<int>(threads.size()) + 1; }
+
+  // Calls fn on disjoint slices covering [0, n).
+  void Run(size_t n, const Slice &fn);
+
+ private:
+  void Work(int id);
+
+  // one Run() at a time
+  std::mutex busy;
+
+  // the current range, valid while `pending` > 0
+  const Slice *slice;
+  size_t n;
+  std::atomic<size_t> generation;
+  std::atomic<int> pending;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stop;
+
+  std::vector<std::thread> threads;
+};
+
+#endif /* STAGE_POOL_H */
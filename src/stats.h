@@ -0,0 +1,32 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// Milliseconds elapsed since `start`.
+inline double MsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start).count();
+}
+
+// The p-th percentile (0-100) of `vals`, nearest rank. 0 if empty.
+inline double Percentile(std::vector<double> vals, double p) {
+  if (vals.empty()) {
+    return 0.0;
+  }
+  size_t k = static_cast<size_t>(p / 100.0 * (vals.size() - 1) + 0.5);
+  std::nth_element(vals.begin(), vals.begin() + k, vals.end());
+  return vals[k];
+}
+
+inline double Mean(const std::vector<double> &vals) {
+  double sum = 0.0;
+  for (double v : vals) {
+    sum += v;
+  }
+  return vals.empty() ? 0.0 : sum / vals.size();
+}
+
+#endif /* STATS_H */
@@ -0,0 +1,114 @@
+#include "terminal_cost.h"
+#include <math.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "json.hpp"
+
+// for convenience
+using json = nlohmann::json;
+
+Eigen::Matrix2d TerminalTable::At(double v) const {
+  if (speeds.empty()) {
+    return Eigen::Matrix2d::Zero();
+  }
+  if (v <= speeds.front()) {
+    return P.front();
+  }
+  if (v >= speeds.back()) {
+    return P.back();
+  }
+  size_t i = 1;
+  while (speeds[i] < v) {
+    i++;
+  }
+  double f = (v - speeds[i - 1]) / (speeds[i] - speeds[i - 1]);
+  return (1.0 - f) * P[i - 1] + f * P[i];
+}
+
+static bool Close(double a, double b) {
+  return fabs(a - b) <= 1e-9 * std::max(fabs(a), fabs(b));
+}
+
+bool TerminalTable::Matches(const MPCConfig &config) const {
+  return integrator == config.integrator && Close(dt, config.dt) &&
+         Close(weight_cet, config.weight_cet) &&
+         Close(weight_epsi, config.weight_epsi) &&
+         Close(weight_delta, config.weight_delta);
+}
+
+size_t TerminalTable::Bytes() const {
+  return sizeof(TerminalTable) + speeds.capacity() * sizeof(double) +
+         P.capacity() * sizeof(Eigen::Matrix2d);
+}
+
+bool LoadTerminalTable(const std::string &path, TerminalTable *table) {
+  std::ifstream in(path);
+  if (!in) {
+    return false;
+  }
+  std::stringstream text;
+  text << in.rdbuf();
+  json j;
+  try {
+    j = json::parse(text.str());
+    TerminalTable parsed;
+    parsed.model = j["model"].get<std::string>();
+    // tables from before the integrators were solved for Euler
+    if (j.find("integrator") != j.end()) {
+      parsed.integrator = j["integrator"].get<std::string>();
+    }
+    parsed.dt = j["dt"];
+    parsed.weight_cet = j["weight_cet"];
+    parsed.weight_epsi = j["weight_epsi"];
+    parsed.weight_delta = j["weight_delta"];
+    parsed.speeds = j["speeds"].get<std::vector<double>>();
+    // row-major, 4 values per speed
+    for (const auto &p : j["P"]) {
+      std::vector<double> values = p.get<std::vector<double>>();
+      if (values.size() != 4) {
+        return false;
+      }
+      parsed.P.push_back(
+          Eigen::Map<Eigen::Matrix<double, 2, 2, Eigen::RowMajor>>(
+              values.data()));
+    }
+    if (parsed.speeds.empty() || parsed.P.size() != parsed.speeds.size()) {
+      return false;
+    }
+    for (size_t i = 1; i < parsed.speeds.size(); i++) {
+      if (parsed.speeds[i] <= parsed.speeds[i - 1]) {
+        return false;
+      }
+    }
+    *table = parsed;
+  } catch (const std::exception &) {
+    return false;
+  }
+  return true;
+}
+
+bool SaveTerminalTable(const std::string &path, const TerminalTable &table) {
+  json j;
+  j["model"] = table.model;
+  j["integrator"] = table.integrator;
+  j["dt"] = table.dt;
+  j["weight_cet"] = table.weight_cet;
+  j["weight_epsi"] = table.weight_epsi;
+  j["weight_delta"] = table.weight_delta;
+  j["speeds"] = table.speeds;
+  json P = json::array();
+  for (const auto &p : table.P) {
+    std::vector<double> values;
+    for (int r = 0; r < 2; r++) {
+      for (int c = 0; c < 2; c++) {
+        values.push_back(p(r, c));
+      }
+    }
+    P.push_back(values);
+  }
+  j["P"] = P;
+  std::ofstream out(path);
+  out << j.dump(2) << std::endl;
+  return static_cast<bool>(out);
+}
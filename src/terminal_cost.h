@@ -0,0 +1,70 @@
+#ifndef TERMINAL_COST_H
+#define TERMINAL_COST_H
+
+#include <string>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "config.h"
+
+/*
+Terminal cost from the infinite-horizon LQR.
+
+Linearized around driving straight along the reference at speed v, the
+lateral errors of the kinematic model
+
+  e = (cte - ref_cte, epsi - ref_epsi)
+
+follow, per step of dt with the Euler error step of the original
+constraints,
+
+  cte'  = cte + v * dt * epsi
+  epsi' = epsi + v / Lf * dt * delta
+
+With rk2, rk4 or euler_integrated the errors are those of the integrated
+state (see ErrorStep in vehicle_model.h), and cte' = cte - v * dt * epsi
+plus the scheme's higher-order terms in delta. `lqr_terminal` linearizes
+the step the solvers take with the config's integrator, not these
+formulas.
+
+Driving them to 0 over an unlimited horizon with the weights of the
+config costs e^T P e, where P solves the discrete algebraic Riccati
+equation. `lqr_terminal` solves it offline on a grid of speeds and writes
+the table. With `terminal_table` set in the config, every solve adds
+e^T P(v) e at the last stage, for the car's speed v after the latency
+prediction. That stands in for the part of the road beyond the horizon.
+
+The speed error is left out. Beyond the horizon the road bends, and the
+cost-to-go of reaching ref_v on a straight sends the car into the
+corners too fast. The rate weights are left out too: the table's state
+has no previous actuation.
+*/
+
+// One matrix per speed, for the errors e above.
+struct TerminalTable {
+  // what the table was solved for
+  std::string model = "kinematic";
+  std::string integrator = "euler";
+  double dt = 0.0;
+  double weight_cet = 0.0;
+  double weight_epsi = 0.0;
+  double weight_delta = 0.0;
+
+  // ascending
+  std::vector<double> speeds;
+  std::vector<Eigen::Matrix2d, Eigen::aligned_allocator<Eigen::Matrix2d>> P;
+
+  // Linear interpolation between the grid speeds, the nearest end
+  // outside them.
+  Eigen::Matrix2d At(double v) const;
+
+  // Whether the table was solved for the dt, integrator and weights of
+  // `config`.
+  bool Matches(const MPCConfig &config) const;
+
+  size_t Bytes() const;
+};
+
+bool LoadTerminalTable(const std::string &path, TerminalTable *table);
+bool SaveTerminalTable(const std::string &path, const TerminalTable &table);
+
+#endif /* TERMINAL_COST_H */
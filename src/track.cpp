@@ -0,0 +1,49 @@
+#include "track.h"
+#include <math.h>
+#include <fstream>
+#include <sstream>
+
+bool LoadTrack(const string &path, Track *track) {
+  ifstream in(path);
+  if (!in) {
+    return false;
+  }
+  string line;
+  // skip the "x,y" header
+  getline(in, line);
+  track->x.clear();
+  track->y.clear();
+  while (getline(in, line)) {
+    istringstream fields(line);
+    double x, y;
+    char comma;
+    if (fields >> x >> comma >> y) {
+      track->x.push_back(x);
+      track->y.push_back(y);
+    }
+  }
+  return track->x.size() > 3;
+}
+
+Telemetry TelemetryOnTrack(const Track &track, int index, double along,
+                           double offset, double dpsi, double speed,
+                           int n_pts) {
+  int n = track.x.size();
+  int i0 = ((index % n) + n) % n;
+  int i1 = (i0 + 1) % n;
+  double dx = track.x[i1] - track.x[i0];
+  double dy = track.y[i1] - track.y[i0];
+  double heading = atan2(dy, dx);
+
+  Telemetry t;
+  t.x = track.x[i0] + along * dx - offset * sin(heading);
+  t.y = track.y[i0] + along * dy + offset * cos(heading);
+  t.psi = heading + dpsi;
+  t.speed = speed;
+  // the simulator sends waypoints starting just behind the car
+  for (int k = 0; k < n_pts; k++) {
+    t.ptsx.push_back(track.x[(i0 + k) % n]);
+    t.ptsy.push_back(track.y[(i0 + k) % n]);
+  }
+  return t;
+}
@@ -0,0 +1,27 @@
+#ifndef TRACK_H
+#define TRACK_H
+
+#include <string>
+#include <vector>
+#include "wire.h"
+
+using namespace std;
+
+// Waypoints of a closed track, e.g. lake_track_waypoints.csv.
+struct Track {
+  vector<double> x;
+  vector<double> y;
+};
+
+// Read an "x,y" CSV with a header line. Returns false if it can't be read.
+bool LoadTrack(const string &path, Track *track);
+
+// Telemetry the simulator would send for a car near waypoint `index`:
+// `along` is the fraction of the way to the next waypoint, `offset` the
+// lateral offset (left positive) and `dpsi` the heading error against the
+// track. ptsx/ptsy hold the next `n_pts` waypoints like the simulator does.
+Telemetry TelemetryOnTrack(const Track &track, int index, double along,
+                           double offset, double dpsi, double speed,
+                           int n_pts = 6);
+
+#endif /* TRACK_H */
@@ -0,0 +1,265 @@
+#ifndef VEHICLE_MODEL_H
+#define VEHICLE_MODEL_H
+
+#include <stddef.h>
+#include <cmath>
+
+/*
+Process models for the MPC.
+
+A model is a struct with
+
+  n_state, n_input            state and actuator counts
+  X, Y, PSI, V, ...           state indices, every model starts with the
+                              position, heading and forward speed
+  DELTA, A                    actuator indices
+  derivative<T>(state, input, rate)
+                              the continuous-time equations
+  step<T>(state, input, dt, next)
+                              one time step of the model, explicit Euler
+                              in `substeps` steps
+  cte_rate<T>(state, epsi)    how fast the car moves across the reference
+  integrated_errors           false: cte and epsi are stepped along with
+                              the model, cte by one Euler step of
+                              cte_rate; true: they are the errors of the
+                              integrated state (ReferenceErrors)
+
+The solver is instantiated once per model (FG_eval<Model> in MPC.cpp), so
+the model is inlined into the AD inner loop and nothing is dispatched per
+evaluation. `T` is double, CppAD::AD<double> or Eigen's AutoDiffScalar;
+the math functions are called unqualified so the AD overloads are found
+by argument lookup. The constants are defined in MPC.cpp.
+
+Midpoint<Model> and RungeKutta4<Model> are the same model integrated with
+a higher order scheme (MPCConfig::integrator), for a larger dt at the
+same prediction error. They are models in their own right and are
+instantiated the same way. An Euler step of cte would undo their
+accuracy, so they take both errors from the integrated state.
+IntegratedEuler<Model> keeps the Euler step and takes the errors the same
+way, so the schemes can be compared on the same errors.
+*/
+
+// Kinematic bicycle: no tire forces, the car goes where the wheels point.
+struct KinematicModel {
+  static const size_t n_state = 4;
+  static const size_t n_input = 2;
+  enum { X, Y, PSI, V };
+  enum { DELTA, A };
+
+  // set the length from front to CoG that has a similar radius.
+  static constexpr double Lf = 2.67;
+  static const int substeps = 1;
+  static const bool integrated_errors = false;
+
+  template <typename T>
+  static void derivative(const T *s, const T *u, T *rate) {
+    using std::cos;
+    using std::sin;
+    rate[X] = s[V] * cos(s[PSI]);
+    rate[Y] = s[V] * sin(s[PSI]);
+    rate[PSI] = s[V] * u[DELTA] / Lf;
+    rate[V] = u[A];
+  }
+
+  // Recall the equations for the model:
+  // x_[t+1] = x[t] + v[t] * cos(psi[t]) * dt
+  // y_[t+1] = y[t] + v[t] * sin(psi[t]) * dt
+  // psi_[t+1] = psi[t] + v[t] / Lf * delta[t] * dt
+  // v_[t+1] = v[t] + a[t] * dt
+  template <typename T>
+  static void step(const T *s, const T *u, double dt, T *next) {
+    using std::cos;
+    using std::sin;
+    next[X] = s[X] + s[V] * cos(s[PSI]) * dt;
+    next[Y] = s[Y] + s[V] * sin(s[PSI]) * dt;
+    next[PSI] = s[PSI] + s[V] * u[DELTA] / Lf * dt;
+    next[V] = s[V] + u[A] * dt;
+  }
+
+  template <typename T>
+  static T cte_rate(const T *s, const T &epsi) {
+    using std::sin;
+    return s[V] * sin(epsi);
+  }
+};
+
+// Dynamic bicycle with a linear tire model, for high speed where the
+// kinematic model's no-slip assumption breaks down. Lateral velocity `VY`
+// and yaw rate `R` are extra states; speeds are in the same units as the
+// kinematic model so the two share weights and reference speed.
+struct DynamicModel {
+  static const size_t n_state = 6;
+  static const size_t n_input = 2;
+  enum { X, Y, PSI, V, VY, R };
+  enum { DELTA, A };
+
+  // front and rear axle to CoG, together the kinematic model's Lf so both
+  // models turn the same at low speed; the rear is longer so the car
+  // understeers and stays stable at any speed
+  static constexpr double Lf = 1.2;
+  static constexpr double Lr = 1.47;
+  // mass and yaw inertia
+  static constexpr double m = 1500.0;
+  static constexpr double Iz = 2500.0;
+  // cornering stiffness of the front and rear axle, per radian of slip;
+  // effective values, speeds are the simulator's mph as everywhere else
+  static constexpr double Cf = 90000.0;
+  static constexpr double Cr = 90000.0;
+  // The linear tire model is stiff at low speed, where explicit Euler
+  // would diverge: the slip angles divide by v + min_speed and every
+  // step is integrated in a few substeps. The steering term is scaled
+  // the same way so a standing car doesn't slide sideways.
+  static constexpr double min_speed = 10.0;
+  static const int substeps = 4;
+  static const bool integrated_errors = false;
+
+  template <typename T>
+  static void derivative(const T *s, const T *u, T *rate) {
+    using std::cos;
+    using std::sin;
+    T psi = s[PSI], v = s[V], vy = s[VY], r = s[R];
+    // slip angles and lateral tire forces
+    T alpha_f = (u[DELTA] * v - vy - Lf * r) / (v + min_speed);
+    T alpha_r = -(vy - Lr * r) / (v + min_speed);
+    T Fyf = Cf * alpha_f;
+    T Fyr = Cr * alpha_r;
+
+    rate[X] = v * cos(psi) - vy * sin(psi);
+    rate[Y] = v * sin(psi) + vy * cos(psi);
+    rate[PSI] = r;
+    rate[V] = u[A] + vy * r;
+    rate[VY] = (Fyf * cos(u[DELTA]) + Fyr) / m - v * r;
+    rate[R] = (Lf * Fyf * cos(u[DELTA]) - Lr * Fyr) / Iz;
+  }
+
+  template <typename T>
+  static void step(const T *s, const T *u, double dt, T *next) {
+    const double h = dt / substeps;
+    T z[n_state], rate[n_state];
+    for (size_t k = 0; k < n_state; k++) {
+      z[k] = s[k];
+    }
+    for (int i = 0; i < substeps; i++) {
+      derivative(z, u, rate);
+      for (size_t k = 0; k < n_state; k++) {
+        z[k] = z[k] + rate[k] * h;
+      }
+    }
+    for (size_t k = 0; k < n_state; k++) {
+      next[k] = z[k];
+    }
+  }
+
+  template <typename T>
+  static T cte_rate(const T *s, const T &epsi) {
+    using std::cos;
+    using std::sin;
+    return s[V] * sin(epsi) + s[VY] * cos(epsi);
+  }
+};
+
+// The model's own Euler step, with the errors of the integrated state
+// rather than stepped along with it.
+template <class Model>
+struct IntegratedEuler : Model {
+  static const bool integrated_errors = true;
+};
+
+// The explicit midpoint rule (RK2), in the model's substeps. Two
+// evaluations of the equations per substep, error O(h^2) per unit time.
+template <class Model>
+struct Midpoint : Model {
+  static const bool integrated_errors = true;
+
+  template <typename T>
+  static void step(const T *s, const T *u, double dt, T *next) {
+    const size_t n = Model::n_state;
+    const double h = dt / Model::substeps;
+    T z[n], mid[n], rate[n];
+    for (size_t k = 0; k < n; k++) {
+      z[k] = s[k];
+    }
+    for (int i = 0; i < Model::substeps; i++) {
+      Model::derivative(z, u, rate);
+      for (size_t k = 0; k < n; k++) {
+        mid[k] = z[k] + rate[k] * (h / 2);
+      }
+      Model::derivative(mid, u, rate);
+      for (size_t k = 0; k < n; k++) {
+        z[k] = z[k] + rate[k] * h;
+      }
+    }
+    for (size_t k = 0; k < n; k++) {
+      next[k] = z[k];
+    }
+  }
+};
+
+// The classic fourth order Runge-Kutta, in the model's substeps. Four
+// evaluations per substep, error O(h^4) per unit time.
+template <class Model>
+struct RungeKutta4 : Model {
+  static const bool integrated_errors = true;
+
+  template <typename T>
+  static void step(const T *s, const T *u, double dt, T *next) {
+    const size_t n = Model::n_state;
+    const double h = dt / Model::substeps;
+    T z[n], stage[n], k1[n], k2[n], k3[n], k4[n];
+    for (size_t k = 0; k < n; k++) {
+      z[k] = s[k];
+    }
+    for (int i = 0; i < Model::substeps; i++) {
+      Model::derivative(z, u, k1);
+      for (size_t k = 0; k < n; k++) {
+        stage[k] = z[k] + k1[k] * (h / 2);
+      }
+      Model::derivative(stage, u, k2);
+      for (size_t k = 0; k < n; k++) {
+        stage[k] = z[k] + k2[k] * (h / 2);
+      }
+      Model::derivative(stage, u, k3);
+      for (size_t k = 0; k < n; k++) {
+        stage[k] = z[k] + k3[k] * h;
+      }
+      Model::derivative(stage, u, k4);
+      for (size_t k = 0; k < n; k++) {
+        z[k] = z[k] + (k1[k] + 2.0 * k2[k] + 2.0 * k3[k] + k4[k]) * (h / 6);
+      }
+    }
+    for (size_t k = 0; k < n; k++) {
+      next[k] = z[k];
+    }
+  }
+};
+
+// The errors of the model state `s` against the reference polynomial
+// `poly` (4 coefficients): cte = f(x) - y and epsi = psi - atan(f'(x)).
+template <class Model, typename T, class Poly>
+void ReferenceErrors(const Poly &poly, const T *s, T *cte, T *epsi) {
+  using std::atan2;
+  T x = s[Model::X];
+  *cte = poly[0] + poly[1] * x + poly[2] * x * x + poly[3] * x * x * x -
+         s[Model::Y];
+  *epsi = s[Model::PSI] -
+          atan2(poly[1] + 2 * poly[2] * x + 3 * poly[3] * x * x, T(1));
+}
+
+// The errors at t+1 from the state s0 at t, its error epsi0 and the
+// model's prediction s1, as the MPC's constraints carry them.
+template <class Model, typename T, class Poly>
+void ErrorStep(const Poly &poly, const T *s0, const T &epsi0, const T *s1,
+               double dt, T *cte1, T *epsi1) {
+  using std::atan2;
+  if (Model::integrated_errors) {
+    ReferenceErrors<Model>(poly, s1, cte1, epsi1);
+    return;
+  }
+  T x0 = s0[Model::X];
+  T f0 = poly[0] + poly[1] * x0 + poly[2] * x0 * x0 + poly[3] * x0 * x0 * x0;
+  T psides0 = atan2(poly[1] + 2 * poly[2] * x0 + 3 * poly[3] * x0 * x0, T(1));
+  *cte1 = (f0 - s0[Model::Y]) + Model::cte_rate(s0, epsi0) * dt;
+  *epsi1 = (s0[Model::PSI] - psides0) + (s1[Model::PSI] - s0[Model::PSI]);
+}
+
+#endif /* VEHICLE_MODEL_H */
@@ -0,0 +1,386 @@
+#include "wire.h"
+#include <string.h>
+#include <fstream>
+
+// for convenience
+using json = nlohmann::json;
+
+string hasData(string s) {
+  auto found_null = s.find("null");
+  auto b1 = s.find_first_of("[");
+  auto b2 = s.rfind("}]");
+  if (found_null != string::npos) {
+    return "";
+  } else if (b1 != string::npos && b2 != string::npos) {
+    return s.substr(b1, b2 - b1 + 2);
+  }
+  return "";
+}
+
+// data[key] as a number, false if it is missing or isn't one.
+static bool ReadNumber(const json &data, const char *key, double *value) {
+  auto it = data.find(key);
+  if (it == data.end() || !it->is_number()) {
+    return false;
+  }
+  *value = *it;
+  return true;
+}
+
+// data[key] as an array of numbers.
+static bool ReadNumbers(const json &data, const char *key,
+                        vector<double> *values) {
+  auto it = data.find(key);
+  if (it == data.end() || !it->is_array()) {
+    return false;
+  }
+  values->clear();
+  for (const auto &v : *it) {
+    if (!v.is_number()) {
+      return false;
+    }
+    values->push_back(v);
+  }
+  return true;
+}
+
+bool TelemetryFromJson(const json &data, Telemetry *t) {
+  if (!data.is_object() || !ReadNumbers(data, "ptsx", &t->ptsx) ||
+      !ReadNumbers(data, "ptsy", &t->ptsy) ||
+      !ReadNumber(data, "x", &t->x) || !ReadNumber(data, "y", &t->y) ||
+      !ReadNumber(data, "psi", &t->psi) ||
+      !ReadNumber(data, "speed", &t->speed)) {
+    return false;
+  }
+  // the simulator always sends these, recorded logs may not
+  if (data.find("steering_angle") != data.end() &&
+      !ReadNumber(data, "steering_angle", &t->steering_angle)) {
+    return false;
+  }
+  if (data.find("throttle") != data.end() &&
+      !ReadNumber(data, "throttle", &t->throttle)) {
+    return false;
+  }
+  // [[x, y, radius], ...], only from our own clients
+  t->obstacles.clear();
+  if (data.find("obstacles") != data.end()) {
+    if (!data["obstacles"].is_array()) {
+      return false;
+    }
+    for (const auto &o : data["obstacles"]) {
+      if (!o.is_array() || o.size() != 3 || !o[0].is_number() ||
+          !o[1].is_number() || !o[2].is_number()) {
+        return false;
+      }
+      t->obstacles.push_back({o[0], o[1], o[2]});
+    }
+  }
+  return t->ptsx.size() == t->ptsy.size() &&
+         t->ptsx.size() >= kMinWaypoints;
+}
+
+json TelemetryToJson(const Telemetry &t) {
+  json data;
+  data["ptsx"] = t.ptsx;
+  data["ptsy"] = t.ptsy;
+  data["x"] = t.x;
+  data["y"] = t.y;
+  data["psi"] = t.psi;
+  data["speed"] = t.speed;
+  data["steering_angle"] = t.steering_angle;
+  data["throttle"] = t.throttle;
+  if (!t.obstacles.empty()) {
+    json obstacles = json::array();
+    for (const auto &o : t.obstacles) {
+      obstacles.push_back({o.x, o.y, o.radius});
+    }
+    data["obstacles"] = obstacles;
+  }
+  return data;
+}
+
+bool SteerFromJson(const json &data, Steer *s) {
+  if (!data.is_object() || data.find("steering_angle") == data.end() ||
+      data.find("throttle") == data.end()) {
+    return false;
+  }
+  s->steering_angle = data["steering_angle"];
+  s->throttle = data["throttle"];
+  s->mpc_x.clear();
+  s->mpc_y.clear();
+  s->next_x.clear();
+  s->next_y.clear();
+  if (data.find("mpc_x") != data.end()) {
+    s->mpc_x = data["mpc_x"].get<vector<double>>();
+    s->mpc_y = data["mpc_y"].get<vector<double>>();
+  }
+  if (data.find("next_x") != data.end()) {
+    s->next_x = data["next_x"].get<vector<double>>();
+    s->next_y = data["next_y"].get<vector<double>>();
+  }
+  return true;
+}
+
+json SteerToJson(const Steer &s) {
+  json msgJson;
+  msgJson["steering_angle"] = s.steering_angle;
+  msgJson["throttle"] = s.throttle;
+  msgJson["mpc_x"] = s.mpc_x;
+  msgJson["mpc_y"] = s.mpc_y;
+  msgJson["next_x"] = s.next_x;
+  msgJson["next_y"] = s.next_y;
+  return msgJson;
+}
+
+string TelemetryMessage(const Telemetry &t) {
+  return "42[\"telemetry\"," + TelemetryToJson(t).dump() + "]";
+}
+
+string SteerMessage(const Steer &s) {
+  return "42[\"steer\"," + SteerToJson(s).dump() + "]";
+}
+
+//
+// Binary frames. Everything is written byte by byte in little-endian order
+// so the layout does not depend on the host.
+//
+static void PutU32(string &out, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    out.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+  }
+}
+
+static void PutDouble(string &out, double d) {
+  uint64_t v;
+  memcpy(&v, &d, sizeof(v));
+  for (int i = 0; i < 8; i++) {
+    out.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+  }
+}
+
+static void PutDoubles(string &out, const vector<double> &vals, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    PutDouble(out, vals[i]);
+  }
+}
+
+static void PutHeader(string &out, uint8_t type) {
+  PutU32(out, kWireMagic);
+  out.push_back(static_cast<char>(kWireVersion));
+  out.push_back(static_cast<char>(type));
+  out.push_back(0);
+  out.push_back(0);
+}
+
+static uint32_t GetU32(const char *p) {
+  uint32_t v = 0;
+  for (int i = 0; i < 4; i++) {
+    v |= static_cast<uint32_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+  }
+  return v;
+}
+
+static double GetDouble(const char *p) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) {
+    v |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+  }
+  double d;
+  memcpy(&d, &v, sizeof(d));
+  return d;
+}
+
+static void GetDoubles(const char *&p, vector<double> &vals, size_t n) {
+  vals.resize(n);
+  for (size_t i = 0; i < n; i++, p += 8) {
+    vals[i] = GetDouble(p);
+  }
+}
+
+const size_t kHeaderSize = 8;
+
+string EncodeTelemetry(const Telemetry &t) {
+  size_t n = t.ptsx.size() < t.ptsy.size() ? t.ptsx.size() : t.ptsy.size();
+  string out;
+  out.reserve(kHeaderSize + 4 + 8 * (6 + 2 * n));
+  PutHeader(out, kWireTelemetry);
+  PutU32(out, n);
+  PutDouble(out, t.x);
+  PutDouble(out, t.y);
+  PutDouble(out, t.psi);
+  PutDouble(out, t.speed);
+  PutDouble(out, t.steering_angle);
+  PutDouble(out, t.throttle);
+  PutDoubles(out, t.ptsx, n);
+  PutDoubles(out, t.ptsy, n);
+  // left out without obstacles, so such frames stay readable by any v1 peer
+  if (!t.obstacles.empty()) {
+    PutU32(out, t.obstacles.size());
+    for (const auto &o : t.obstacles) {
+      PutDouble(out, o.x);
+      PutDouble(out, o.y);
+      PutDouble(out, o.radius);
+    }
+  }
+  return out;
+}
+
+string EncodeSteer(const Steer &s) {
+  size_t n_mpc = s.mpc_x.size() < s.mpc_y.size() ? s.mpc_x.size() : s.mpc_y.size();
+  size_t n_next = s.next_x.size() < s.next_y.size() ? s.next_x.size() : s.next_y.size();
+  string out;
+  out.reserve(kHeaderSize + 8 + 8 * (2 + 2 * n_mpc + 2 * n_next));
+  PutHeader(out, kWireSteer);
+  PutU32(out, n_mpc);
+  PutU32(out, n_next);
+  PutDouble(out, s.steering_angle);
+  PutDouble(out, s.throttle);
+  PutDoubles(out, s.mpc_x, n_mpc);
+  PutDoubles(out, s.mpc_y, n_mpc);
+  PutDoubles(out, s.next_x, n_next);
+  PutDoubles(out, s.next_y, n_next);
+  return out;
+}
+
+string EncodeHello() {
+  string out;
+  PutHeader(out, kWireHello);
+  PutU32(out, kWireVersion);
+  return out;
+}
+
+string EncodeManual() {
+  string out;
+  PutHeader(out, kWireManual);
+  return out;
+}
+
+bool WireHeader(const char *data, size_t length, uint8_t *version,
+                uint8_t *type) {
+  if (length < kHeaderSize || GetU32(data) != kWireMagic) {
+    return false;
+  }
+  *version = static_cast<uint8_t>(data[4]);
+  *type = static_cast<uint8_t>(data[5]);
+  return true;
+}
+
+bool DecodeTelemetry(const char *data, size_t length, Telemetry *t) {
+  uint8_t version, type;
+  if (!WireHeader(data, length, &version, &type) ||
+      version != kWireVersion || type != kWireTelemetry ||
+      length < kHeaderSize + 4) {
+    return false;
+  }
+  const char *p = data + kHeaderSize;
+  size_t n = GetU32(p);
+  p += 4;
+  if (n < kMinWaypoints) {
+    return false;
+  }
+  size_t base = kHeaderSize + 4 + 8 * (6 + 2 * n);
+  size_t n_obstacles = 0;
+  if (length >= base + 4) {
+    n_obstacles = GetU32(data + base);
+    if (length != base + 4 + 24 * n_obstacles) {
+      return false;
+    }
+  } else if (length != base) {
+    return false;
+  }
+  t->x = GetDouble(p);
+  t->y = GetDouble(p + 8);
+  t->psi = GetDouble(p + 16);
+  t->speed = GetDouble(p + 24);
+  t->steering_angle = GetDouble(p + 32);
+  t->throttle = GetDouble(p + 40);
+  p += 48;
+  GetDoubles(p, t->ptsx, n);
+  GetDoubles(p, t->ptsy, n);
+  t->obstacles.resize(n_obstacles);
+  p += n_obstacles ? 4 : 0;
+  for (size_t i = 0; i < n_obstacles; i++, p += 24) {
+    t->obstacles[i] = {GetDouble(p), GetDouble(p + 8), GetDouble(p + 16)};
+  }
+  return true;
+}
+
+bool DecodeSteer(const char *data, size_t length, Steer *s) {
+  uint8_t version, type;
+  if (!WireHeader(data, length, &version, &type) ||
+      version != kWireVersion || type != kWireSteer ||
+      length < kHeaderSize + 8) {
+    return false;
+  }
+  const char *p = data + kHeaderSize;
+  size_t n_mpc = GetU32(p);
+  size_t n_next = GetU32(p + 4);
+  p += 8;
+  if (length != kHeaderSize + 8 + 8 * (2 + 2 * n_mpc + 2 * n_next)) {
+    return false;
+  }
+  s->steering_angle = GetDouble(p);
+  s->throttle = GetDouble(p + 8);
+  p += 16;
+  GetDoubles(p, s->mpc_x, n_mpc);
+  GetDoubles(p, s->mpc_y, n_mpc);
+  GetDoubles(p, s->next_x, n_next);
+  GetDoubles(p, s->next_y, n_next);
+  return true;
+}
+
+void WriteFrame(ostream &out, const string &frame) {
+  string length;
+  PutU32(length, frame.size());
+  out.write(length.data(), length.size());
+  out.write(frame.data(), frame.size());
+}
+
+bool ReadFrame(istream &in, string *frame) {
+  char length[4];
+  if (!in.read(length, 4)) {
+    return false;
+  }
+  frame->resize(GetU32(length));
+  return static_cast<bool>(in.read(&(*frame)[0], frame->size()));
+}
+
+bool ReadTelemetryLog(const string &path, vector<Telemetry> *log) {
+  ifstream in(path, ios::binary);
+  if (!in) {
+    return false;
+  }
+  log->clear();
+  // binary logs start with a frame length followed by the magic
+  char head[8];
+  bool binary = in.read(head, 8) && GetU32(head + 4) == kWireMagic;
+  in.clear();
+  in.seekg(0);
+  if (binary) {
+    string frame;
+    while (ReadFrame(in, &frame)) {
+      Telemetry telemetry;
+      if (DecodeTelemetry(frame.data(), frame.size(), &telemetry)) {
+        log->push_back(telemetry);
+      }
+    }
+    return true;
+  }
+  string line;
+  while (getline(in, line)) {
+    if (line.size() <= 2 || line[0] != '4' || line[1] != '2') {
+      continue;
+    }
+    string s = hasData(line);
+    if (s == "") {
+      continue;
+    }
+    auto j = json::parse(s);
+    Telemetry telemetry;
+    if (j[0].get<string>() == "telemetry" &&
+        TelemetryFromJson(j[1], &telemetry)) {
+      log->push_back(telemetry);
+    }
+  }
+  return true;
+}
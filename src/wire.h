@@ -0,0 +1,111 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stdint.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "json.hpp"
+
+using namespace std;
+
+/*
+Messages exchanged with a client.
+
+The Unity simulator speaks socket.io text: 42["telemetry",{...}] in and
+42["steer",{...}] out (see DATA.md). Our own clients may instead send
+uWS::OpCode::BINARY frames holding the same fields as a fixed, versioned
+little-endian layout: a header, the array counts, then packed doubles.
+The server answers every client in the format it was spoken to.
+
+  header     uint32 magic "MPCW", uint8 version, uint8 type, uint16 0
+  telemetry  uint32 n_pts
+             double x, y, psi, speed, steering_angle, throttle
+             double ptsx[n_pts], ptsy[n_pts]
+             optionally uint32 n_obstacles, then x, y, radius per obstacle
+  steer      uint32 n_mpc, uint32 n_next
+             double steering_angle, throttle
+             double mpc_x[n_mpc], mpc_y[n_mpc], next_x[n_next], next_y[n_next]
+  hello      uint32 supported version (sent back on a version mismatch)
+*/
+
+const uint32_t kWireMagic = 0x5743504D;  // "MPCW" read little-endian
+const uint8_t kWireVersion = 1;
+
+// The fewest waypoints telemetry may carry: the reference polynomial is a
+// cubic fit through them (ReferenceCoeffs in controller.h).
+const size_t kMinWaypoints = 4;
+
+enum WireType : uint8_t {
+  kWireHello = 0,
+  kWireTelemetry = 1,
+  kWireSteer = 2,
+  kWireManual = 3
+};
+
+// A static obstacle (cone, parked car) as a disk in map coordinates.
+struct Obstacle {
+  double x;
+  double y;
+  double radius;
+};
+
+// Telemetry sent by the simulator, fields as described in DATA.md.
+// Obstacles are optional, the Unity simulator never sends any.
+struct Telemetry {
+  vector<double> ptsx;
+  vector<double> ptsy;
+  double x = 0.0;
+  double y = 0.0;
+  double psi = 0.0;
+  double speed = 0.0;
+  double steering_angle = 0.0;
+  double throttle = 0.0;
+  vector<Obstacle> obstacles;
+};
+
+// Controls sent back to the simulator plus the lines it draws.
+struct Steer {
+  double steering_angle = 0.0;
+  double throttle = 0.0;
+  vector<double> mpc_x;
+  vector<double> mpc_y;
+  vector<double> next_x;
+  vector<double> next_y;
+};
+
+// Checks if the SocketIO event has JSON data.
+// If there is data the JSON object in string format will be returned,
+// else the empty string "" will be returned.
+string hasData(string s);
+
+// socket.io text messages. TelemetryFromJson() returns false on a missing
+// or non-numeric field, or fewer than kMinWaypoints.
+bool TelemetryFromJson(const nlohmann::json &data, Telemetry *t);
+nlohmann::json TelemetryToJson(const Telemetry &t);
+bool SteerFromJson(const nlohmann::json &data, Steer *s);
+nlohmann::json SteerToJson(const Steer &s);
+string TelemetryMessage(const Telemetry &t);
+string SteerMessage(const Steer &s);
+
+// Binary frames. Decoding returns false on a bad magic, version, type or
+// length, or fewer than kMinWaypoints; the caller answers a version
+// mismatch with EncodeHello().
+string EncodeTelemetry(const Telemetry &t);
+string EncodeSteer(const Steer &s);
+string EncodeHello();
+string EncodeManual();
+bool WireHeader(const char *data, size_t length, uint8_t *version,
+                uint8_t *type);
+bool DecodeTelemetry(const char *data, size_t length, Telemetry *t);
+bool DecodeSteer(const char *data, size_t length, Steer *s);
+
+// Recorded binary logs are a sequence of frames, each preceded by its
+// uint32 little-endian length.
+void WriteFrame(ostream &out, const string &frame);
+bool ReadFrame(istream &in, string *frame);
+
+// Telemetry of a recorded drive, either a text or a binary log.
+bool ReadTelemetryLog(const string &path, vector<Telemetry> *log);
+
+#endif /* WIRE_H */
@@ -0,0 +1,156 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "json.hpp"
+#include "wire.h"
+
+// for convenience
+using json = nlohmann::json;
+
+/*
+Convert recorded logs between the socket.io text format and the binary
+wire format.
+
+A text log is what `mpc` prints: one 42["telemetry",{...}] or
+42["steer",{...}] message per line, anything else is skipped.
+A binary log is a sequence of length-prefixed frames (see wire.h).
+
+  wire_convert to-binary drive.log drive.bin
+  wire_convert to-text   drive.bin drive.log
+
+`wire_convert check` runs good and malformed telemetry through both
+decoders and fails if a bad one is accepted or the good one isn't.
+*/
+
+int ToBinary(istream &in, ostream &out) {
+  string line;
+  int frames = 0;
+  while (getline(in, line)) {
+    if (line.size() <= 2 || line[0] != '4' || line[1] != '2') {
+      continue;
+    }
+    string s = hasData(line);
+    if (s == "") {
+      continue;
+    }
+    auto j = json::parse(s);
+    string event = j[0].get<string>();
+    Telemetry telemetry;
+    Steer steer;
+    if (event == "telemetry" && TelemetryFromJson(j[1], &telemetry)) {
+      WriteFrame(out, EncodeTelemetry(telemetry));
+      frames++;
+    } else if (event == "steer" && SteerFromJson(j[1], &steer)) {
+      WriteFrame(out, EncodeSteer(steer));
+      frames++;
+    }
+  }
+  return frames;
+}
+
+int ToText(istream &in, ostream &out) {
+  string frame;
+  int frames = 0;
+  while (ReadFrame(in, &frame)) {
+    Telemetry telemetry;
+    Steer steer;
+    if (DecodeTelemetry(frame.data(), frame.size(), &telemetry)) {
+      out << TelemetryMessage(telemetry) << endl;
+      frames++;
+    } else if (DecodeSteer(frame.data(), frame.size(), &steer)) {
+      out << SteerMessage(steer) << endl;
+      frames++;
+    }
+  }
+  return frames;
+}
+
+// Telemetry the server can solve, `n` waypoints ahead of the car.
+Telemetry GoodTelemetry(size_t n) {
+  Telemetry t;
+  for (size_t i = 0; i < n; i++) {
+    t.ptsx.push_back(10.0 * i);
+    t.ptsy.push_back(0.1 * i * i);
+  }
+  t.speed = 30.0;
+  return t;
+}
+
+// Whether each decoder takes `text` and `frame` as `accept` says.
+bool CheckCase(const string &name, const json &text, const string &frame,
+               bool accept) {
+  Telemetry t;
+  bool from_text = TelemetryFromJson(text, &t);
+  bool from_frame = DecodeTelemetry(frame.data(), frame.size(), &t);
+  bool ok = from_text == accept && from_frame == accept;
+  cout << (ok ? "ok      " : "FAILED  ") << name << ": text "
+       << (from_text ? "accepted" : "rejected") << ", binary "
+       << (from_frame ? "accepted" : "rejected") << endl;
+  return ok;
+}
+
+int Check() {
+  bool ok = true;
+  Telemetry good = GoodTelemetry(kMinWaypoints);
+  ok &= CheckCase("good", TelemetryToJson(good), EncodeTelemetry(good),
+                  true);
+
+  // the reference polynomial is a cubic, it can't be fit through these
+  Telemetry short_track = GoodTelemetry(kMinWaypoints - 1);
+  ok &= CheckCase("too few waypoints", TelemetryToJson(short_track),
+                  EncodeTelemetry(short_track), false);
+  Telemetry empty = GoodTelemetry(0);
+  ok &= CheckCase("no waypoints", TelemetryToJson(empty),
+                  EncodeTelemetry(empty), false);
+
+  json mismatched = TelemetryToJson(good);
+  mismatched["ptsy"].erase(0);
+  string truncated = EncodeTelemetry(good);
+  truncated.resize(truncated.size() - 8);
+  ok &= CheckCase("mismatched or truncated waypoints", mismatched,
+                  truncated, false);
+
+  json missing = TelemetryToJson(good);
+  missing.erase("speed");
+  string bad_magic = EncodeTelemetry(good);
+  bad_magic[0] ^= 0xff;
+  ok &= CheckCase("missing field or bad magic", missing, bad_magic, false);
+
+  json not_number = TelemetryToJson(good);
+  not_number["psi"] = "north";
+  string bad_version = EncodeTelemetry(good);
+  bad_version[4] = kWireVersion + 1;
+  ok &= CheckCase("non-numeric field or other version", not_number,
+                  bad_version, false);
+  return ok ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc == 2 && string(argv[1]) == "check") {
+    return Check();
+  }
+  if (argc != 4) {
+    cerr << "usage: " << argv[0] << " to-binary|to-text <in> <out>" << endl;
+    cerr << "       " << argv[0] << " check" << endl;
+    return -1;
+  }
+  string mode = argv[1];
+  ifstream in(argv[2], ios::binary);
+  ofstream out(argv[3], ios::binary);
+  if (!in || !out) {
+    cerr << "Failed to open " << argv[2] << " or " << argv[3] << endl;
+    return -1;
+  }
+
+  int frames;
+  if (mode == "to-binary") {
+    frames = ToBinary(in, out);
+  } else if (mode == "to-text") {
+    frames = ToText(in, out);
+  } else {
+    cerr << "Unknown mode " << mode << endl;
+    return -1;
+  }
+  cout << "Converted " << frames << " messages" << endl;
+  return 0;
+}